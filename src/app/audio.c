@@ -1,3 +1,7 @@
+/**
+ * @file audio.c
+ * @brief This module implements the audio behavior for the desktop application
+ */
 #include "audio.h"
 
 void generateSineWave(int16_t *samples, size_t sampleCount, float frequency, float amplitude, unsigned sampleRate)
@@ -23,28 +27,34 @@ sfSoundBuffer *createSineWaveBuffer(float frequency, float amplitude, unsigned s
     return buffer;
 }
 
-void noise()
+int init_audio(sounder *sounder)
 {
     float frequency = 440.0f;    // A4 note frequency
     float amplitude = 0.5f;      // Amplitude (0.0 to 1.0)
     unsigned sampleRate = 44100; // Standard sample rate
-    float duration = .05f;       // Duration in seconds
+    float duration = .1f;        // Holds exactly 44 periods, so the wave loops seamlessly
 
-    sfSoundBuffer *buffer = createSineWaveBuffer(frequency, amplitude, sampleRate, duration);
-    if (!buffer)
-    {
-        return; // Error handling
-    }
+    sounder->buffer = createSineWaveBuffer(frequency, amplitude, sampleRate, duration);
+    if (!sounder->buffer)
+        return EXIT_FAILURE;
 
-    sfSound *sound = sfSound_create();
-    sfSound_setBuffer(sound, buffer);
-    sfSound_play(sound);
+    sounder->sound = sfSound_create();
+    if (!sounder->sound)
+        return EXIT_FAILURE;
 
-    // Keep the application running while the sound plays
-    sfTime durationTime = sfSeconds(duration);
-    sfSleep(durationTime);
+    sfSound_setBuffer(sounder->sound, sounder->buffer);
+    sfSound_setLoop(sounder->sound, sfTrue);
+
+    return 0;
+}
 
-    // Cleanup
-    sfSound_destroy(sound);
-    sfSoundBuffer_destroy(buffer);
-}
\ No newline at end of file
+void buzzer(sounder *sounder, uint8_t on)
+{
+    if (!sounder->sound)
+        return;
+
+    if (on)
+        sfSound_play(sounder->sound);
+    else
+        sfSound_stop(sounder->sound);
+}
@@ -1,3 +1,8 @@
+/**
+ * @file audio.h
+ * @brief This module is used for the desktop application version of the CHIP-8 device
+ *  It is used to sound the device's buzzer via cSFML
+ */
 #ifndef AUDIO_H
 #define AUDIO_H
 
@@ -7,18 +12,45 @@
 #include <stdlib.h>
 
 /**
- * Generates a 
+ * @struct sounder
+ * @brief The sound resources of a buzzer. Each instance of the device has its own
+ */
+typedef struct sounder
+{
+    /**
+     * @brief The sound that is looped while the buzzer is on
+     */
+    sfSound *sound;
+    /**
+     * @brief The wavetable played by the sound
+     */
+    sfSoundBuffer *buffer;
+} sounder;
+
+/**
+ * @brief Generates a sine wave of the given frequency and amplitude into the given samples
  */
 void generateSineWave(int16_t *samples, size_t sampleCount, float frequency, float amplitude, unsigned sampleRate);
 
 /**
- * 
+ * @brief Creates a sound buffer holding the given duration of a sine wave
  */
 sfSoundBuffer *createSineWaveBuffer(float frequency, float amplitude, unsigned sampleRate, float duration);
 
 /**
- * 
+ * @brief Precomputes the buzzer's wavetable and creates the looping sound that plays it
+ *
+ * @param sounder - The sounder to be initialized
+ * @return 0 on success. EXIT_FAILURE if the sound could not be created
+ */
+int init_audio(sounder *sounder);
+
+/**
+ * @brief A function that starts or stops the buzzer. It never blocks
+ *
+ * @param sounder - The sounder of the buzzer
+ * @param on - 1 to start the buzzer, 0 to stop it
  */
-void noise();
+void buzzer(sounder *sounder, uint8_t on);
 
-#endif
\ No newline at end of file
+#endif
@@ -4,79 +4,152 @@
  */
 #include "graphics.h"
 
-sfImage *image = NULL; 
-sfTexture *texture = NULL;
-sfSprite *sprite = NULL;
-sfWindow *window = NULL;
+/**
+ * Fills the lookup table with the RGBA pixels each entry expands to. The palette holds a color for each
+ * combination of planes, indexed by their bits, the first plane as the least significant
+ */
+static void build_pixel_lut(renderer *renderer, const sfColor *palette)
+{
+    uint32_t colors[1 << SCREEN_PLANES];
+    // sfColor is laid out as the RGBA bytes the texture expects
+    memcpy(colors, palette, sizeof(colors));
+
+    for (int i = 0; i < 256; i++)
+        for (int j = 0; j < LUT_PIXELS; j++)
+        {
+            uint8_t color = 0;
+            for (int plane = 0; plane < SCREEN_PLANES; plane++)
+                color |= ((i >> (plane * LUT_PIXELS + LUT_PIXELS - 1 - j)) & 1) << plane;
+            renderer->pixel_lut[i][j] = colors[color];
+        }
+}
 
-int init_screen(int width, int height, float scale_factor)
+/**
+ * Returns the lookup table entry of the given part of a byte of a row, LUT_PIXELS pixels from the left
+ */
+static inline uint8_t lut_index(const uint8_t *row, int i, int part)
 {
-    const sfVideoMode mode = {width, height, 32};
-    window = sfRenderWindow_create(mode, "CHIP-8", sfResize | sfClose, NULL);
+#if SCREEN_PLANES > 1
+    uint8_t shift = (1 - part) * LUT_PIXELS;
+    return ((row[i] >> shift) & 0x0F) | (((row[i + SCREEN_PLANE_BYTES] >> shift) & 0x0F) << 4);
+#else
+    return row[i];
+#endif
+}
 
-    image = sfImage_create(SCREEN_W, SCREEN_H);
-    sfImage_createMaskFromColor(image, sfBlack, 0);
+int init_screen(renderer *renderer, int width, int height, float scale_factor, unsigned int scale)
+{
+    const sfVideoMode mode = {width, height, 32};
+    renderer->window = sfRenderWindow_create(mode, "CHIP-8", sfResize | sfClose, NULL);
 
-    if (!window)
+    if (!renderer->window)
         return EXIT_FAILURE;
 
-    texture = sfTexture_createFromImage(image, NULL);
-    sprite = sfSprite_create();
-    
-    sfSprite_setTexture(sprite, texture, sfTrue);
-    sfVector2f scale;
-    scale.x = scale_factor;
-    scale.y = scale_factor;
-    sfSprite_setScale(sprite, scale);
+    unsigned int pixel_scale = (scale > 0) ? scale : 1;
+    renderer->pixel_scale = pixel_scale;
+    renderer->hires = 0;
+    renderer->pixels = calloc(SCREEN_W * pixel_scale * SCREEN_H * pixel_scale, sizeof(uint32_t));
+    // Unset, the first plane, the second plane (XO-CHIP), and both
+    const sfColor palette[] = {sfBlack, sfWhite, {0xFF, 0x66, 0x00, 0xFF}, {0x66, 0x22, 0x00, 0xFF}};
+    build_pixel_lut(renderer, palette);
+
+    renderer->texture = sfTexture_create(SCREEN_W * pixel_scale, SCREEN_H * pixel_scale);
+    renderer->sprite = sfSprite_create();
+
+    sfSprite_setTexture(renderer->sprite, renderer->texture, sfTrue);
+    sfVector2f sprite_scale;
+    sprite_scale.x = scale_factor / pixel_scale;
+    sprite_scale.y = scale_factor / pixel_scale;
+    sfSprite_setScale(renderer->sprite, sprite_scale);
 
     return 0;
 }
 
-void draw_screen(uint8_t *screen)
+void set_screen_resolution(renderer *renderer, uint8_t hires)
 {
-    uint8_t x = 0;
-    uint8_t y = 0;
-    uint8_t pixels;
-    sfColor color;
+    renderer->hires = hires;
+}
+
+void draw_screen(renderer *renderer, uint8_t *screen)
+{
+    draw_screen_region(renderer, screen, 0, renderer->hires ? SCREEN_H : LORES_SCREEN_H);
+}
 
-    for (int i = 0; i < SCREEN_BYTES; i++)
+void draw_screen_region(renderer *renderer, uint8_t *rows, uint8_t first_row, uint8_t row_count)
+{
+    // Low resolution pixels are twice the size of high resolution ones, and only cover half of each row
+    unsigned int pixel_scale = renderer->pixel_scale * (renderer->hires ? 1 : 2);
+    int row_bytes = renderer->hires ? H_OFFSET : LORES_SCREEN_W / 8;
+    uint32_t (*pixel_lut)[LUT_PIXELS] = renderer->pixel_lut;
+    unsigned int line_width = SCREEN_W * renderer->pixel_scale;
+    uint32_t *first_line = &renderer->pixels[first_row * pixel_scale * line_width];
+    uint32_t *line, *pixel;
+    uint8_t *row;
+
+    for (int y = 0; y < row_count; y++)
     {
+        row = &rows[y * H_OFFSET];
+        line = &first_line[y * pixel_scale * line_width];
 
-        if (i % H_OFFSET == 0)
+        if (pixel_scale == 1)
         {
-            x = 0;
-            y++;
+            for (int i = 0; i < row_bytes; i++)
+                for (int part = 0; part < 8 / LUT_PIXELS; part++)
+                    memcpy(&line[i * 8 + part * LUT_PIXELS], pixel_lut[lut_index(row, i, part)], sizeof(pixel_lut[0]));
+            continue;
         }
 
-        pixels = screen[i];
-        color = sfBlack;
-        for (int j = 8; j > 0; j--, pixels <<= 1)
-        {
-            color = ((pixels & 0b10000000) != 0) ? sfWhite : sfBlack;
-            sfImage_setPixel(image, x++, y, color);
-        }
+        pixel = line;
+        for (int i = 0; i < row_bytes; i++)
+            for (int j = 0; j < 8; j++)
+                for (unsigned int k = 0; k < pixel_scale; k++)
+                    *pixel++ = pixel_lut[lut_index(row, i, j / LUT_PIXELS)][j % LUT_PIXELS];
+
+        // The remaining lines of a scaled row are copies of its first
+        for (unsigned int k = 1; k < pixel_scale; k++)
+            memcpy(&line[k * line_width], line, line_width * sizeof(uint32_t));
     }
 
-    sfTexture_updateFromImage(texture, image, 0, 0);
-    sfRenderWindow_drawSprite(window, sprite, NULL);
-    sfRenderWindow_display(window);
+    // Only the changed rows are uploaded to the texture
+    sfTexture_updateFromPixels(renderer->texture, (sfUint8 *)first_line, line_width, row_count * pixel_scale,
+                               0, first_row * pixel_scale);
+    sfRenderWindow_drawSprite(renderer->window, renderer->sprite, NULL);
+    sfRenderWindow_display(renderer->window);
 }
 
-void start_render_loop(chip8 *cpu, unsigned int frame_limit)
+void start_render_loop(renderer *renderer, chip8 *cpu, unsigned int frame_limit, rewind_buffer *rewind, recording *recording)
 {
-    // Kind of hacky solution to the CHIP-8 timing
-    sfWindow_setFramerateLimit(window, frame_limit);
+    sfClock *clock = sfClock_create();
+    sfInt64 frame_time = sfTime_asMicroseconds(sfSeconds(1.0f / frame_limit));
 
     sfEvent event;
-    while (sfRenderWindow_isOpen(window))
+    while (sfRenderWindow_isOpen(renderer->window))
     {
-        chip8_run(cpu);
+        if (rewind != NULL && sfKeyboard_isKeyPressed(REWIND_KEY))
+        {
+            // Rather than running, step back a frame. Nothing is drawn if there's nothing left to step back to
+            if (rewind_step_back(rewind, cpu) == 0)
+                draw_screen(renderer, cpu->state.screen);
+        }
+        else
+        {
+            if (recording != NULL)
+                recording_frame(recording);
+            chip8_run_frame(cpu);
+            if (rewind != NULL)
+                rewind_capture(rewind, cpu);
+        }
 
-        while (sfRenderWindow_pollEvent(window, &event))
+        while (sfRenderWindow_pollEvent(renderer->window, &event))
         {
             if (event.type == sfEvtClosed)
-                sfRenderWindow_close(window);
+                sfRenderWindow_close(renderer->window);
         }
 
+        // Sleep off the rest of the frame, so the device runs in real time
+        sfSleep(sfMicroseconds(frame_time - sfTime_asMicroseconds(sfClock_getElapsedTime(clock))));
+        sfClock_restart(clock);
     }
-}
\ No newline at end of file
+
+    sfClock_destroy(clock);
+}
@@ -10,47 +10,119 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../chip8/chip8.h"
+#include "../host/rewind.h"
+#include "../host/recording.h"
 
 /**
- * @brief Image that is displayed to the screen
+ * @def REWIND_KEY
+ * @brief The key that steps the device back a frame at a time, for as long as it's held
  */
-extern sfImage *image;
-/**
- * @brief The texture that wraps the above image
- */
-extern sfTexture *texture;
+#define REWIND_KEY sfKeyBackspace
+
 /**
- * @brief The sprite that uses the texture to display content to the screen
+ * @def LUT_PIXELS
+ * @brief The number of RGBA pixels each entry of the pixel lookup table expands to. With one plane, an entry is
+ *  a whole byte of the screen buffer. With two, it's 4 pixels of each plane, the first plane's as its low nibble,
+ *  so that the planes are composited by the lookup rather than pixel by pixel
  */
-extern sfSprite *sprite;
+#if SCREEN_PLANES == 1
+#define LUT_PIXELS 8
+#elif SCREEN_PLANES == 2
+#define LUT_PIXELS 4
+#else
+#error "The renderer composites at most two planes"
+#endif
+
 /**
- * @brief The window responsible for visually displaying our device
+ * @struct renderer
+ * @brief The window and the resources used to draw a CHIP-8 screen buffer to it.
+ * Each instance of the device being displayed has its own
  */
-extern sfWindow *window;
+typedef struct renderer
+{
+    /**
+     * @brief The texture the screen's pixels are uploaded to
+     */
+    sfTexture *texture;
+    /**
+     * @brief The sprite that uses the texture to display content to the screen
+     */
+    sfSprite *sprite;
+    /**
+     * @brief The window responsible for visually displaying our device
+     */
+    sfRenderWindow *window;
+    /**
+     * @brief The RGBA pixels of the screen, as last drawn. These are uploaded to the texture row by row.
+     * Each pixel of the device is expanded to pixel_scale x pixel_scale of these pixels
+     */
+    uint32_t *pixels;
+    /**
+     * @brief The factor by which pixels are scaled up on the CPU, before being uploaded to the texture
+     */
+    unsigned int pixel_scale;
+    /**
+     * @brief Set while the device's screen is in high resolution. The texture is always SCREEN_W x SCREEN_H
+     * (times pixel_scale), so pixels in low resolution are drawn twice as large
+     */
+    uint8_t hires;
+    /**
+     * @brief Lookup table of the RGBA pixels that each byte of the screen buffer expands to, colored by
+     * which planes are set. @see LUT_PIXELS
+     */
+    uint32_t pixel_lut[256][LUT_PIXELS];
+} renderer;
 
 /**
  * @brief Creates the cSFML window according to the given parameters
+ * @param renderer - The renderer to be initialized
  * @param width - The width of the window to be created
  * @param heigh - The height of the window to be created
- * @param scale_factor - How the image should be scaled relative to the window size
+ * @param scale_factor - How the image should be scaled relative to the window size, per high resolution pixel
+ * @param scale - An integer factor that the pixels are scaled up by on the CPU, ahead of the texture upload.
+ *  The remainder of scale_factor is left to the sprite. 1 leaves all scaling to the sprite
+ */
+int init_screen(renderer *renderer, int width, int height, float scale_factor, unsigned int scale);
+
+/**
+ * @brief Sets the resolution the CHIP-8 screen buffer is drawn at, as given to the resolution peripheral
+ *
+ * @param renderer - The renderer of the window to be drawn to
+ * @param hires - 1 for high resolution, 0 for low
  */
-int init_screen(int width, int height, float scale_factor);
+void set_screen_resolution(renderer *renderer, uint8_t hires);
 
 /**
  * @brief A function that draws the given CHIP-8 screen buffer to a desktop window
- * This function adheres to the signature described by the peripheral in @see chip8.h
  *
+ * @param renderer - The renderer of the window to be drawn to
  * @param screen - The CHIP-8 screen buffer
  */
-void draw_screen(uint8_t *screen);
+void draw_screen(renderer *renderer, uint8_t *screen);
+
+/**
+ * @brief A function that draws the given rows of a CHIP-8 screen buffer to a desktop window.
+ * Only the given rows are converted and uploaded to the window's texture
+ *
+ * @param renderer - The renderer of the window to be drawn to
+ * @param rows - The first row to be drawn, within the CHIP-8 screen buffer
+ * @param first_row - The index of the first row to be drawn
+ * @param row_count - The number of rows to be drawn
+ */
+void draw_screen_region(renderer *renderer, uint8_t *rows, uint8_t first_row, uint8_t row_count);
 
 /**
- * @brief Starts a loop that runs the given cpu, periodically rendering the contents
+ * @brief Starts a loop that runs the given cpu a frame at a time, periodically rendering the contents
  * of the device's screen to the application window
  *
+ * @param renderer - The renderer of the window the device is displayed in
  * @param cpu - The CHIP-8 device to emulate and render for
- * @param frame_limit - Sets the rate at which the window is polled
+ * @param frame_limit - The number of frames run per second. The window is polled once per frame
+ * @param rewind - Where each frame is captured, to be stepped back through while REWIND_KEY is held.
+ *  May be NULL, in which case the device can't be rewound
+ * @param recording - The recording the device's peripherals are wired through, told of the start of each frame.
+ *  May be NULL
  */
-void start_render_loop(chip8 *cpu, unsigned int frame_limit);
+void start_render_loop(renderer *renderer, chip8 *cpu, unsigned int frame_limit, rewind_buffer *rewind, recording *recording);
 
 #endif
\ No newline at end of file
@@ -22,37 +22,24 @@ sfKeyCode keyMap[16] = {
     [0xE] = sfKeyF,
     [0xF] = sfKeyV};
 
-void load_program(char *file_name, uint8_t *program)
-{
-    long lSize;
-    FILE *file = fopen(file_name, "rb");
-
-    // obtain file size:
-    fseek(file, 0, SEEK_END);
-    lSize = ftell(file);
-    rewind(file);
-
-    fread(program, 1, lSize, file);
-}
-
-uint8_t rand_byte()
+uint8_t rand_byte(void *user)
 {
     uint8_t r = rand() % 256;
     return r;
 }
 
-uint8_t get_key_pressed()
+uint8_t get_key_pressed(void *user)
 {
     // Block
     while (1)
     {
         for (int i = 0; i < 0xF; i++)
-            if (is_key_pressed(i))
+            if (is_key_pressed(user, i))
                 return i;
     }
 }
 
-uint8_t is_key_pressed(uint8_t key)
+uint8_t is_key_pressed(void *user, uint8_t key)
 {
     sfBool isPressed = sfKeyboard_isKeyPressed(keyMap[key]);
     return (isPressed == sfTrue) ? 1 : 0;
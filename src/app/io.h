@@ -1,7 +1,7 @@
 /**
  * @file io.h
  * @brief This module is used for the desktop application version of the CHIP-8 device
- *  It is used to capture input/output via a keyboard (provided by cSFML) and to load program files
+ *  It is used to capture input/output via a keyboard (provided by cSFML)
  */
 #ifndef IO_H
 #define IO_H
@@ -20,32 +20,27 @@ extern sfKeyCode keyMap[16];
  * @brief A blocking function that waits for the user to press a key
  * This function adheres to the signature described by the peripheral in @see chip8.h
  *
+ * @param user - The peripheral's context. Unused, as the keyboard is shared
  * @return The key code presed
  */
-uint8_t get_key_pressed();
+uint8_t get_key_pressed(void *user);
 
 /**
  * @brief A function that checks if the given key code was pressed
  * This function adheres to the signature described by the peripheral in @see chip8.h
+ * @param user - The peripheral's context. Unused, as the keyboard is shared
  * @param key - The key to be checked
  * @returns 1 - if the key was pressed. 0 otherwise.
  */
-uint8_t is_key_pressed(uint8_t key);
+uint8_t is_key_pressed(void *user, uint8_t key);
 
 /**
  * @brief A function that returns a random value between 0 - 255 (inclusive)
  * This function adheres to the signature described by the peripheral in @see chip8.h
  *
+ * @param user - The peripheral's context. Unused
  * @returns a random number between 0 - 255 (inclusive)
  */
-uint8_t rand_byte();
-
-/**
- * @brief Loads the give file ands writes its contents to the given program memory
- *
- * @param file_name - The path of the program file to be read from
- * @param program - The pointer to the memory location for the program to be loaded to
- */
-void load_program(char *file_name, uint8_t *program);
+uint8_t rand_byte(void *user);
 
 #endif
\ No newline at end of file
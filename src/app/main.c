@@ -4,41 +4,142 @@
  *
  * This module demonstrates a generic use case of our CHIP-8 module @see chip8.h
  * It leverages function pointers passed through peripherals to keep the device more portable
+ *
+ * Usage: chip8 program.ch8 [cycles_per_frame] [--record FILE]
+ * With --record, the keys and random bytes of every frame are recorded, to be replayed by chip8_headless.
+ * Rewinding is disabled while recording, as the recording can only run forwards
  */
 
 #include "graphics.h"
 #include "../chip8/chip8.h"
 #include "audio.h"
-#include "audio.h"
 #include "io.h"
+#include "../host/rom.h"
+
+/**
+ * @struct app
+ * @brief The context given to the desktop application's peripherals
+ */
+typedef struct app
+{
+    renderer renderer;
+    sounder sounder;
+} app;
 
-void init_peripherals(peripherals *peripherals);
+void init_peripherals(peripherals *peripherals, app *app);
 
 int main(int argc, char *argv[])
 {
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s program.ch8 [cycles_per_frame] [--record FILE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
     srand(time(0));
 
     // Setup
+    app app = {0};
     peripherals peripherals;
-    init_peripherals(&peripherals);
+    init_peripherals(&peripherals, &app);
     uint8_t memory[RAM_SIZE];
     uint8_t program_memory[PROGRAM_SIZE];
-    load_program(argv[1], program_memory);
-    chip8_config config = {&peripherals, memory, program_memory};
+    op decode_cache[DECODE_CACHE_SIZE];
+    if (load_rom(argv[1], program_memory) < 0)
+    {
+        fprintf(stderr, "Could not load %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    // Optionally, the number of instructions run per frame may be given
+    uint16_t cycles_per_frame = CYCLES_PER_FRAME;
+    const char *record_file = NULL;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_file = argv[++i];
+        else
+            cycles_per_frame = atoi(argv[i]);
+    }
+
+    // When recording, the device's inputs are wired through the recording
+    recording input_recording;
+    recording *active_recording = NULL;
+    if (record_file != NULL)
+    {
+        if (recording_start(&input_recording, record_file, &peripherals, program_memory, cycles_per_frame) < 0)
+        {
+            fprintf(stderr, "Could not record to %s\n", record_file);
+            return EXIT_FAILURE;
+        }
+        active_recording = &input_recording;
+    }
+    chip8_config config = {(active_recording != NULL) ? &input_recording.peripherals : &peripherals, memory, program_memory,
+                           decode_cache, cycles_per_frame};
 
     // Init chip8
     chip8 cpu = chip8_init(&config);
 
-    // Start graphics loop
-    init_screen(SCREEN_W * 8, SCREEN_H * 8, 8.0f);
-    start_render_loop(&cpu, 60);
+    // The last REWIND_SECONDS of frames may be stepped back through
+    rewind_buffer *rewind_frames = (active_recording == NULL) ? malloc(sizeof(rewind_buffer)) : NULL;
+    if (rewind_frames != NULL && rewind_init(rewind_frames, 0, 0) < 0)
+    {
+        free(rewind_frames);
+        rewind_frames = NULL;
+    }
+
+    // Start audio and graphics loop
+    init_audio(&app.sounder);
+    if (init_screen(&app.renderer, SCREEN_W * 4, SCREEN_H * 4, 4.0f, 1) != 0)
+    {
+        fprintf(stderr, "Could not open the window\n");
+        if (rewind_frames != NULL)
+        {
+            rewind_free(rewind_frames);
+            free(rewind_frames);
+        }
+        if (active_recording != NULL)
+            recording_close(active_recording);
+        return EXIT_FAILURE;
+    }
+    start_render_loop(&app.renderer, &cpu, TIMER_HZ, rewind_frames, active_recording);
+
+    if (rewind_frames != NULL)
+    {
+        rewind_free(rewind_frames);
+        free(rewind_frames);
+    }
+    if (active_recording != NULL)
+        recording_close(active_recording);
+}
+
+void app_display(void *user, uint8_t *screen)
+{
+    draw_screen(&((app *)user)->renderer, screen);
+}
+
+void app_display_region(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count)
+{
+    draw_screen_region(&((app *)user)->renderer, rows, first_row, row_count);
+}
+
+void app_resolution(void *user, uint8_t hires)
+{
+    set_screen_resolution(&((app *)user)->renderer, hires);
+}
+
+void app_buzzer(void *user, uint8_t on)
+{
+    buzzer(&((app *)user)->sounder, on);
 }
 
-void init_peripherals(peripherals *peripherals)
+void init_peripherals(peripherals *peripherals, app *app)
 {
-    peripherals->display = &draw_screen;
+    peripherals->user = app;
+    peripherals->display = &app_display;
+    peripherals->display_region = &app_display_region;
+    peripherals->resolution = &app_resolution;
+    peripherals->present_mode = PRESENT_VBLANK;
     peripherals->get_key_pressed = &get_key_pressed;
     peripherals->is_key_pressed = &is_key_pressed;
     peripherals->random = &rand_byte;
-    peripherals->noise = &noise;
+    peripherals->buzzer = &app_buzzer;
 }
\ No newline at end of file
@@ -8,6 +8,8 @@
 extern "C"
 {
 #include "chip8/chip8.h"
+#include "chip8/aot.h"
+#include "chip8/trace.h"
 };
 #include "roms/roms.h"
 
@@ -19,6 +21,10 @@ byte device_state = STATE_LAUNCHER;
 byte selected_rom_idx = 0;
 byte prev_selected_rom_idx = -1;
 
+/* Launcher */
+/* The most characters of a ROM's name that are shown */
+#define ROM_NAME_LENGTH 24
+
 /* Display */
 #define TFT_DC 28
 #define TFT_CS 30
@@ -26,8 +32,18 @@ Adafruit_ILI9341 tft = Adafruit_ILI9341(TFT_CS, TFT_DC);
 
 /* CHIP-8 */
 chip8 cpu;
-uint8_t chip8_memory[RAM_SIZE];
+peripherals chip8_peripherals;
+/* With CHIP8_PAGED_MEMORY, only the page pool is held in SRAM and the ROM is read from flash */
+uint8_t chip8_memory[MEMORY_SIZE];
+#ifndef CHIP8_PAGED_MEMORY
 uint8_t *program_memory = &chip8_memory[PROGRAM_OFFSET];
+#endif
+#if CHIP8_TRACE_LEVEL > 0
+trace_buffer chip8_trace;
+#endif
+/* The ahead-of-time translation of the running ROM, when built with CHIP8_AOT */
+aot translated;
+byte use_translated = 0;
 
 /* Keypad setup */
 const byte KEYPAD_ROWS = 4;
@@ -42,71 +58,159 @@ char keys[KEYPAD_ROWS][KEYPAD_COLS] = {
 
 Keypad keypad = Keypad(makeKeymap(keys), rowPins, colPins, KEYPAD_ROWS, KEYPAD_COLS);
 
+/* Set while the CHIP-8's screen is in SUPER-CHIP high resolution */
+byte hires = 0;
+
+/* The color of each combination of the screen's planes, indexed by their bits: unset, then the first plane,
+   the second (XO-CHIP), and both */
+#if SCREEN_PLANES > 1
+const uint16_t palette[1 << SCREEN_PLANES] = {ILI9341_WHITE, ILI9341_RED, ILI9341_BLUE, ILI9341_BLACK};
+#else
+const uint16_t palette[1 << SCREEN_PLANES] = {ILI9341_WHITE, ILI9341_RED};
+#endif
+
 /**
- * Passed to our CHIP-8 instance as a display peripheral
- * This function takes the CHIP-8's screen buffer as a parameter and renders it pixel-by-pixel
+ * Passed to our CHIP-8 instance as a display_region peripheral
+ * This function takes the changed rows of the CHIP-8's screen buffer and renders only those, pixel-by-pixel,
+ * to the display given as the user context
  */
-void draw(uint8_t *screen_buffer)
+void draw_region(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count)
 {
+  Adafruit_ILI9341 *screen = (Adafruit_ILI9341 *)user;
+  // Low resolution only takes up the first half of each row of the buffer
+  uint8_t row_bytes = hires ? H_OFFSET : LORES_SCREEN_W / 8;
   uint8_t x, y, pixels;
-  x = 0;
-  y = 0;
-  uint16_t color;
-  for (int i = 0; i < SCREEN_BYTES; i++)
+  uint16_t offset;
+#if SCREEN_PLANES > 1
+  uint8_t second_pixels;
+#endif
+  for (int i = 0; i < row_count * row_bytes; i++)
   {
-    if (i % H_OFFSET == 0)
-    {
-      x = 0;
-      y++;
-    }
-
-    pixels = screen_buffer[i];
-
+    x = (i % row_bytes) * 8;
+    y = first_row + (i / row_bytes);
+    offset = (i / row_bytes) * H_OFFSET + (i % row_bytes);
+    pixels = rows[offset];
+#if SCREEN_PLANES > 1
+    // The same pixels of the second plane are a plane's worth of bytes along
+    second_pixels = rows[offset + SCREEN_PLANE_BYTES];
+    for (int j = 8; j > 0; j--, pixels <<= 1, second_pixels <<= 1)
+      screen->drawPixel(x++, y, palette[(pixels >> 7) | ((second_pixels >> 7) << 1)]);
+#else
     for (int j = 8; j > 0; j--, pixels <<= 1)
-    {
-      color = ((pixels & 0b10000000) != 0) ? ILI9341_RED : ILI9341_WHITE;
-      tft.drawPixel(x++, y, color);
-    }
+      screen->drawPixel(x++, y, palette[pixels >> 7]);
+#endif
   }
 }
 
+/**
+ * Passed to our CHIP-8 instance as a display peripheral
+ * This function takes the CHIP-8's screen buffer as a parameter and renders it pixel-by-pixel
+ */
+void draw(void *user, uint8_t *screen_buffer)
+{
+  draw_region(user, screen_buffer, 0, hires ? SCREEN_H : LORES_SCREEN_H);
+}
+
+/**
+ * Passed to our CHIP-8 instance as a resolution peripheral
+ * Clears the whole of the high resolution area, so that nothing is left outside of a low resolution screen
+ */
+void set_resolution(void *user, uint8_t new_hires)
+{
+  hires = new_hires;
+  ((Adafruit_ILI9341 *)user)->fillRect(0, 0, SCREEN_W, SCREEN_H, ILI9341_WHITE);
+}
+
+#if CHIP8_TRACE_LEVEL > 0
+/**
+ * Passed to the trace buffer as its sink
+ * Each flushed block is written, as is, to the serial port given as the user context. @see tracedump.c
+ */
+void write_trace(void *user, const uint8_t *block, uint16_t size)
+{
+  ((HardwareSerial *)user)->write(block, size);
+}
+#endif
+
+/**
+ * Reads the given entry of the ROM library out of flash
+ */
+rom_entry read_rom_entry(unsigned int index)
+{
+  rom_entry entry;
+  memcpy_P(&entry, &rom_index[index], sizeof(entry));
+  return entry;
+}
+
 /**
  * Function that is called to draw the launcher menu - a list of selectable ROMs 
+ * The names are read out of flash one at a time, so only the longest ever takes up SRAM
  */
-void draw_launcher(Adafruit_ILI9341 *screen, unsigned int selected_index, const char *selections[], unsigned int length)
+void draw_launcher(Adafruit_ILI9341 *screen, unsigned int selected_index, unsigned int length)
 {
   tft.fillScreen(ILI9341_BLACK);
   tft.setCursor(0, 0);
   int16_t x, y;
   uint16_t w, h;
+  char name[ROM_NAME_LENGTH + 1];
   for (unsigned int i = 0; i < length; i++)
   {
+    strncpy_P(name, read_rom_entry(i).name, ROM_NAME_LENGTH);
+    name[ROM_NAME_LENGTH] = '\0';
     screen->setTextColor(ILI9341_WHITE);
 
     // Highlight the curently selected title
     if (i == selected_index)
     {
-      screen->getTextBounds(selections[i], screen->getCursorX(), screen->getCursorY(), &x, &y, &w, &h);
+      screen->getTextBounds(name, screen->getCursorX(), screen->getCursorY(), &x, &y, &w, &h);
       screen->fillRect(x, y, w, h, ILI9341_WHITE);
       screen->setTextColor(ILI9341_BLACK);
     }
-    screen->println(selections[i]);
+    screen->println(name);
   }
 }
 
+/**
+ * Resets the CHIP-8 to run the given ROM. Its program memory is zeroed past the ROM's end
+ */
+void load_rom(rom_entry *rom)
+{
+  unsigned int size = (rom->size < PROGRAM_SIZE) ? rom->size : PROGRAM_SIZE;
+#ifdef CHIP8_PAGED_MEMORY
+  // The ROM is read straight out of flash, until a page of it is written
+  init_state(&(cpu.state), chip8_memory, (uint8_t *)rom->program);
+  cpu.state.program_size = size;
+#else
+  init_state(&(cpu.state), chip8_memory, program_memory);
+  memcpy_P(program_memory, rom->program, size);
+  memset(&program_memory[size], 0, PROGRAM_SIZE - size);
+#endif
+#if CHIP8_TRACE_LEVEL > 0
+  // Initializing the state detached the trace, which starts over with the new ROM
+  chip8_trace_attach(&(cpu.state), &chip8_trace, &write_trace, &Serial);
+#endif
+}
+
 void setup()
 {
   Serial.begin(115200);
   tft.begin();
 
-  peripherals peripherals;
-  peripherals.display = &draw;
-  peripherals.get_key_pressed = NULL;
-  peripherals.is_key_pressed = NULL;
-  peripherals.random = NULL;
-  peripherals.noise = NULL;
+  chip8_peripherals.user = &tft;
+  chip8_peripherals.display = &draw;
+  chip8_peripherals.display_region = &draw_region;
+  chip8_peripherals.resolution = &set_resolution;
+  chip8_peripherals.present_mode = PRESENT_VBLANK;
+  chip8_peripherals.get_key_pressed = NULL;
+  chip8_peripherals.is_key_pressed = NULL;
+  chip8_peripherals.random = NULL;
+  chip8_peripherals.buzzer = NULL;
 
-  chip8_config config = {&peripherals, chip8_memory, program_memory};
+#ifdef CHIP8_PAGED_MEMORY
+  chip8_config config = {&chip8_peripherals, chip8_memory, NULL};
+#else
+  chip8_config config = {&chip8_peripherals, chip8_memory, program_memory};
+#endif
 
   cpu = chip8_init(&config);
 }
@@ -125,28 +229,44 @@ void loop()
 
     // Down on d-pad
     case '8':
-      selected_rom_idx += (selected_rom_idx < ROMS_COUNT) ? 1 : 0;
+      selected_rom_idx += (selected_rom_idx < ROMS_COUNT - 1) ? 1 : 0;
       break;
 
     case '=':
-      init_state(&(cpu.state), chip8_memory, program_memory);
-      memcpy(program_memory, rom_programs[selected_rom_idx], rom_programs_sizes[selected_rom_idx]);
+    {
+      rom_entry rom = read_rom_entry(selected_rom_idx);
+      load_rom(&rom);
+#ifdef CHIP8_AOT
+      const aot_program *program = aot_find(&cpu, aot_programs, aot_program_count);
+      use_translated = program != NULL && aot_init(&translated, &cpu, program) == 0;
+#endif
       device_state = STATE_RUNNING;
       break;
+    }
 
     case '/':
       device_state = (device_state == STATE_LAUNCHER) ? STATE_RUNNING : STATE_LAUNCHER;
       break;
     }
     if (prev_selected_rom_idx != selected_rom_idx)
-      draw_launcher(&tft, selected_rom_idx, rom_names, ROMS_COUNT);
+      draw_launcher(&tft, selected_rom_idx, ROMS_COUNT);
     prev_selected_rom_idx = selected_rom_idx;
   }
   else if (device_state == STATE_RUNNING)
   {
-    Serial.print(cpu.state.memory[cpu.state.PC], HEX);
-    Serial.print(cpu.state.memory[cpu.state.PC + 1], HEX);
-    Serial.println();
-    chip8_run(&cpu);
+#if CHIP8_TRACE_LEVEL > 0
+    // Anything sent over the serial port asks for the trace, which is otherwise only sent on a fault
+    if (Serial.available() > 0)
+    {
+      Serial.read();
+      chip8_trace_flush(&chip8_trace, TRACE_REQUESTED);
+    }
+#endif
+    // Translated blocks only pay off when run for more than one instruction at a time, so a whole frame is
+    // run per loop
+    if (use_translated)
+      aot_run_frame(&translated);
+    else
+      chip8_run(&cpu);
   }
 }
@@ -1,4 +1,4 @@
-unsigned char roms_games_br8kout[] = {
+const unsigned char roms_games_br8kout[] PROGMEM = {
   0x12, 0x9f, 0xfc, 0xfc, 0x80, 0xa2, 0x02, 0xdd, 0xc1, 0x00, 0xee, 0xa2,
   0x04, 0xdb, 0xa1, 0x00, 0xee, 0xa2, 0x03, 0x60, 0x02, 0x61, 0x05, 0x87,
   0x00, 0x86, 0x10, 0xd6, 0x71, 0x71, 0x08, 0x6f, 0x38, 0x8f, 0x17, 0x4f,
@@ -17,5 +17,5 @@ unsigned char roms_games_br8kout[] = {
   0x11, 0x60, 0x07, 0xe0, 0xa1, 0x22, 0x3b, 0x60, 0x09, 0xe0, 0xa1, 0x22,
   0x33, 0x22, 0x63, 0x22, 0x93, 0x12, 0xb5
 };
-unsigned int roms_games_br8kout_len = 199;
-const char* br8kout = "br8kout";
+const unsigned int roms_games_br8kout_len = 199;
+const char roms_games_br8kout_name[] PROGMEM = "br8kout";
@@ -1,4 +1,4 @@
-unsigned char roms_games_down8[] = {
+const unsigned char roms_games_down8[] PROGMEM = {
   0x14, 0x36, 0x47, 0x01, 0x00, 0xee, 0x67, 0x01, 0x65, 0xfe, 0x22, 0x54,
   0x76, 0x01, 0xa4, 0xea, 0xf6, 0x33, 0x22, 0x54, 0xa4, 0xee, 0xf2, 0x65,
   0x6f, 0x09, 0x8f, 0x45, 0x4f, 0x00, 0x12, 0x26, 0x69, 0x08, 0x88, 0x00,
@@ -135,5 +135,5 @@ unsigned char roms_games_down8[] = {
   0x00, 0xff, 0x00, 0x00, 0x00, 0xff, 0x11, 0x11, 0x51, 0x11, 0xf1, 0x01,
   0x01, 0xfe
 };
-unsigned int roms_games_down8_len = 1610;
-const char* down8 = "down8";
+const unsigned int roms_games_down8_len = 1610;
+const char roms_games_down8_name[] PROGMEM = "down8";
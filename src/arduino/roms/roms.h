@@ -1,24 +1,23 @@
 // ROM Index Header File
+#include <avr/pgmspace.h>
 #include "br8kout.h"
 #include "down8.h"
 #include "tetris.h"
 
 #define ROMS_COUNT 3
 
-const char* rom_names[] = {
-    "br8kout",
-    "down8",
-    "tetris",
-};
-
-const unsigned char *rom_programs[] = {
-    roms_games_br8kout,
-    roms_games_down8,
-    roms_games_tetris,
-};
+/**
+ * A ROM of the library. Entries are in flash, and must be read out with memcpy_P
+ */
+typedef struct rom_entry
+{
+    const char *name;
+    const unsigned char *program;
+    unsigned int size;
+} rom_entry;
 
-const unsigned int rom_programs_sizes[] = {
-    roms_games_br8kout_len,
-    roms_games_down8_len,
-    roms_games_tetris_len,
+const rom_entry rom_index[ROMS_COUNT] PROGMEM = {
+    {roms_games_br8kout_name, roms_games_br8kout, roms_games_br8kout_len},
+    {roms_games_down8_name, roms_games_down8, roms_games_down8_len},
+    {roms_games_tetris_name, roms_games_tetris, roms_games_tetris_len},
 };
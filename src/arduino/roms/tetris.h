@@ -1,4 +1,4 @@
-unsigned char roms_games_tetris[] = {
+const unsigned char roms_games_tetris[] PROGMEM = {
   0xa2, 0xb4, 0x23, 0xe6, 0x22, 0xb6, 0x70, 0x01, 0xd0, 0x11, 0x30, 0x25,
   0x12, 0x06, 0x71, 0xff, 0xd0, 0x11, 0x60, 0x1a, 0xd0, 0x11, 0x60, 0x25,
   0x31, 0x00, 0x12, 0x0e, 0xc4, 0x70, 0x44, 0x70, 0x12, 0x1c, 0xc3, 0x03,
@@ -42,5 +42,5 @@ unsigned char roms_games_tetris[] = {
   0xf2, 0x65, 0xa2, 0xb4, 0x00, 0xee, 0x6a, 0x00, 0x60, 0x19, 0x00, 0xee,
   0x37, 0x23
 };
-unsigned int roms_games_tetris_len = 494;
-const char* tetris = "tetris";
+const unsigned int roms_games_tetris_len = 494;
+const char roms_games_tetris_name[] PROGMEM = "tetris";
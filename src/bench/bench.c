@@ -0,0 +1,380 @@
+/**
+ * @file bench.c
+ * @brief A benchmark suite for the CHIP-8 implementation
+ *
+ * The suite is made up of two parts:
+ * 1. Microbenchmarks of decode, execute (per operation type), display with aligned and misaligned sprites, and
+ *    starting a device over by initializing it or by resetting it to a golden image
+ * 2. Whole programs, found in the given directories, run for a fixed number of cycles by each engine
+ *
+ * Results are written to stdout as JSON, so that they may be compared between versions and engines.
+ *
+ * Usage: bench_chip8 [cycles] [program directories...]
+ */
+#include "../chip8/chip8.h"
+#include "../chip8/threaded.h"
+#include "../host/rom.h"
+#include "../host/host_util.h"
+#include "../host/jit.h"
+#if !defined(CHIP8_PAGED_MEMORY) && !defined(CHIP8_XO_CHIP)
+// The batch engine needs flat CHIP-8 memory, so only those builds benchmark it
+#include "../host/batch.h"
+#define BENCH_BATCH
+#endif
+#include <dirent.h>
+#include <time.h>
+
+/**
+ * @def MICRO_ITERATIONS
+ * @brief The number of times each microbenchmark's operation is run
+ */
+#define MICRO_ITERATIONS 1000000
+
+/**
+ * @def BATCH_MACHINES
+ * @brief The number of machines each program is run on by the batch benchmarks
+ */
+#define BATCH_MACHINES 256
+
+/**
+ * @def DEFAULT_CYCLES
+ * @brief The number of cycles each program is run for, unless otherwise given
+ */
+#define DEFAULT_CYCLES 5000000
+
+#ifdef CHIP8_THREADED
+#define ENGINE_NAME "threaded"
+#else
+#define ENGINE_NAME "switch"
+#endif
+
+/**
+ * @brief Written to with the results of benchmarked operations, so that they aren't optimized away
+ */
+volatile uint32_t sink;
+
+void stub_display(void *user, uint8_t *screen) {}
+void stub_buzzer(void *user, uint8_t on) {}
+uint8_t stub_random(void *user) { return 0xA5; }
+uint8_t stub_is_key_pressed(void *user, uint8_t key) { return 0; }
+uint8_t stub_get_key_pressed(void *user) { return 0; }
+
+/**
+ * @brief A xorshift generator, seeded the same way as the machines of a batch
+ */
+uint8_t seeded_random(void *user)
+{
+    return xorshift_next(user);
+}
+
+peripherals stub_peripherals = {
+    .display = &stub_display,
+    .buzzer = &stub_buzzer,
+    .random = &stub_random,
+    .is_key_pressed = &stub_is_key_pressed,
+    .get_key_pressed = &stub_get_key_pressed,
+};
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Prints a microbenchmark result as a JSON object
+ */
+void print_micro(const char *name, double seconds, int *first)
+{
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.3f}", *first ? "" : ",",
+           name, MICRO_ITERATIONS, seconds * 1e9 / MICRO_ITERATIONS);
+    *first = 0;
+}
+
+void bench_decode(int *first)
+{
+    uint8_t instruction[2];
+    op decoded_op;
+
+    double start = seconds_now();
+    for (uint32_t i = 0; i < MICRO_ITERATIONS; i++)
+    {
+        instruction[0] = (i >> 8) & 0xFF;
+        instruction[1] = i & 0xFF;
+        decode(instruction, &decoded_op);
+        sink = decoded_op.type;
+    }
+    print_micro("decode", seconds_now() - start, first);
+}
+
+void bench_execute(state *state, int *first)
+{
+    char name[64];
+    op decoded_op = {
+        .x = 1,
+        .y = 2,
+        .nnn = 0x300,
+        .nn = 0x12,
+        .n = 5
+    };
+
+    for (int type = CLEAR_DISPLAY; type <= NOOP; type++)
+    {
+        decoded_op.type = type;
+        state->I = 0x300;
+        state->SP = 0;
+
+        double start = seconds_now();
+        for (uint32_t i = 0; i < MICRO_ITERATIONS; i++)
+        {
+            execute(&decoded_op, state, &stub_peripherals);
+            // Keep the operations that move these from wandering off through memory
+            state->I &= 0x3FF;
+            state->SP &= 0x7;
+        }
+        sink = state->V[1];
+
+        snprintf(name, sizeof(name), "execute_%s", op_type_names[type]);
+        print_micro(name, seconds_now() - start, first);
+    }
+}
+
+void bench_display(state *state, uint8_t x, const char *name, int *first)
+{
+    op decoded_op = {
+        .type = DRAW_SPRITE,
+        .x = 0,
+        .y = 1,
+        .n = 15
+    };
+    state->I = 0x200;
+    state->V[0] = x;
+    state->V[1] = 3;
+
+    double start = seconds_now();
+    for (uint32_t i = 0; i < MICRO_ITERATIONS; i++)
+        display(state, &decoded_op);
+    sink = state->V[0xF];
+    print_micro(name, seconds_now() - start, first);
+}
+
+/**
+ * @brief Starts a device over with a decode cache attached, either by initializing it anew or by resetting it to
+ * a golden image, after each time it has written to memory
+ */
+void bench_restart(uint8_t *program, int reset, int *first)
+{
+    uint8_t memory[RAM_SIZE];
+    uint8_t golden[RAM_SIZE];
+    op *decode_cache = malloc(DECODE_CACHE_SIZE * sizeof(op));
+    chip8_config config = {&stub_peripherals, memory, program, decode_cache, CYCLES_PER_FRAME};
+    chip8 cpu = chip8_init(&config);
+    init_golden_image(golden, program, PROGRAM_SIZE);
+    op decoded_op = {
+        .type = BCD,
+        .x = 1
+    };
+
+    double start = seconds_now();
+    for (uint32_t i = 0; i < MICRO_ITERATIONS; i++)
+    {
+        cpu.state.I = 0x300;
+        cpu.state.V[1] = i;
+        execute(&decoded_op, &cpu.state, cpu.peripherals);
+        if (reset)
+            chip8_reset(&cpu, golden);
+        else
+            cpu = chip8_init(&config);
+    }
+    sink = memory[0x300];
+    print_micro(reset ? "reset_golden" : "reset_init", seconds_now() - start, first);
+    free(decode_cache);
+}
+
+/**
+ * @brief Runs the given program for the given number of cycles with the given engine, and prints the result
+ */
+void bench_rom(const char *path, uint8_t *program, uint32_t cycles, const char *engine, int use_cache, int *first)
+{
+    uint8_t memory[RAM_SIZE];
+    op *decode_cache = use_cache ? malloc(DECODE_CACHE_SIZE * sizeof(op)) : NULL;
+    chip8_config config = {&stub_peripherals, memory, program, decode_cache, CYCLES_PER_FRAME};
+    chip8 cpu = chip8_init(&config);
+#ifdef JIT_SUPPORTED
+    // Blocks are translated as they're first run, so translating is timed along with running
+    jit jit;
+    int use_jit = strcmp(engine, "jit") == 0;
+    if (use_jit && jit_init(&jit, &cpu) < 0)
+    {
+        free(decode_cache);
+        return;
+    }
+#endif
+
+    double start = seconds_now();
+    if (strcmp(engine, "threaded_run") == 0)
+        threaded_run(&cpu, cycles);
+#ifdef JIT_SUPPORTED
+    else if (use_jit)
+        jit_run_cycles(&jit, cycles);
+#endif
+    else
+        chip8_run_cycles(&cpu, cycles);
+    double elapsed = seconds_now() - start;
+    sink = cpu.state.PC;
+#ifdef JIT_SUPPORTED
+    if (use_jit)
+        jit_free(&jit);
+#endif
+
+    printf("%s\n    {\"rom\": \"%s\", \"engine\": \"%s\", \"decode_cache\": %s, \"cycles\": %u, "
+           "\"seconds\": %.6f, \"instructions_per_second\": %.0f}",
+           *first ? "" : ",", path, engine, use_cache ? "true" : "false", cycles,
+           elapsed, (elapsed > 0) ? cycles / elapsed : 0);
+    *first = 0;
+    free(decode_cache);
+}
+
+#ifdef BENCH_BATCH
+/**
+ * @brief Runs BATCH_MACHINES machines of the given program for the given number of cycles, first one
+ * machine at a time and then in lockstep as a batch, and prints the results
+ */
+void bench_batch(const char *path, uint8_t *program, uint32_t cycles, int *first)
+{
+    uint8_t *memory = malloc(RAM_SIZE);
+    uint8_t *golden = malloc(RAM_SIZE);
+    uint32_t machine_cycles = cycles / BATCH_MACHINES;
+    // The machines are seeded just as those of the batch are
+    uint32_t rng_state;
+    peripherals seeded_peripherals = stub_peripherals;
+    seeded_peripherals.user = &rng_state;
+    seeded_peripherals.random = &seeded_random;
+    chip8_config config = {&seeded_peripherals, memory, program, NULL, CYCLES_PER_FRAME};
+    chip8 cpu = chip8_init(&config);
+    init_golden_image(golden, program, PROGRAM_SIZE);
+
+    // One machine is reset and run in turn for each machine of the batch
+    double start = seconds_now();
+    for (uint32_t i = 0; i < BATCH_MACHINES; i++)
+    {
+        rng_state = i + 1;
+        chip8_reset(&cpu, golden);
+        chip8_run_cycles(&cpu, machine_cycles);
+        sink = cpu.state.PC;
+    }
+    double scalar_elapsed = seconds_now() - start;
+    free(memory);
+    free(golden);
+
+    batch batch;
+    if (batch_init(&batch, BATCH_MACHINES, program, CYCLES_PER_FRAME) < 0)
+        return;
+    start = seconds_now();
+    batch_run_cycles(&batch, machine_cycles);
+    double batch_elapsed = seconds_now() - start;
+    sink = batch.PC[0];
+
+    uint64_t steps = (uint64_t)machine_cycles * BATCH_MACHINES;
+    printf("%s\n    {\"rom\": \"%s\", \"machines\": %d, \"cycles\": %u, "
+           "\"scalar_steps_per_second\": %.0f, \"batch_steps_per_second\": %.0f, \"lockstep_ratio\": %.3f, \"avx2\": %d}",
+           *first ? "" : ",", path, BATCH_MACHINES, machine_cycles,
+           (scalar_elapsed > 0) ? steps / scalar_elapsed : 0, (batch_elapsed > 0) ? steps / batch_elapsed : 0,
+           (double)batch.lockstep_steps / (batch.lockstep_steps + batch.scalar_steps), batch.avx2);
+    *first = 0;
+    batch_free(&batch);
+}
+#endif
+
+/**
+ * @brief Benchmarks every program in the given directory, either with each engine or as a batch
+ */
+void bench_rom_dir(const char *dir_path, uint32_t cycles, int batched, int *first)
+{
+    char path[1024];
+    uint8_t program[PROGRAM_SIZE];
+    struct dirent *entry;
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL)
+        return;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (load_rom(path, program) < 0)
+            continue;
+
+#ifdef BENCH_BATCH
+        if (batched)
+        {
+            bench_batch(path, program, cycles, first);
+            continue;
+        }
+#endif
+        bench_rom(path, program, cycles, ENGINE_NAME, 0, first);
+        bench_rom(path, program, cycles, ENGINE_NAME, 1, first);
+        bench_rom(path, program, cycles, "threaded_run", 1, first);
+#ifdef JIT_SUPPORTED
+        bench_rom(path, program, cycles, "jit", 0, first);
+#endif
+    }
+    closedir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t cycles = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_CYCLES;
+    uint8_t memory[RAM_SIZE];
+    uint8_t program[PROGRAM_SIZE] = {0};
+    state state;
+    int first = 1;
+
+    // Some sprite data for display to draw
+    for (int i = 0; i < 16; i++)
+        program[i] = 0xA5 ^ i;
+    init_state(&state, memory, program);
+
+    printf("{\n  \"engine\": \"%s\",\n  \"micro\": [", ENGINE_NAME);
+    bench_decode(&first);
+    bench_execute(&state, &first);
+    // Executing HIRES left the screen in high resolution
+    state.hires = 0;
+    bench_display(&state, 8, "display_aligned", &first);
+    bench_display(&state, 13, "display_misaligned", &first);
+    state.hires = 1;
+    bench_display(&state, 60, "display_hires_straddling", &first);
+#ifdef CHIP8_XO_CHIP
+    state.planes = 3;
+    bench_display(&state, 13, "display_two_planes", &first);
+    state.planes = 1;
+#endif
+    bench_restart(program, 0, &first);
+    bench_restart(program, 1, &first);
+
+#ifdef BENCH_BATCH
+    int passes = 2;
+#else
+    int passes = 1;
+#endif
+    for (int batched = 0; batched < passes; batched++)
+    {
+        printf(batched ? "\n  ],\n  \"batch\": [" : "\n  ],\n  \"roms\": [");
+        first = 1;
+        if (argc > 2)
+        {
+            for (int i = 2; i < argc; i++)
+                bench_rom_dir(argv[i], cycles, batched, &first);
+        }
+        else
+        {
+            bench_rom_dir("roms/games", cycles, batched, &first);
+            bench_rom_dir("roms/tests", cycles, batched, &first);
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file aot.c
+ * @brief This module implements the runtime of programs translated ahead of time
+ */
+#include "aot.h"
+
+uint32_t aot_hash(const uint8_t *program, uint16_t size)
+{
+    uint32_t hash = 0x811c9dc5UL;
+    for (uint16_t i = 0; i < size; i++)
+    {
+        hash ^= program[i];
+        hash *= 0x01000193UL;
+    }
+    return hash;
+}
+
+const aot_program *aot_find(chip8 *cpu, const aot_program *const *programs, uint16_t count)
+{
+#if defined(CHIP8_PAGED_MEMORY) || defined(CHIP8_XO_CHIP)
+    // Translated code reads and writes memory directly, @see memory.h, and knows nothing of XO-CHIP
+    return NULL;
+#else
+    for (uint16_t i = 0; i < count; i++)
+        if (aot_hash(&cpu->state.memory[PROGRAM_OFFSET], programs[i]->size) == programs[i]->hash)
+            return programs[i];
+    return NULL;
+#endif
+}
+
+int aot_init(aot *aot, chip8 *cpu, const aot_program *program)
+{
+    aot->cpu = cpu;
+    aot->program = program;
+    aot->modified = 0;
+    aot->translated_steps = 0;
+    aot->interpreted_steps = 0;
+
+#if defined(CHIP8_PAGED_MEMORY) || defined(CHIP8_XO_CHIP)
+    return -1;
+#else
+    if (program->size > PROGRAM_SIZE || aot_hash(&cpu->state.memory[PROGRAM_OFFSET], program->size) != program->hash)
+        return -1;
+    return 0;
+#endif
+}
+
+/**
+ * Falls back to the interpreter for good if any of the written addresses hold a translated instruction
+ */
+static void check_written(aot *aot, uint16_t address, uint16_t length)
+{
+    const aot_program *program = aot->program;
+    uint32_t end = (uint32_t)address + length;
+
+    for (uint32_t i = address; i < end; i++)
+    {
+        if (i < program->code_start || i >= program->code_end)
+            continue;
+
+        uint16_t bit = i - program->code_start;
+        if (program->code_map[bit / 8] & (1 << (bit % 8)))
+        {
+            aot->modified = 1;
+            return;
+        }
+    }
+}
+
+void aot_wrote(aot *aot, uint16_t address, uint16_t length)
+{
+    invalidate_decode_cache(&aot->cpu->state, address, length);
+    check_written(aot, address, length);
+}
+
+/**
+ * Fetches, decodes and executes a single instruction with the interpreter
+ */
+static void interpret(aot *aot)
+{
+    chip8 *cpu = aot->cpu;
+    state *state = &cpu->state;
+    op decoded_instruction;
+    op *decoded_op = &decoded_instruction;
+    uint8_t instruction[2];
+
+    if (state->decode_cache != NULL)
+    {
+        decoded_op = fetch_decoded(state);
+    }
+    else
+    {
+        fetch(state, instruction);
+        decode(instruction, decoded_op);
+    }
+    execute(decoded_op, state, cpu->peripherals);
+
+    if (decoded_op->type == BCD)
+        check_written(aot, state->I, 3);
+    else if (decoded_op->type == REG_DUMP)
+        check_written(aot, state->I, decoded_op->x + 1);
+    aot->interpreted_steps++;
+}
+
+/**
+ * Runs the given number of instructions, by way of translated blocks wherever the PC reaches one
+ */
+static void run(void *user, uint32_t cycles)
+{
+    aot *aot = user;
+    while (cycles > 0)
+    {
+        if (!aot->modified)
+        {
+            uint32_t remaining = aot->program->run(aot, cycles);
+            aot->translated_steps += cycles - remaining;
+            cycles = remaining;
+            if (cycles == 0)
+                break;
+        }
+
+        // Either the PC isn't at a translated block, or the program has been modified
+        interpret(aot);
+        cycles--;
+    }
+}
+
+void aot_run_cycles(aot *aot, uint32_t cycles)
+{
+    chip8_run_cycles_with(aot->cpu, cycles, &run, aot);
+}
+
+void aot_run_frame(aot *aot)
+{
+    state *state = &aot->cpu->state;
+    aot_run_cycles(aot, (aot->cpu->cycles_per_frame > state->frame_cycles) ? aot->cpu->cycles_per_frame - state->frame_cycles : 1);
+}
@@ -0,0 +1,159 @@
+/**
+ * @file aot.h
+ * @brief The runtime of programs translated ahead of time into C by the chip8_aot tool
+ *
+ * chip8_aot statically walks a program from PROGRAM_OFFSET, following jumps, calls, returns and both sides
+ * of every skip, and emits each basic block it finds as C operating directly on the device's state.
+ * The translated program is compiled and linked alongside the core, and is described by an aot_program.
+ *
+ * Translated code is only run while the PC is at the start of a translated block. Anywhere else, such
+ * as the computed target of a BNNN that wasn't found by the walk, instructions are run by the interpreter
+ * until a translated block is reached again. Once the program writes over any of its own translated
+ * instructions, the translation no longer matches memory, and the interpreter is used from then on.
+ *
+ * The timers are ticked after exactly cycles_per_frame instructions, just as with the interpreter.
+ * @see translate.c for the translator
+ */
+#ifndef AOT_H
+#define AOT_H
+
+#include "chip8.h"
+
+// Translated code reads and writes memory directly, @see memory.h, and knows nothing of XO-CHIP
+#if defined(CHIP8_AOT) && (defined(CHIP8_PAGED_MEMORY) || defined(CHIP8_XO_CHIP))
+#error "Translated programs need the flat memory of CHIP-8 and SUPER-CHIP builds"
+#endif
+
+struct aot;
+
+/**
+ * @struct aot_program
+ * @brief A program translated ahead of time
+ */
+typedef struct aot_program
+{
+    /**
+     * @brief The name of the program, as given to the translator
+     */
+    const char *name;
+    /**
+     * @brief The size, in bytes, of the program that was translated
+     */
+    uint16_t size;
+    /**
+     * @brief A hash of the program that was translated, @see aot_hash
+     */
+    uint32_t hash;
+    /**
+     * @brief The lowest address held by a translated instruction
+     */
+    uint16_t code_start;
+    /**
+     * @brief One past the highest address held by a translated instruction
+     */
+    uint16_t code_end;
+    /**
+     * @brief A bitmap of the addresses from code_start to code_end that are held by translated instructions.
+     * Bit (address - code_start) % 8 of byte (address - code_start) / 8 is set for each of them
+     */
+    const uint8_t *code_map;
+    /**
+     * @brief Runs translated blocks, one after another, for at most the given number of instructions.
+     * Returns once the PC isn't at the start of a translated block, or the program has been modified,
+     * with the number of instructions that remain
+     */
+    uint32_t (*run)(struct aot *aot, uint32_t cycles);
+} aot_program;
+
+/**
+ * @struct aot
+ * @brief A CHIP-8 instance being run by a program translated ahead of time
+ */
+typedef struct aot
+{
+    /**
+     * @brief The instance being run
+     */
+    chip8 *cpu;
+    /**
+     * @brief The translation of the instance's program
+     */
+    const aot_program *program;
+    /**
+     * @brief Set once the program has written over its own translated instructions.
+     * From then on, every instruction is run by the interpreter
+     */
+    uint8_t modified;
+    /**
+     * @brief The number of instructions run by translated code
+     */
+    unsigned long translated_steps;
+    /**
+     * @brief The number of instructions run by the interpreter
+     */
+    unsigned long interpreted_steps;
+} aot;
+
+/**
+ * @brief The programs listed by chip8_aot --index. Only defined when its output is linked in
+ */
+extern const aot_program *const aot_programs[];
+
+/**
+ * @brief The number of programs in aot_programs
+ */
+extern const uint16_t aot_program_count;
+
+/**
+ * @brief Hashes a program with 32 bit FNV-1a, to match translations to the programs they were translated from
+ *
+ * @param program - The program to be hashed
+ * @param size - The size of the program in bytes
+ */
+uint32_t aot_hash(const uint8_t *program, uint16_t size);
+
+/**
+ * @brief Finds the translation of the program loaded into the given instance's memory
+ *
+ * @param cpu - The instance whose program should be matched
+ * @param programs - The translated programs to choose from
+ * @param count - The number of translated programs
+ * @returns The matching translation. NULL if none of them match
+ */
+const aot_program *aot_find(chip8 *cpu, const aot_program *const *programs, uint16_t count);
+
+/**
+ * @brief Prepares the given instance to be run by the given translated program
+ *
+ * @param aot - The runtime to be initialized
+ * @param cpu - The instance to be run. Its program should be freshly loaded
+ * @param program - The translation of the instance's program
+ * @returns 0 on success. -1 if the instance's memory doesn't hold the translated program
+ */
+int aot_init(aot *aot, chip8 *cpu, const aot_program *program);
+
+/**
+ * @brief Performs the given number of cycles against the runtime's instance, ticking the timers once every
+ * cycles_per_frame cycles, @see chip8_run_cycles
+ *
+ * @param aot - The runtime of the instance to run cycles on
+ * @param cycles - The number of instructions to execute
+ */
+void aot_run_cycles(aot *aot, uint32_t cycles);
+
+/**
+ * @brief Runs the runtime's instance until its timers are next ticked, @see chip8_run_frame
+ */
+void aot_run_frame(aot *aot);
+
+/**
+ * @brief Notes that memory has been written to, falling back to the interpreter if any translated
+ * instruction was written over. Called by translated code after BCD and REG_DUMP
+ *
+ * @param aot - The runtime of the instance that wrote to memory
+ * @param address - The first address that was written to
+ * @param length - The number of bytes that were written
+ */
+void aot_wrote(aot *aot, uint16_t address, uint16_t length);
+
+#endif
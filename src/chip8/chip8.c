@@ -3,6 +3,15 @@
  * @brief This module implements the logic for the CHIP-8 device
  */
 #include "chip8.h"
+#include "threaded.h"
+#include "instrument.h"
+#include "trace.h"
+#include "memory.h"
+
+static void present(state *state, peripherals *peripherals);
+static void scroll(state *state, op *decoded_op);
+static void scroll_plane(state *state, uint64_t (*rows)[SCREEN_ROW_WORDS], op *decoded_op);
+static void set_resolution(state *state, peripherals *peripherals, uint8_t hires);
 
 enum op_type op_type_lookup[0xE] = {
     [0] = NOOP,
@@ -32,6 +41,52 @@ enum op_type bit_op_type_lookup[0xF] = {
     NOOP, NOOP, NOOP, NOOP, NOOP, NOOP,
     [0xE] = SHIFT_LEFT};
 
+const char *const op_type_names[UNDECODED + 1] = {
+    [CLEAR_DISPLAY] = "CLEAR_DISPLAY",
+    [RET] = "RET",
+    [JUMP] = "JUMP",
+    [CALL] = "CALL",
+    [SET_REG] = "SET_REG",
+    [ADD_REG] = "ADD_REG",
+    [SET_I_REG] = "SET_I_REG",
+    [IF_EQ] = "IF_EQ",
+    [IF_NEQ] = "IF_NEQ",
+    [IF_EQ_REG] = "IF_EQ_REG",
+    [SET_REG_BY_REG] = "SET_REG_BY_REG",
+    [OR] = "OR",
+    [AND] = "AND",
+    [XOR] = "XOR",
+    [ADD_BY_REG] = "ADD_BY_REG",
+    [SUB] = "SUB",
+    [SHIFT_RIGHT] = "SHIFT_RIGHT",
+    [SUBN] = "SUBN",
+    [SHIFT_LEFT] = "SHIFT_LEFT",
+    [SKIP_NEQ] = "SKIP_NEQ",
+    [BNNN] = "BNNN",
+    [RANDOM] = "RANDOM",
+    [DRAW_SPRITE] = "DRAW_SPRITE",
+    [SKIP_IF_KEY] = "SKIP_IF_KEY",
+    [SKIP_IF_NKEY] = "SKIP_IF_NKEY",
+    [GET_DELAY] = "GET_DELAY",
+    [GET_KEY] = "GET_KEY",
+    [SET_DELAY] = "SET_DELAY",
+    [SET_AUDIO] = "SET_AUDIO",
+    [ADVANCE_I] = "ADVANCE_I",
+    [SET_I_HEX_SPRITE] = "SET_I_HEX_SPRITE",
+    [BCD] = "BCD",
+    [REG_DUMP] = "REG_DUMP",
+    [REG_LOAD] = "REG_LOAD",
+    [SCROLL_DOWN] = "SCROLL_DOWN",
+    [SCROLL_RIGHT] = "SCROLL_RIGHT",
+    [SCROLL_LEFT] = "SCROLL_LEFT",
+    [LORES] = "LORES",
+    [HIRES] = "HIRES",
+    [SELECT_PLANES] = "SELECT_PLANES",
+    [LONG_I] = "LONG_I",
+    [NOOP] = "NOOP",
+    [UNDECODED] = "UNDECODED",
+};
+
 uint8_t digit_sprites_data[0x50] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -51,30 +106,151 @@ uint8_t digit_sprites_data[0x50] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80, // F
 };
 
+/**
+ * Whether the given plane of the screen is drawn to, cleared and scrolled. With a single plane, it always is
+ */
+static inline uint8_t plane_selected(state *state, uint8_t plane)
+{
+    return SCREEN_PLANES == 1 || ((state->planes >> plane) & 1);
+}
+
+/**
+ * Fetches, decodes and executes a single instruction, leaving the timers alone
+ */
+static inline void step(chip8 *cpu)
+{
+    op decoded_instruction;
+    uint8_t instruction[2];
+    state *state = &((*cpu).state);
+
+    if (state->decode_cache != NULL)
+    {
+        op *decoded_op = fetch_decoded(state);
+        INSTRUMENT_OP(state, state->PC - 2, decoded_op->type);
+        TRACE_BEFORE(state, decoded_op);
+        execute(decoded_op, state, cpu->peripherals);
+        TRACE_AFTER(state, decoded_op);
+    }
+    else
+    {
+        fetch(state, instruction);
+        decode(instruction, &decoded_instruction);
+        INSTRUMENT_OP(state, state->PC - 2, decoded_instruction.type);
+        TRACE_BEFORE(state, &decoded_instruction);
+        execute(&decoded_instruction, state, cpu->peripherals);
+        TRACE_AFTER(state, &decoded_instruction);
+    }
+}
+
 void chip8_run(chip8 *cpu)
 {
-    static op decoded_instruction;
-    static uint8_t instruction[2] = {0, 0};
+    chip8_run_cycles(cpu, 1);
+}
+
+/**
+ * Runs the given number of instructions with the interpreter engine selected at build time
+ */
+static void run_interpreter(void *user, uint32_t cycles)
+{
+    chip8 *cpu = user;
+#ifdef CHIP8_THREADED
+    threaded_run(cpu, cycles);
+#else
+    for (uint32_t i = 0; i < cycles; i++)
+        step(cpu);
+#endif
+}
+
+void chip8_run_cycles_with(chip8 *cpu, uint32_t cycles, chip8_runner run, void *user)
+{
+    state *state = &((*cpu).state);
+    uint32_t batch;
+
+    while (cycles > 0)
+    {
+        // Run up until the end of the frame, or fewer cycles if that's all that's left
+        batch = (cpu->cycles_per_frame > state->frame_cycles) ? cpu->cycles_per_frame - state->frame_cycles : 1;
+        if (batch > cycles)
+            batch = cycles;
+
+        run(user, batch);
+
+        cycles -= batch;
+        state->frame_cycles += batch;
+        if (state->frame_cycles >= cpu->cycles_per_frame)
+        {
+            state->frame_cycles = 0;
+            chip8_tick(cpu);
+        }
+    }
+}
+
+void chip8_run_cycles(chip8 *cpu, uint32_t cycles)
+{
+    chip8_run_cycles_with(cpu, cycles, &run_interpreter, cpu);
+}
+
+void chip8_run_frame(chip8 *cpu)
+{
     state *state = &((*cpu).state);
+    chip8_run_cycles(cpu, (cpu->cycles_per_frame > state->frame_cycles) ? cpu->cycles_per_frame - state->frame_cycles : 1);
+}
+
+/**
+ * Starts or stops the buzzer peripheral, if there is one
+ */
+static void set_buzzer(chip8 *cpu, uint8_t on)
+{
+    cpu->state.buzzer_on = on;
+    if (cpu->peripherals->buzzer != NULL)
+        INSTRUMENT_CALLBACK(&cpu->state, INSTRUMENT_BUZZER, cpu->peripherals->buzzer(cpu->peripherals->user, on));
+}
 
-    fetch(state, instruction);
-    decode(instruction, &decoded_instruction);
-    execute(&decoded_instruction, state, cpu->peripherals);
+void chip8_tick(chip8 *cpu)
+{
+    state *state = &cpu->state;
 
+    // The buzzer is only told when it should start or stop, rather than being called every frame
     if (state->audio_timer > 0)
     {
-        cpu->peripherals->noise();
+        if (!state->buzzer_on)
+            set_buzzer(cpu, 1);
         state->audio_timer--;
     }
+    else if (state->buzzer_on)
+    {
+        set_buzzer(cpu, 0);
+    }
 
     if (state->delay_timer > 0)
         state->delay_timer--;
+
+    if (cpu->peripherals->present_mode == PRESENT_VBLANK)
+        present(state, cpu->peripherals);
 }
 
 void fetch(state *state, uint8_t instruction[2])
 {
     for (int i = 0; i < 2; i++)
-        instruction[i] = state->memory[state->PC++];
+        instruction[i] = MEMORY_READ(state, state->PC++);
+}
+
+op *fetch_decoded(state *state)
+{
+    op *decoded_op = &state->decode_cache[state->PC % DECODE_CACHE_SIZE];
+    uint8_t instruction[2];
+
+    if (decoded_op->type == UNDECODED)
+    {
+        fetch(state, instruction);
+        decode(instruction, decoded_op);
+    }
+    else
+    {
+        state->PC += 2;
+    }
+
+    return decoded_op;
 }
 
 void decode(uint8_t instruction[2], op *decoded_op)
@@ -85,6 +261,8 @@ void decode(uint8_t instruction[2], op *decoded_op)
     decoded_op->x = (instruction[0] & 0x0F);                             // 0x0X00;
     decoded_op->y = (instruction[1] & 0xF0) >> 4;                        // 0x00Y0;
     decoded_op->n = instruction[1] & 0x0F;                               // 0x000N;
+    // Anything not matched below is treated as a no-op, rather than retaining a stale type
+    decoded_op->type = NOOP;
 
     switch (op_type_major)
     {
@@ -97,6 +275,21 @@ void decode(uint8_t instruction[2], op *decoded_op)
         case 0xEE:
             decoded_op->type = RET;
             break;
+        case 0xC0 ... 0xCF:
+            decoded_op->type = SCROLL_DOWN;
+            break;
+        case 0xFB:
+            decoded_op->type = SCROLL_RIGHT;
+            break;
+        case 0xFC:
+            decoded_op->type = SCROLL_LEFT;
+            break;
+        case 0xFE:
+            decoded_op->type = LORES;
+            break;
+        case 0xFF:
+            decoded_op->type = HIRES;
+            break;
         }
         break;
 
@@ -124,6 +317,15 @@ void decode(uint8_t instruction[2], op *decoded_op)
     case 0xF:
         switch (decoded_op->nn)
         {
+#ifdef CHIP8_XO_CHIP
+        case 0x00:
+            if (decoded_op->x == 0)
+                decoded_op->type = LONG_I;
+            break;
+        case 0x01:
+            decoded_op->type = SELECT_PLANES;
+            break;
+#endif
         case 0x07:
             decoded_op->type = GET_DELAY;
             break;
@@ -160,6 +362,25 @@ void decode(uint8_t instruction[2], op *decoded_op)
     }
 }
 
+/**
+ * Hands the screen's dirty rows to the display peripheral, preferring display_region when set
+ */
+static void present(state *state, peripherals *peripherals)
+{
+    if (state->dirty_bottom <= state->dirty_top)
+        return;
+
+    if (peripherals->display_region != NULL)
+        INSTRUMENT_CALLBACK(state, INSTRUMENT_DISPLAY,
+                            peripherals->display_region(peripherals->user, &state->screen[state->dirty_top * H_OFFSET],
+                                                        state->dirty_top, state->dirty_bottom - state->dirty_top));
+    else
+        INSTRUMENT_CALLBACK(state, INSTRUMENT_DISPLAY, peripherals->display(peripherals->user, state->screen));
+
+    state->dirty_top = SCREEN_H;
+    state->dirty_bottom = 0;
+}
+
 void execute(op *decoded_op, state *state, peripherals *peripherals)
 {
     uint8_t *x = &(state->V[decoded_op->x]);
@@ -170,8 +391,12 @@ void execute(op *decoded_op, state *state, peripherals *peripherals)
     switch (decoded_op->type)
     {
     case CLEAR_DISPLAY:
-        memset(state->screen, 0, SCREEN_BYTES);
-        peripherals->display(state->screen);
+        for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++)
+            if (plane_selected(state, plane))
+                memset(state->screen_planes[plane], 0, SCREEN_PLANE_BYTES);
+        mark_dirty(state, 0, SCREEN_H);
+        if (peripherals->present_mode == PRESENT_IMMEDIATE)
+            present(state, peripherals);
         break;
     case RET:
         state->SP -= (state->SP > 0) ? 1 : 0; // Min SP is 0
@@ -196,16 +421,33 @@ void execute(op *decoded_op, state *state, peripherals *peripherals)
         break;
     case DRAW_SPRITE:
         display(state, decoded_op);
-        peripherals->display(state->screen);
+        if (peripherals->present_mode == PRESENT_IMMEDIATE)
+            present(state, peripherals);
+        break;
+    case SCROLL_DOWN:
+    case SCROLL_RIGHT:
+    case SCROLL_LEFT:
+        scroll(state, decoded_op);
+        if (peripherals->present_mode == PRESENT_IMMEDIATE)
+            present(state, peripherals);
+        break;
+    case LORES:
+    case HIRES:
+        set_resolution(state, peripherals, decoded_op->type == HIRES);
+        if (peripherals->present_mode == PRESENT_IMMEDIATE)
+            present(state, peripherals);
         break;
     case IF_EQ:
-        state->PC += (*x == decoded_op->nn) ? 2 : 0;
+        if (*x == decoded_op->nn)
+            skip_instruction(state);
         break;
     case IF_NEQ:
-        state->PC += (*x != decoded_op->nn) ? 2 : 0;
+        if (*x != decoded_op->nn)
+            skip_instruction(state);
         break;
     case IF_EQ_REG:
-        state->PC += (*x == *y) ? 2 : 0;
+        if (*x == *y)
+            skip_instruction(state);
         break;
     case SET_REG_BY_REG:
         *x = *y;
@@ -245,25 +487,31 @@ void execute(op *decoded_op, state *state, peripherals *peripherals)
         state->V[0xF] = temp;
         break;
     case SKIP_NEQ:
-        state->PC += (*x != *y) ? 2 : 0;
+        if (*x != *y)
+            skip_instruction(state);
         break;
     case BNNN:
         state->PC = decoded_op->nnn + state->V[0];
         break;
     case RANDOM:
-        *x = peripherals->random() & decoded_op->nn;
+        INSTRUMENT_CALLBACK(state, INSTRUMENT_RANDOM, temp = peripherals->random(peripherals->user));
+        *x = temp & decoded_op->nn;
         break;
     case SKIP_IF_KEY:
-        state->PC += (peripherals->is_key_pressed(*x) == 1) ? 2 : 0;
+        INSTRUMENT_CALLBACK(state, INSTRUMENT_IS_KEY_PRESSED, temp = peripherals->is_key_pressed(peripherals->user, *x));
+        if (temp == 1)
+            skip_instruction(state);
         break;
     case SKIP_IF_NKEY:
-        state->PC += (peripherals->is_key_pressed(*x) == 0) ? 2 : 0;
+        INSTRUMENT_CALLBACK(state, INSTRUMENT_IS_KEY_PRESSED, temp = peripherals->is_key_pressed(peripherals->user, *x));
+        if (temp == 0)
+            skip_instruction(state);
         break;
     case GET_DELAY:
         *x = state->delay_timer;
         break;
     case GET_KEY:
-        *x = peripherals->get_key_pressed();
+        INSTRUMENT_CALLBACK(state, INSTRUMENT_GET_KEY_PRESSED, *x = peripherals->get_key_pressed(peripherals->user));
         break;
     case SET_DELAY:
         state->delay_timer = *x;
@@ -278,16 +526,29 @@ void execute(op *decoded_op, state *state, peripherals *peripherals)
         state->I = DIGIT_SPRITES_OFFSET + (*x * 5);
         break;
     case BCD:
-        state->memory[state->I] = (*x / 100) % 10;    // 100's place
-        state->memory[state->I + 1] = (*x / 10) % 10; // 10's place
-        state->memory[state->I + 2] = *x % 10;        // 1's place
+        MEMORY_WRITE(state, state->I, (*x / 100) % 10);    // 100's place
+        MEMORY_WRITE(state, state->I + 1, (*x / 10) % 10); // 10's place
+        MEMORY_WRITE(state, state->I + 2, *x % 10);        // 1's place
+        invalidate_decode_cache(state, state->I, 3);
         break;
     case REG_DUMP:
-        memcpy(&state->memory[state->I], state->V, decoded_op->x + 1);
+        temp = decoded_op->x + 1;
+        memory_store(state, state->I, state->V, temp);
+        invalidate_decode_cache(state, state->I, temp);
         break;
     case REG_LOAD:
-        memcpy(&state->V, &state->memory[state->I], decoded_op->x + 1);
+        memory_load(state, state->V, state->I, decoded_op->x + 1);
+        break;
+#ifdef CHIP8_XO_CHIP
+    case SELECT_PLANES:
+        state->planes = decoded_op->x & ((1 << SCREEN_PLANES) - 1);
         break;
+    case LONG_I:
+        // The address is read from memory, rather than decoded, as it follows the instruction
+        state->I = (MEMORY_READ(state, state->PC) << 8) | MEMORY_READ(state, state->PC + 1);
+        state->PC += 2;
+        break;
+#endif
     default:
         // The instruction is either not yet implemented or it is invalid
         break;
@@ -296,53 +557,177 @@ void execute(op *decoded_op, state *state, peripherals *peripherals)
 
 void display(state *state, op *decoded_op)
 {
-    // Because the screen with is 64, there are 8 bytes to each row,
-    // this tells us which byte our given x pixel is in
-    uint8_t x = ((state->V[decoded_op->x]) % SCREEN_W) / 8;
-    // This tells us how many bits into our byte we should start drawing the sprite
-    uint8_t x_off = ((state->V[decoded_op->x]) % SCREEN_W) % 8;
-    uint8_t y = (state->V[decoded_op->y]) % SCREEN_H;
+    uint8_t width = CURRENT_SCREEN_W(state);
+    uint8_t height = CURRENT_SCREEN_H(state);
+    uint8_t x = (state->V[decoded_op->x]) % width;
+    uint8_t y = (state->V[decoded_op->y]) % height;
+    // The word of each row the sprite starts in, and how far into it
+    uint8_t word = x / 64;
+    uint8_t shift = x % 64;
+    // Low resolution only uses the first word of each row, so a sprite there is clipped at its end
+    uint8_t spills = shift > 0 && word + 1 < width / 64;
 
-    // Used to determine if the operation resulted in ANY pixels were unset/toggled off
-    int unset_pixel = 0;
-    int start_idx = ((y * H_OFFSET) + x);
-    int end_idx = start_idx + (decoded_op->n * H_OFFSET);
+    // DXY0 draws a 16x16 sprite
+    uint8_t row_count = (decoded_op->n > 0) ? decoded_op->n : 16;
+    uint8_t row_bytes = (decoded_op->n > 0) ? 1 : 2;
 
-    uint8_t screen_buffer;
+    // Set if any pixels were unset/toggled off
+    uint64_t collided = 0;
+    uint64_t sprite_row;
+    uint64_t sprite;
+    uint16_t sprite_address = state->I;
+    uint16_t address;
 
-    for (int i = start_idx, n = 0; i < end_idx; i += H_OFFSET, n++)
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++)
     {
-        if (i >= SCREEN_BYTES)
-            break;
+        if (!plane_selected(state, plane))
+            continue;
 
-        screen_buffer = state->screen[i] ^ (state->memory[state->I + n] >> x_off);
-        for (int j = 8; j > 0; j--)
-            if ( (state->screen[i] & (1 << j)) != 0 && (screen_buffer & (1 << j)) == 0)
-                unset_pixel = 1;
+        address = sprite_address;
+        for (uint8_t n = 0; n < row_count && y + n < height; n++, address += row_bytes)
+        {
+            // The sprite's row is shifted into place once, as the leftmost bits of a row
+            if (row_bytes == 2)
+                sprite_row = ((uint64_t)MEMORY_READ(state, address) << 56) | ((uint64_t)MEMORY_READ(state, address + 1) << 48);
+            else
+                sprite_row = (uint64_t)MEMORY_READ(state, address) << 56;
+            uint64_t *row = state->screen_planes[plane][y + n];
 
-        state->screen[i] = screen_buffer;
+            sprite = SCREEN_ROW(sprite_row >> shift);
+            collided |= row[word] & sprite;
+            row[word] ^= sprite;
+            // Whatever falls past the end of the word carries on into the next one, or is clipped at the right
+            // edge of the screen
+            if (spills)
+            {
+                sprite = SCREEN_ROW(sprite_row << (64 - shift));
+                collided |= row[word + 1] & sprite;
+                row[word + 1] ^= sprite;
+            }
+        }
+        // The next plane's sprite follows the whole of this one's, however much of it was clipped
+        sprite_address += row_count * row_bytes;
+    }
+    state->V[0xF] = collided != 0;
+    INSTRUMENT_DRAW(state, state->V[0xF]);
+    mark_dirty(state, y, row_count);
+}
 
-        // Depending on the x coord, the sprite can span two bytes.
-        // So if we just drew 7 pixels to the previous byte, we'll draw the remaining 1 bit
-        // to the screen's following byte.
-        if (x_off > 0 && (i + 1) % H_OFFSET != 0)
-        {
-            screen_buffer = state->screen[i + 1] ^ (state->memory[state->I + n] << (8 - x_off));
-            for (int j = 8; j > 0; j--)
-                if ( (state->screen[i + 1] & (1 << j)) != 0 && (screen_buffer & (1 << j)) == 0)
-                    unset_pixel = 1;
+/**
+ * Scrolls the selected planes of the screen at its current resolution: down by whole rows, or left or right
+ * by 4 pixels
+ */
+static void scroll(state *state, op *decoded_op)
+{
+    for (uint8_t plane = 0; plane < SCREEN_PLANES; plane++)
+        if (plane_selected(state, plane))
+            scroll_plane(state, state->screen_planes[plane], decoded_op);
+    mark_dirty(state, 0, CURRENT_SCREEN_H(state));
+}
+
+/**
+ * Scrolls a single plane of the screen
+ */
+static void scroll_plane(state *state, uint64_t (*rows)[SCREEN_ROW_WORDS], op *decoded_op)
+{
+    uint8_t height = CURRENT_SCREEN_H(state);
+    uint64_t left;
+    uint64_t right;
 
-            state->screen[i + 1] = screen_buffer;
+    switch (decoded_op->type)
+    {
+    case SCROLL_DOWN:
+        // Rows are moved whole, and the rows scrolled in from the top are blank
+        memmove(rows[decoded_op->n], rows[0], (height - decoded_op->n) * H_OFFSET);
+        memset(rows[0], 0, decoded_op->n * H_OFFSET);
+        break;
+    case SCROLL_RIGHT:
+        for (uint8_t i = 0; i < height; i++)
+        {
+            uint64_t *row = rows[i];
+            left = SCREEN_ROW(row[0]);
+            // In low resolution, what's scrolled past the first word is clipped at the right edge
+            if (state->hires)
+                row[1] = SCREEN_ROW((SCREEN_ROW(row[1]) >> 4) | (left << 60));
+            row[0] = SCREEN_ROW(left >> 4);
+        }
+        break;
+    case SCROLL_LEFT:
+        for (uint8_t i = 0; i < height; i++)
+        {
+            uint64_t *row = rows[i];
+            // The second word is always blank in low resolution
+            right = SCREEN_ROW(row[1]);
+            row[0] = SCREEN_ROW((SCREEN_ROW(row[0]) << 4) | (right >> 60));
+            row[1] = SCREEN_ROW(right << 4);
         }
+        break;
+    default:
+        break;
     }
-    state->V[0xF] = unset_pixel;
+}
+
+/**
+ * Switches the screen's resolution, clearing it, and tells the resolution peripheral if it has changed
+ */
+static void set_resolution(state *state, peripherals *peripherals, uint8_t hires)
+{
+    memset(state->screen, 0, SCREEN_BYTES);
+    if (hires != state->hires)
+    {
+        state->hires = hires;
+        if (peripherals->resolution != NULL)
+            peripherals->resolution(peripherals->user, hires);
+    }
+    mark_dirty(state, 0, SCREEN_H);
+}
+
+void mark_dirty(state *state, uint8_t first_row, uint8_t row_count)
+{
+    // Rows past the bottom of the screen at its current resolution are never drawn to
+    int end_row = first_row + row_count;
+    if (end_row > CURRENT_SCREEN_H(state))
+        end_row = CURRENT_SCREEN_H(state);
+
+    if (first_row < state->dirty_top)
+        state->dirty_top = first_row;
+    if (end_row > state->dirty_bottom)
+        state->dirty_bottom = end_row;
+}
+
+/**
+ * Zeroes everything but the memory of the given state, and points its PC at the start of the program
+ */
+static void reset_registers(state *state)
+{
+    // Zero the stack
+    memset(state->stack, 0, sizeof(state->stack));
+
+    // Init registers
+    state->PC = PROGRAM_OFFSET;
+    state->I = 0;
+    state->SP = 0;
+    memset(state->V, 0, REGISTER_COUNT);
+
+    // Init peripherals
+    state->audio_timer = 0;
+    state->delay_timer = 0;
+    state->frame_cycles = 0;
+    state->buzzer_on = 0;
+    memset(state->screen, 0, SCREEN_BYTES);
+    state->planes = 1;
+    state->hires = 0;
+    state->dirty_top = SCREEN_H;
+    state->dirty_bottom = 0;
 }
 
 chip8 chip8_init(chip8_config *config)
 {
     chip8 cpu;
     cpu.peripherals = config->peripherals;
+    cpu.cycles_per_frame = (config->cycles_per_frame > 0) ? config->cycles_per_frame : CYCLES_PER_FRAME;
     init_state(&cpu.state, config->memory, config->program);
+    attach_decode_cache(&cpu.state, config->decode_cache);
     return cpu;
 } 
 
@@ -350,23 +735,86 @@ void init_state(state *state, uint8_t *memory, uint8_t *program)
 {
     // Point our memory to wherever has been allocated for us
     state->memory = memory;
+#ifdef CHIP8_PAGED_MEMORY
+    // Nothing has been written yet, so every page is read from the digit sprites and the program
+    memory_reset(state);
+    state->program = program;
+    state->program_size = PROGRAM_SIZE;
+#else
+    init_golden_image(state->memory, program, PROGRAM_SIZE);
+#endif
+    reset_registers(state);
+
+    // The program has changed underneath any cache we might have had
+    state->decode_cache = NULL;
+#ifdef CHIP8_INSTRUMENT
+    state->stats = NULL;
+#endif
+#if CHIP8_TRACE_LEVEL > 0
+    state->trace = NULL;
+#endif
+}
+
+void init_golden_image(uint8_t *golden, const uint8_t *program, uint16_t size)
+{
     // Clear the contents of memory
-    memset(state->memory, 0, RAM_SIZE);
+    memset(golden, 0, RAM_SIZE);
     // Store sprite representation of hex digits to memory
-    memcpy(&state->memory[DIGIT_SPRITES_OFFSET], digit_sprites_data, sizeof(digit_sprites_data));
+    memcpy(&golden[DIGIT_SPRITES_OFFSET], digit_sprites_data, sizeof(digit_sprites_data));
     // Store the given program at the correct place in memory
-    memcpy(&state->memory[PROGRAM_OFFSET], program, PROGRAM_SIZE);
-    // Zero the stack
-    memset(state->stack, 0, STACK_COUNT);
+    if (size > 0)
+        memcpy(&golden[PROGRAM_OFFSET], program, size);
+}
 
-    // Init registers
-    state->PC = PROGRAM_OFFSET;
-    state->I = 0;
-    state->SP = 0;
-    memset(state->V, 0, REGISTER_COUNT);
+void reset_state(state *state, const uint8_t *golden)
+{
+#ifdef CHIP8_PAGED_MEMORY
+    memory_reset(state);
+    invalidate_decode_cache(state, 0, DECODE_CACHE_SIZE);
+#else
+    for (uint32_t address = 0; address < RAM_SIZE; address += RESET_BLOCK_SIZE)
+    {
+        if (memcmp(&state->memory[address], &golden[address], RESET_BLOCK_SIZE) == 0)
+            continue;
+        memcpy(&state->memory[address], &golden[address], RESET_BLOCK_SIZE);
+        invalidate_decode_cache(state, address, RESET_BLOCK_SIZE);
+    }
+#endif
+    reset_registers(state);
+}
 
-    // Init peripherals
-    state->audio_timer = 0;
-    state->delay_timer = 0;
-    memset(state->screen, 0, SCREEN_BYTES);
+void chip8_reset(chip8 *cpu, const uint8_t *golden)
+{
+    if (cpu->state.buzzer_on)
+        set_buzzer(cpu, 0);
+    if (cpu->state.hires && cpu->peripherals->resolution != NULL)
+        cpu->peripherals->resolution(cpu->peripherals->user, 0);
+    reset_state(&cpu->state, golden);
+    // Whatever was displayed before is cleared by the next display
+    mark_dirty(&cpu->state, 0, SCREEN_H);
+}
+
+void attach_decode_cache(state *state, op *decode_cache)
+{
+    state->decode_cache = decode_cache;
+    invalidate_decode_cache(state, 0, DECODE_CACHE_SIZE);
+}
+
+void invalidate_decode_cache(state *state, uint16_t address, uint32_t length)
+{
+    if (state->decode_cache == NULL)
+        return;
+
+    // Instructions are two bytes long, so one starting just before the write overlaps it as well
+    uint32_t start = (address > 0) ? address - 1 : 0;
+    uint32_t end = address + length;
+    if (end > DECODE_CACHE_SIZE)
+    {
+        // Writes past the end of memory wrap around to its start
+        invalidate_decode_cache(state, 0, end - DECODE_CACHE_SIZE);
+        end = DECODE_CACHE_SIZE;
+    }
+
+    for (uint32_t i = start; i < end; i++)
+        state->decode_cache[i].type = UNDECODED;
 }
\ No newline at end of file
@@ -12,7 +12,12 @@
  * 2. Allocate and load the program/instructions to memory
  * 3. Wire your peripherals such that they align with the function pointer signatures described by the `peripherals` struct
  * 4. Call chip8_init with the aforementioned: memory, program memory, and peripherals and assign to a variable
- * 5. Iteratively call chip8_run, passing a reference to your previously assigned chip8 variable
+ * 5. Iteratively call chip8_run (or chip8_run_cycles), passing a reference to your previously assigned chip8 variable
+ *
+ * Defining CHIP8_XO_CHIP at build time extends the device to XO-CHIP: a 64KB address space, a second plane
+ * of the screen selected with FN01, and F000 NNNN loading I with a 16-bit address. The interpreters,
+ * snapshots and traces work with it. The JIT, the batch engine and the AOT translator only implement
+ * CHIP-8 and SUPER-CHIP, and aren't used by XO-CHIP builds
  *
  * @see main.c for a well-defined example usage
  */
@@ -47,27 +52,62 @@
 
 /**
  * @def SCREEN_W
- * @brief The width of the device's screen
+ * @brief The width of the device's screen in high resolution (SUPER-CHIP's 00FF). @see state.hires
  */
-#define SCREEN_W 64
+#define SCREEN_W 128
 
 /**
  * @def SCREEN_H
- * @brief The height of the device's screen
+ * @brief The height of the device's screen in high resolution
  */
-#define SCREEN_H 32
+#define SCREEN_H 64
 
 /**
- * @def SCREEN_BYTES
- * @brief The number of bytes needed to represent the device's screen
+ * @def LORES_SCREEN_W
+ * @brief The width of the device's screen in low resolution, as on the original CHIP-8
  */
-#define SCREEN_BYTES ((SCREEN_W * SCREEN_H) / __CHAR_BIT__)
+#define LORES_SCREEN_W 64
 
 /**
- * @def DIGIT_SPRITES_OFFSET
- * @brief The location in memory where the sprites of the hex digits should be stored
+ * @def LORES_SCREEN_H
+ * @brief The height of the device's screen in low resolution
  */
-#define DIGIT_SPRITES_OFFSET 0
+#define LORES_SCREEN_H 32
+
+/**
+ * @def CURRENT_SCREEN_W
+ * @brief The width of the given state's screen at its current resolution
+ */
+#define CURRENT_SCREEN_W(state) ((state)->hires ? SCREEN_W : LORES_SCREEN_W)
+
+/**
+ * @def CURRENT_SCREEN_H
+ * @brief The height of the given state's screen at its current resolution
+ */
+#define CURRENT_SCREEN_H(state) ((state)->hires ? SCREEN_H : LORES_SCREEN_H)
+
+/**
+ * @def SCREEN_PLANES
+ * @brief The number of bit planes the screen is made of. Each pixel's color is the planes' bits combined,
+ *  the first plane as the least significant bit. XO-CHIP has two, and everything else one
+ */
+#ifdef CHIP8_XO_CHIP
+#define SCREEN_PLANES 2
+#else
+#define SCREEN_PLANES 1
+#endif
+
+/**
+ * @def SCREEN_PLANE_BYTES
+ * @brief The number of bytes needed to represent a single plane of the device's screen
+ */
+#define SCREEN_PLANE_BYTES ((SCREEN_W * SCREEN_H) / __CHAR_BIT__)
+
+/**
+ * @def SCREEN_BYTES
+ * @brief The number of bytes needed to represent the device's screen, every plane back to back
+ */
+#define SCREEN_BYTES (SCREEN_PLANES * SCREEN_PLANE_BYTES)
 
 /**
  * @def H_OFFSET
@@ -76,18 +116,50 @@
  */
 #define H_OFFSET (SCREEN_W / __CHAR_BIT__)
 
+/**
+ * @def SCREEN_ROW_WORDS
+ * @brief How many 64-bit words to a row of the screen
+ */
+#define SCREEN_ROW_WORDS (SCREEN_W / 64)
+
+/**
+ * @def SCREEN_ROW
+ * @brief Converts a word of a row of the screen between 64 pixels, with the leftmost as its most significant bit,
+ *  and the order it's stored in. Words are stored big-endian, so that their bytes are in the order the display
+ *  peripherals expect @see state.screen_rows
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SCREEN_ROW(row) (row)
+#else
+#define SCREEN_ROW(row) __builtin_bswap64(row)
+#endif
+
+/**
+ * @def DIGIT_SPRITES_OFFSET
+ * @brief The location in memory where the sprites of the hex digits should be stored
+ */
+#define DIGIT_SPRITES_OFFSET 0
+
 /**
  * @def RAM_SIZE
  * @brief The number of bytes representing the device's total memory
- *        4KB by default
+ *        4KB by default, and 64KB with CHIP8_XO_CHIP
  */
+#ifdef CHIP8_XO_CHIP
+#define RAM_SIZE 65536
+#else
 #define RAM_SIZE 4096
+#endif
 
 /**
  * @def PROGRAM_SIZE
  * @brief The number of bytes allocated for the program's memory
  */
+#ifdef CHIP8_XO_CHIP
+#define PROGRAM_SIZE (RAM_SIZE - PROGRAM_OFFSET)
+#else
 #define PROGRAM_SIZE 0xDFF
+#endif
 
 /**
  * @def PROGRAM_OFFSET
@@ -95,6 +167,69 @@
  */
 #define PROGRAM_OFFSET 0x200
 
+/**
+ * @def TIMER_HZ
+ * @brief The rate at which the delay and audio timers count down. Each tick of the timers marks a frame
+ */
+#define TIMER_HZ 60
+
+/**
+ * @def CYCLES_PER_FRAME
+ * @brief The default number of instructions executed per frame (i.e. per tick of the timers).
+ *  At TIMER_HZ this is roughly 700 instructions per second
+ */
+#define CYCLES_PER_FRAME 12
+
+/**
+ * @def DECODE_CACHE_SIZE
+ * @brief The number of decoded operations needed for a decode cache to cover the device's memory.
+ *  There is one entry per address, as instructions are not required to be aligned
+ */
+#define DECODE_CACHE_SIZE RAM_SIZE
+
+/**
+ * @def RESET_BLOCK_SIZE
+ * @brief The number of bytes of memory compared against the golden image at a time by reset_state.
+ *  Only the blocks that differ are copied back
+ */
+#define RESET_BLOCK_SIZE 64
+
+#ifdef CHIP8_PAGED_MEMORY
+/**
+ * @def MEMORY_PAGE_SHIFT
+ * @brief The log2 of the size of a page of memory, in CHIP8_PAGED_MEMORY builds. @see memory.h
+ */
+#define MEMORY_PAGE_SHIFT 8
+
+/**
+ * @def MEMORY_PAGE_SIZE
+ * @brief The number of bytes to a page of memory
+ */
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+
+/**
+ * @def MEMORY_PAGE_COUNT
+ * @brief The number of pages the device's memory is split into
+ */
+#define MEMORY_PAGE_COUNT (RAM_SIZE / MEMORY_PAGE_SIZE)
+
+/**
+ * @def CHIP8_PAGE_POOL
+ * @brief The most pages that may be written to. May be defined at build time
+ */
+#ifndef CHIP8_PAGE_POOL
+#define CHIP8_PAGE_POOL 4
+#endif
+
+/**
+ * @def MEMORY_SIZE
+ * @brief The size, in bytes, of the memory buffer a device must be given
+ */
+#define MEMORY_SIZE (CHIP8_PAGE_POOL * MEMORY_PAGE_SIZE)
+#else
+#define MEMORY_SIZE RAM_SIZE
+#endif
+
 ///
 /// Instructions
 ///
@@ -224,7 +359,10 @@ enum op_type
     RANDOM,
     /**
      * @brief Loads a given constant 'n' worth of bytes from memory at the I index,
-     *  and draws the sprite to the V[X] and V[Y] position in the screen buffer
+     *  and draws the sprite to the V[X] and V[Y] position in the screen buffer.
+     *  With 'n' of 0 (SUPER-CHIP), a 16x16 sprite of 32 bytes is drawn, two bytes to a row.
+     *  (XO-CHIP) The sprite is drawn to each selected plane in turn, the next plane's sprite following
+     *  the last one's in memory
      * peripheral: display
      */
     DRAW_SPRITE,
@@ -288,12 +426,62 @@ enum op_type
      * modifies: V[0] ... V[X]
      */
     REG_LOAD,
+    /**
+     * @brief (SUPER-CHIP) Scrolls the screen down by N rows, at its current resolution
+     * peripheral: display
+     */
+    SCROLL_DOWN,
+    /**
+     * @brief (SUPER-CHIP) Scrolls the screen right by 4 pixels
+     * peripheral: display
+     */
+    SCROLL_RIGHT,
+    /**
+     * @brief (SUPER-CHIP) Scrolls the screen left by 4 pixels
+     * peripheral: display
+     */
+    SCROLL_LEFT,
+    /**
+     * @brief (SUPER-CHIP) Switches the screen to low resolution, LORES_SCREEN_W x LORES_SCREEN_H, and clears it
+     * modifies: hires
+     * peripheral: resolution, display
+     */
+    LORES,
+    /**
+     * @brief (SUPER-CHIP) Switches the screen to high resolution, SCREEN_W x SCREEN_H, and clears it
+     * modifies: hires
+     * peripheral: resolution, display
+     */
+    HIRES,
+    /**
+     * @brief (XO-CHIP) Selects the planes of the screen that are drawn to, cleared and scrolled, as the
+     *  bit mask X (FX01)
+     * modifies: planes
+     */
+    SELECT_PLANES,
+    /**
+     * @brief (XO-CHIP) Loads the 16-bit address in the two bytes following the instruction into I, and
+     *  skips over them (F000 NNNN). Skipping instructions skip the whole four bytes of it
+     * modifies: I, PC
+     */
+    LONG_I,
     /**
      * @brief Not an actual instruction. Just used as a placeholder.
      */
     NOOP,
+    /**
+     * @brief Not an actual instruction. Marks an entry of a decode cache that has yet to be
+     *  (re)decoded from memory
+     * @see decode_cache
+     */
+    UNDECODED,
 };
 
+/**
+ * @brief The name of each op_type, as written in its enum (e.g. "CLEAR_DISPLAY"), for reports and traces
+ */
+extern const char *const op_type_names[UNDECODED + 1];
+
 /**
  * Lookup table that maps the first bit of an instruction to an instruction type.
  * This is not the case for all operations.
@@ -361,14 +549,73 @@ typedef struct op
 typedef struct state
 {
     /**
-     * @brief The pointer to the memory buffer. Should be set to the size specified by RAM_SIZE
-     * @see RAM_SIZE
+     * @brief The pointer to the memory buffer. Should be set to the size specified by MEMORY_SIZE, which is
+     * RAM_SIZE unless CHIP8_PAGED_MEMORY is defined, in which case it's the pool that written pages are copied to
+     * @see memory.h
      */
     uint8_t *memory;
+#ifdef CHIP8_PAGED_MEMORY
+    /**
+     * @brief The page of the pool each page of memory was copied to when first written. MEMORY_UNWRITTEN
+     * for those that haven't been, which are read from the program (or the digit sprites) instead
+     */
+    uint8_t page_table[MEMORY_PAGE_COUNT];
+    /**
+     * @brief The number of pages of the pool in use
+     */
+    uint8_t pages_used;
     /**
-     * @brief A buffer for the contents of the machine's screen. Its size is determined by SCREEN_H x SCREEN_W
+     * @brief Set if a write was dropped, as it was to a page that couldn't be copied with the pool in use
      */
-    uint8_t screen[SCREEN_BYTES];
+    uint8_t pool_exhausted;
+    /**
+     * @brief The program the unwritten pages are read from. On AVR, this is a pointer into flash
+     */
+    const uint8_t *program;
+    /**
+     * @brief The size of the program in bytes. The memory past it reads as zeros. PROGRAM_SIZE by default
+     */
+    uint16_t program_size;
+#endif
+    union
+    {
+        /**
+         * @brief A buffer for the contents of the machine's screen. Its size is determined by SCREEN_H x SCREEN_W.
+         * Each byte is 8 pixels of a row, the leftmost as its most significant bit, and each row is H_OFFSET
+         * bytes. In low resolution, only the first LORES_SCREEN_W pixels of the first LORES_SCREEN_H rows are used.
+         * With more than one plane, each plane's SCREEN_PLANE_BYTES follow the last's
+         */
+        uint8_t screen[SCREEN_BYTES];
+        /**
+         * @brief The first plane of the same buffer, SCREEN_ROW_WORDS words to each row, so that a sprite is drawn
+         * to a row with a single XOR of each word it covers, and scrolls are word shifts. Words are stored big-endian
+         * @see SCREEN_ROW
+         */
+        uint64_t screen_rows[SCREEN_H][SCREEN_ROW_WORDS];
+        /**
+         * @brief Every plane of the same buffer, as rows of words
+         */
+        uint64_t screen_planes[SCREEN_PLANES][SCREEN_H][SCREEN_ROW_WORDS];
+    };
+    /**
+     * @brief The bit mask of the planes that are drawn to, cleared and scrolled. Only the first plane,
+     * 1, unless changed by SELECT_PLANES
+     */
+    uint8_t planes;
+    /**
+     * @brief Set while the screen is in high resolution, SCREEN_W x SCREEN_H. Otherwise, it's in low
+     * resolution, LORES_SCREEN_W x LORES_SCREEN_H
+     */
+    uint8_t hires;
+    /**
+     * @brief The first row of the screen that has changed since it was last displayed
+     */
+    uint8_t dirty_top;
+    /**
+     * @brief One past the last row of the screen that has changed since it was last displayed.
+     * No rows have changed if this is not greater than dirty_top
+     */
+    uint8_t dirty_bottom;
     /**
      * @brief The Program Counter register.
      * It points to the location in memory that holds the current instruction to be fetched
@@ -384,14 +631,22 @@ typedef struct state
      */
     uint16_t I;
     /**
-     * @brief The delay_timer. If positive, it is decremented by one each cycle of the cpu
+     * @brief The delay_timer. If positive, it is decremented by one each frame
      */
     uint8_t delay_timer;
     /**
-     * @brief The audio_timer. If positive, it is decremented by one each cycle of the cpu.
-     * Each cycle its value is positive, the audio peripheral is called to produce noise
+     * @brief The audio_timer. If positive, it is decremented by one each frame.
+     * The buzzer peripheral sounds for as many frames as its value
      */
     uint8_t audio_timer;
+    /**
+     * @brief Whether the buzzer peripheral was last told to sound (1) or to stop (0)
+     */
+    uint8_t buzzer_on;
+    /**
+     * @brief The number of cycles that have been run since the timers were last ticked
+     */
+    uint16_t frame_cycles;
     /**
      * @brief The Stack. It used to persist the PC as subroutines are branched to during CALL operations.
      * It is managed by the SP
@@ -402,39 +657,100 @@ typedef struct state
      * and perform as part of instructions
      */
     uint8_t V[REGISTER_COUNT];
+    /**
+     * @brief An optional buffer of DECODE_CACHE_SIZE decoded operations, indexed by address.
+     * Entries are decoded lazily as the PC reaches them, and are reset to UNDECODED whenever the
+     * memory they were decoded from is written to. NULL if no cache is used
+     * @see attach_decode_cache
+     */
+    op *decode_cache;
+#ifdef CHIP8_INSTRUMENT
+    /**
+     * @brief The counters this device adds to as it runs. NULL if it isn't counted
+     * @see chip8_stats_attach
+     */
+    struct chip8_stats *stats;
+#endif
+#if CHIP8_TRACE_LEVEL > 0
+    /**
+     * @brief The buffer the instructions this device runs are traced into. NULL if it isn't traced
+     * @see chip8_trace_attach
+     */
+    struct trace_buffer *trace;
+#endif
 } state;
 
+/**
+ * @enum present_mode
+ * @brief When the display peripheral is handed the contents of the screen
+ */
+enum present_mode
+{
+    /**
+     * @brief The display peripheral is called as soon as the screen is drawn to or cleared
+     */
+    PRESENT_IMMEDIATE,
+    /**
+     * @brief Drawing only marks the screen as dirty. The display peripheral is called at most once per
+     *  frame, when the timers are ticked, with all of the rows changed during that frame
+     */
+    PRESENT_VBLANK,
+};
+
 /**
  * @struct peripherals
  * @brief Configurable function pointers that are provided as callbacks that may be used by the CHIP-8
- *  device during operation
+ *  device during operation. Every callback is given the peripherals' user pointer as its first parameter,
+ *  so that each device may be wired to its own instance of a peripheral
  */
 typedef struct peripherals
 {
+    /**
+     * @brief A context pointer that is passed, untouched, as the first parameter of every callback
+     */
+    void *user;
     /**
      * @brief The display peripheral that is called. It is provided the screen buffer as a parameter
      * It should draw the contents of the screen to some sort of display
      */
-    void (*display)(uint8_t *);
+    void (*display)(void *, uint8_t *);
+    /**
+     * @brief An optional display peripheral that is only provided the rows of the screen buffer that have changed.
+     * It is given a pointer to the first changed row, the index of that row, and the number of rows that changed.
+     * The same rows of any other planes are SCREEN_PLANE_BYTES after them.
+     * If set, it is called instead of display
+     */
+    void (*display_region)(void *, uint8_t *, uint8_t, uint8_t);
+    /**
+     * @brief An optional display peripheral that is called with 1 when the screen switches to high resolution,
+     * and with 0 when it switches back to low resolution. The screen is cleared on a switch, and displayed as
+     * usual afterwards. Rows of the screen buffer are always H_OFFSET bytes apart, but in low resolution only
+     * the first LORES_SCREEN_H of them, and the first LORES_SCREEN_W pixels of those, are drawn to
+     */
+    void (*resolution)(void *, uint8_t);
     /**
-     * @brief The audio/noiser peripheral that is periodically called
-     * It should create some noise via some sounder
+     * @brief When the display peripherals are called. PRESENT_IMMEDIATE by default
      */
-    void (*noise)();
+    enum present_mode present_mode;
+    /**
+     * @brief The audio/buzzer peripheral. It is called with 1 when the audio_timer starts counting down,
+     * and with 0 once it has expired. It should start or stop some sounder without blocking
+     */
+    void (*buzzer)(void *, uint8_t);
     /**
      * @brief The random number generator peripheral. It should produce a random byte of data.
      */
-    uint8_t (*random)();
+    uint8_t (*random)(void *);
     /**
      * @brief The keyboard peripheral. It should determine if the key with the given code
      * was pressed. It should return a value of 1 if pressed, and 0 if it wasn't.
      */
-    uint8_t (*is_key_pressed)(uint8_t);
+    uint8_t (*is_key_pressed)(void *, uint8_t);
     /**
      * @brief The keyboard peripheral. It should produce a blocking call that awaits the
      * press of a key. The keycode should be returned by this function.
      */
-    uint8_t (*get_key_pressed)();
+    uint8_t (*get_key_pressed)(void *);
 } peripherals;
 
 /**
@@ -451,6 +767,11 @@ typedef struct chip8
      * @brief The given peripherals that may be accessed by the device
      */
     peripherals *peripherals;
+    /**
+     * @brief The number of instructions executed per frame. The timers are ticked once this many cycles
+     * have been run, so that they count down at TIMER_HZ no matter how fast the device is run
+     */
+    uint16_t cycles_per_frame;
 } chip8;
 
 /**
@@ -468,19 +789,75 @@ typedef struct chip8_config
      */
     uint8_t *memory;
     /**
-     * @brief The program instructions that have been read and will be loaded into the CHIP-8's memory
+     * @brief The program instructions that have been read and will be loaded into the CHIP-8's memory.
+     * With CHIP8_PAGED_MEMORY, the program isn't copied, and must outlive the device
      */
     uint8_t *program;
+    /**
+     * @brief An optional buffer of DECODE_CACHE_SIZE operations to be used as the device's decode cache.
+     * May be NULL (e.g. on memory constrained targets), in which case every instruction is decoded as it's run
+     */
+    op *decode_cache;
+    /**
+     * @brief The number of instructions to execute per frame. CYCLES_PER_FRAME is used if 0
+     */
+    uint16_t cycles_per_frame;
 } chip8_config;
 
 /**
  * @brief initializes the given state with the provided memory and program/instructions
  *
  * It zeroes memory, registers, and sets up the memory appropriately. It maps the program
- * into the appropriate place in the device's memory
+ * into the appropriate place in the device's memory. Any decode cache is detached, as are any counters
+ * with CHIP8_INSTRUMENT and any trace buffer with CHIP8_TRACE_LEVEL.
+ * With CHIP8_PAGED_MEMORY, every page is marked unwritten, and the program is only read from as needed,
+ * so it must outlive the device
  */
 void init_state(state *state, uint8_t *memory, uint8_t *program);
 
+/**
+ * @brief Writes the RAM_SIZE bytes of memory a device has once it's been initialized with the given program:
+ * the digit sprites, and the program at PROGRAM_OFFSET, zeroed past its end. Devices may then be reset to
+ * this image far more cheaply than they're initialized @see reset_state
+ *
+ * @param golden - The RAM_SIZE bytes of the image to be written
+ * @param program - The program to be placed in the image
+ * @param size - The size of the program in bytes. At most PROGRAM_SIZE
+ */
+void init_golden_image(uint8_t *golden, const uint8_t *program, uint16_t size);
+
+/**
+ * @brief Resets the given state as if it had just been initialized, with its memory restored from the
+ * given golden image @see init_golden_image
+ *
+ * Memory is compared with the image RESET_BLOCK_SIZE bytes at a time, and only the blocks that differ are
+ * copied back and invalidated in the decode cache, which stays attached. Programs that only write to a few
+ * bytes of memory are reset without touching the rest of it.
+ * With CHIP8_PAGED_MEMORY, the pages written are forgotten instead, and the golden image is unused
+ *
+ * @param state - The state to be reset. Must have been initialized
+ * @param golden - The image memory is restored from
+ */
+void reset_state(state *state, const uint8_t *golden);
+
+/**
+ * @brief Attaches the given decode cache to the state, and marks all of its entries as UNDECODED
+ *
+ * @param state - The state whose instructions will be cached
+ * @param decode_cache - A buffer of DECODE_CACHE_SIZE operations. NULL detaches the current cache
+ */
+void attach_decode_cache(state *state, op *decode_cache);
+
+/**
+ * @brief Marks the decode cache entries of any instruction overlapping the given memory range as UNDECODED.
+ * This should be called whenever the device's memory is written to outside of execute
+ *
+ * @param state - The state whose decode cache should be invalidated
+ * @param address - The first address that was written to
+ * @param length - The number of bytes that were written
+ */
+void invalidate_decode_cache(state *state, uint16_t address, uint32_t length);
+
 /**
  * @brief This function reads the next instruction from memory, based off of the given state's PC.
  *
@@ -497,13 +874,23 @@ void fetch(state *state, uint8_t instruction[2]);
  */
 void decode(uint8_t instruction[2], op *decoded_op);
 
+/**
+ * @brief Fetches and decodes the instruction at the given state's PC by way of its decode cache,
+ * and advances the PC. The instruction is only decoded if its cache entry is UNDECODED.
+ * The state must have a decode cache attached
+ *
+ * @param state - The state of our emulator, which we'll use to read memory and PC
+ * @returns The decode cache entry for the instruction
+ */
+op *fetch_decoded(state *state);
+
 /**
  * @brief Given a well formed decoded operation, this function will execute the operation against the
  * given state, and will call peripheral methods as necessary.
  *
  * @param decoded_op - The operation and its operands, to be executed
  * @param state - The state of our emulator to which the decoded_op will be run against
- * @param peripherals - The callbacks to peripheral functions (e.g. noiser)
+ * @param peripherals - The callbacks to peripheral functions (e.g. buzzer)
  */
 void execute(op *decoded_op, state *state, peripherals *peripherals);
 
@@ -513,11 +900,62 @@ void execute(op *decoded_op, state *state, peripherals *peripherals);
  * 1. Fetch retrieves instruction and advances PC
  * 2. The instruction, and its operands, are decoded
  * 3. The decoded operation is executed against the state. Calling peripherals as necessary.
+ * 4. The timers are ticked if the cycle completed a frame
  *
  * @param cpu - The given CHIP-8 instance to run a cycle on
  */
 void chip8_run(chip8 *cpu);
 
+/**
+ * @brief Performs the given number of cycles against the given CHIP-8 instance
+ *
+ * The cycles are run in batches that end at each frame boundary, where the timers are ticked.
+ * The batches are run by the interpreter engine selected at build time. This is the `execute` switch
+ * by default, or the direct-threaded engine if CHIP8_THREADED is defined. @see threaded.h
+ *
+ * @param cpu - The given CHIP-8 instance to run cycles on
+ * @param cycles - The number of instructions to execute
+ */
+void chip8_run_cycles(chip8 *cpu, uint32_t cycles);
+
+/**
+ * @brief Runs a batch of instructions against a CHIP-8 instance, for chip8_run_cycles_with
+ *
+ * @param user - The user context given to chip8_run_cycles_with
+ * @param cycles - The number of instructions to execute. These never run past the end of the frame
+ */
+typedef void (*chip8_runner)(void *user, uint32_t cycles);
+
+/**
+ * @brief Performs the given number of cycles against the given CHIP-8 instance, with the given engine.
+ * This is how chip8_run_cycles runs the interpreter, and how the JIT and AOT engines are run
+ *
+ * The cycles are handed to run in batches that end at each frame boundary, where the timers are ticked.
+ *
+ * @param cpu - The given CHIP-8 instance to run cycles on
+ * @param cycles - The number of instructions to execute
+ * @param run - Executes each batch of instructions
+ * @param user - The user context passed to run
+ */
+void chip8_run_cycles_with(chip8 *cpu, uint32_t cycles, chip8_runner run, void *user);
+
+/**
+ * @brief Runs the given CHIP-8 instance up to the end of its current frame, ticking its timers.
+ * Calling this at TIMER_HZ runs the device in real time
+ *
+ * @param cpu - The given CHIP-8 instance to run a frame on
+ */
+void chip8_run_frame(chip8 *cpu);
+
+/**
+ * @brief Ticks the timers of the given CHIP-8 instance, starting or stopping the buzzer peripheral
+ * as the audio_timer becomes positive or expires. This is done once per frame by the run functions.
+ * With PRESENT_VBLANK, any rows drawn to during the frame are displayed
+ *
+ * @param cpu - The given CHIP-8 instance whose timers should be advanced
+ */
+void chip8_tick(chip8 *cpu);
+
 /**
  * @brief Initializes state for a well-defined CHIP-8 instance
  *
@@ -526,12 +964,32 @@ void chip8_run(chip8 *cpu);
  */
 chip8 chip8_init(chip8_config *config);
 
+/**
+ * @brief Resets the given CHIP-8 instance to run its program from the start, restoring its memory from the
+ * given golden image @see reset_state. The buzzer is stopped if it's sounding, the screen is put back in
+ * low resolution, and the whole of the cleared screen is marked dirty, so that it's included in the next display
+ *
+ * @param cpu - The CHIP-8 instance to be reset
+ * @param golden - The image of the instance's memory once initialized @see init_golden_image
+ */
+void chip8_reset(chip8 *cpu, const uint8_t *golden);
+
 /**
  * @brief Function called when decoding a DISPLAY operation
- * It sets the states screen buffer appropriately
+ * It sets the states screen buffer appropriately, and marks the rows it drew to as dirty
  */
 void display(state *state, op *decoded_op);
 
+/**
+ * @brief Marks the given rows of the screen as changed, so that they're included in the next display.
+ * Rows past the bottom of the screen at its current resolution are left out
+ *
+ * @param state - The state whose screen has changed
+ * @param first_row - The first row that changed
+ * @param row_count - The number of rows that changed
+ */
+void mark_dirty(state *state, uint8_t first_row, uint8_t row_count);
+
 // If SP was previously defined, redefine it here
 #ifdef SP_BACKUP
 #define SP SP_BACKUP
@@ -0,0 +1,85 @@
+/**
+ * @file instrument.c
+ * @brief This module implements the counters of CHIP8_INSTRUMENT builds and their report
+ */
+#include "instrument.h"
+
+#ifdef CHIP8_INSTRUMENT
+
+static const char *callback_names[] = {
+    [INSTRUMENT_DISPLAY] = "display",
+    [INSTRUMENT_BUZZER] = "buzzer",
+    [INSTRUMENT_RANDOM] = "random",
+    [INSTRUMENT_IS_KEY_PRESSED] = "is_key_pressed",
+    [INSTRUMENT_GET_KEY_PRESSED] = "get_key_pressed",
+};
+
+void chip8_stats_attach(state *state, chip8_stats *stats)
+{
+    state->stats = stats;
+}
+
+void chip8_stats_reset(chip8_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+/**
+ * Returns the address run most often after the given one, ordered by count and then by address.
+ * Returns RAM_SIZE if there's none left that has been run
+ */
+static uint32_t next_top_address(const chip8_stats *stats, uint64_t previous_count, uint16_t previous)
+{
+    const uint64_t *counts = stats->pc_counts;
+    uint32_t best = RAM_SIZE;
+
+    for (uint32_t address = 0; address < RAM_SIZE; address++)
+    {
+        uint64_t count = counts[address];
+        if (count == 0 || count > previous_count || (count == previous_count && address <= previous))
+            continue;
+        if (best == RAM_SIZE || count > counts[best])
+            best = address;
+    }
+    return best;
+}
+
+void chip8_stats_report(FILE *out, const chip8_stats *stats, uint16_t top_addresses)
+{
+    uint64_t total = 0;
+    for (int type = 0; type <= UNDECODED; type++)
+        total += stats->op_counts[type];
+
+    fprintf(out, "instrumented_instructions: %llu\n", (unsigned long long)total);
+    for (int type = 0; type <= UNDECODED; type++)
+        if (stats->op_counts[type] > 0)
+            fprintf(out, "  op %-16s %12llu %6.2f%%\n", op_type_names[type], (unsigned long long)stats->op_counts[type],
+                    100.0 * stats->op_counts[type] / total);
+
+    fprintf(out, "hottest_addresses:\n");
+    uint64_t previous_count = UINT64_MAX;
+    uint16_t previous = 0;
+    for (uint16_t i = 0; i < top_addresses; i++)
+    {
+        uint32_t address = next_top_address(stats, previous_count, previous);
+        if (address == RAM_SIZE)
+            break;
+        fprintf(out, "  0x%03X %12llu %6.2f%%\n", address, (unsigned long long)stats->pc_counts[address],
+                100.0 * stats->pc_counts[address] / total);
+        previous_count = stats->pc_counts[address];
+        previous = address;
+    }
+
+    fprintf(out, "draws: %llu\n", (unsigned long long)stats->draws);
+    fprintf(out, "collisions: %llu\n", (unsigned long long)stats->collisions);
+    fprintf(out, "peripheral_calls:\n");
+    for (int callback = 0; callback < INSTRUMENT_CALLBACK_COUNT; callback++)
+    {
+        uint64_t calls = stats->callback_calls[callback];
+        fprintf(out, "  %-16s %12llu calls %12llu cycles %8.1f cycles/call\n", callback_names[callback],
+                (unsigned long long)calls, (unsigned long long)stats->callback_cycles[callback],
+                (calls > 0) ? (double)stats->callback_cycles[callback] / calls : 0.0);
+    }
+}
+
+#endif
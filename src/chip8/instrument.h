@@ -0,0 +1,188 @@
+/**
+ * @file instrument.h
+ * @brief Counters of what a CHIP-8 device spends its time on, compiled in with CHIP8_INSTRUMENT
+ *
+ * When CHIP8_INSTRUMENT is defined, the interpreter engines count every instruction they run, by its
+ * operation type and by its address, along with every sprite drawn and every one that collided. Each call
+ * to a peripheral is counted and timed with the host's cycle counter, so that the time spent emulating
+ * can be told apart from the time spent in the peripherals.
+ *
+ * Each device adds to the counters attached to it with chip8_stats_attach, and isn't counted while none are.
+ * Devices run on different threads should each have their own. The counters are only ever added to until
+ * reset. Code run by the JIT or by an ahead-of-time translation is only counted where it hands back to the
+ * core, e.g. to draw.
+ *
+ * When CHIP8_INSTRUMENT isn't defined, none of the counters exist, and the hooks in the core expand to
+ * nothing (or to the bare peripheral call) so the engines are exactly as they'd be without them.
+ */
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include "chip8.h"
+
+#ifdef CHIP8_INSTRUMENT
+
+/**
+ * @def CHIP8_INSTRUMENT_CLOCK
+ * @brief Reads the cycle counter peripheral calls are timed with. It may be defined before this header
+ *  is included to use another clock (e.g. micros() on the Arduino). Calls aren't timed if there is none
+ */
+#ifndef CHIP8_INSTRUMENT_CLOCK
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CHIP8_INSTRUMENT_CLOCK() __rdtsc()
+#elif defined(__aarch64__)
+static inline uint64_t instrument_clock(void)
+{
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+}
+#define CHIP8_INSTRUMENT_CLOCK() instrument_clock()
+#else
+#define CHIP8_INSTRUMENT_CLOCK() 0
+#endif
+#endif
+
+/**
+ * @enum instrument_callback
+ * @brief The peripherals whose calls are counted and timed
+ */
+enum instrument_callback
+{
+    /**
+     * @brief display or display_region
+     */
+    INSTRUMENT_DISPLAY,
+    INSTRUMENT_BUZZER,
+    INSTRUMENT_RANDOM,
+    INSTRUMENT_IS_KEY_PRESSED,
+    INSTRUMENT_GET_KEY_PRESSED,
+    /**
+     * @brief Not a peripheral. The number of peripherals counted
+     */
+    INSTRUMENT_CALLBACK_COUNT,
+};
+
+/**
+ * @struct chip8_stats
+ * @brief The counters gathered while CHIP8_INSTRUMENT is defined
+ */
+typedef struct chip8_stats
+{
+    /**
+     * @brief The number of instructions run of each operation type
+     */
+    uint64_t op_counts[UNDECODED + 1];
+    /**
+     * @brief The number of instructions run from each address
+     */
+    uint64_t pc_counts[RAM_SIZE];
+    /**
+     * @brief The number of sprites drawn, i.e. calls to display
+     */
+    uint64_t draws;
+    /**
+     * @brief The number of sprites drawn that turned off a pixel, setting V[0xF]
+     */
+    uint64_t collisions;
+    /**
+     * @brief The number of calls to each peripheral
+     */
+    uint64_t callback_calls[INSTRUMENT_CALLBACK_COUNT];
+    /**
+     * @brief The total cycles of CHIP8_INSTRUMENT_CLOCK spent in each peripheral
+     */
+    uint64_t callback_cycles[INSTRUMENT_CALLBACK_COUNT];
+} chip8_stats;
+
+/**
+ * @brief Attaches the given counters to the state, to be added to as it runs
+ *
+ * @param state - The state of the device to be counted
+ * @param stats - The counters. NULL stops counting the device
+ */
+void chip8_stats_attach(state *state, chip8_stats *stats);
+
+/**
+ * @brief Zeroes every counter
+ *
+ * @param stats - The counters to be zeroed
+ */
+void chip8_stats_reset(chip8_stats *stats);
+
+/**
+ * @brief Writes a readable report of the counters: the count and share of each operation type that was run,
+ * the addresses run most often, the draws and collisions, and the calls and average cycles of each peripheral
+ *
+ * @param out - The stream to write the report to
+ * @param stats - The counters to report
+ * @param top_addresses - The number of the most run addresses to list
+ */
+void chip8_stats_report(FILE *out, const chip8_stats *stats, uint16_t top_addresses);
+
+/**
+ * @def INSTRUMENT_OP
+ * @brief Counts an instruction of the given type run by the given state from the given address
+ */
+#define INSTRUMENT_OP(state, address, type)                               \
+    do                                                                    \
+    {                                                                     \
+        chip8_stats *instrument_stats = (state)->stats;                   \
+        if (instrument_stats != NULL)                                     \
+        {                                                                 \
+            instrument_stats->op_counts[type]++;                          \
+            instrument_stats->pc_counts[(address) % RAM_SIZE]++;          \
+        }                                                                 \
+    } while (0)
+
+/**
+ * @def INSTRUMENT_DRAW
+ * @brief Counts a sprite drawn by the given state, and whether it collided
+ */
+#define INSTRUMENT_DRAW(state, collided)                                  \
+    do                                                                    \
+    {                                                                     \
+        chip8_stats *instrument_stats = (state)->stats;                   \
+        if (instrument_stats != NULL)                                     \
+        {                                                                 \
+            instrument_stats->draws++;                                    \
+            instrument_stats->collisions += (collided) != 0;              \
+        }                                                                 \
+    } while (0)
+
+/**
+ * @def INSTRUMENT_CALLBACK
+ * @brief Makes the given call to a peripheral for the given state, counting and timing it as the given
+ * instrument_callback
+ */
+#define INSTRUMENT_CALLBACK(state, callback, call)                                        \
+    do                                                                                    \
+    {                                                                                     \
+        chip8_stats *instrument_stats = (state)->stats;                                   \
+        if (instrument_stats == NULL)                                                     \
+        {                                                                                 \
+            call;                                                                         \
+        }                                                                                 \
+        else                                                                              \
+        {                                                                                 \
+            uint64_t instrument_start = CHIP8_INSTRUMENT_CLOCK();                         \
+            call;                                                                         \
+            instrument_stats->callback_cycles[callback] += CHIP8_INSTRUMENT_CLOCK() - instrument_start; \
+            instrument_stats->callback_calls[callback]++;                                 \
+        }                                                                                 \
+    } while (0)
+
+#else
+
+#define INSTRUMENT_OP(state, address, type) ((void)0)
+#define INSTRUMENT_DRAW(state, collided) ((void)0)
+#define INSTRUMENT_CALLBACK(state, callback, call) \
+    do                                             \
+    {                                              \
+        call;                                      \
+    } while (0)
+
+#endif
+
+#endif
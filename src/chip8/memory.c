@@ -0,0 +1,46 @@
+/**
+ * @file memory.c
+ * @brief This module implements the copy-on-write pages of CHIP8_PAGED_MEMORY builds
+ */
+#include "memory.h"
+
+#ifdef CHIP8_PAGED_MEMORY
+
+uint8_t memory_read_unwritten(state *state, uint16_t address)
+{
+    if (address < DIGIT_SPRITES_OFFSET + sizeof(digit_sprites_data) && address >= DIGIT_SPRITES_OFFSET)
+        return digit_sprites_data[address - DIGIT_SPRITES_OFFSET];
+
+    uint16_t offset = address - PROGRAM_OFFSET;
+    if (address >= PROGRAM_OFFSET && offset < state->program_size && state->program != NULL)
+        return CHIP8_PROGRAM_READ(&state->program[offset]);
+    return 0;
+}
+
+void memory_write(state *state, uint16_t address, uint8_t value)
+{
+    address &= RAM_SIZE - 1;
+    uint8_t *page_entry = &state->page_table[address >> MEMORY_PAGE_SHIFT];
+
+    if (*page_entry == MEMORY_UNWRITTEN)
+    {
+        // Writing what's already there needn't take up a page
+        if (memory_read_unwritten(state, address) == value)
+            return;
+        if (state->pages_used == CHIP8_PAGE_POOL)
+        {
+            state->pool_exhausted = 1;
+            return;
+        }
+
+        uint8_t *page = &state->memory[state->pages_used << MEMORY_PAGE_SHIFT];
+        uint16_t start = address & ~(MEMORY_PAGE_SIZE - 1);
+        for (uint16_t i = 0; i < MEMORY_PAGE_SIZE; i++)
+            page[i] = memory_read_unwritten(state, start + i);
+        *page_entry = state->pages_used++;
+    }
+
+    state->memory[(*page_entry << MEMORY_PAGE_SHIFT) | (address & (MEMORY_PAGE_SIZE - 1))] = value;
+}
+
+#endif
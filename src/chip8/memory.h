@@ -0,0 +1,143 @@
+/**
+ * @file memory.h
+ * @brief How the core reads and writes the memory of a CHIP-8 device
+ *
+ * By default, memory is a flat buffer of RAM_SIZE bytes, and the accessors below are plain array accesses.
+ *
+ * Defining CHIP8_PAGED_MEMORY instead splits memory into MEMORY_PAGE_COUNT pages, and gives the device
+ * only a pool of CHIP8_PAGE_POOL pages of RAM. Pages that have never been written aren't held anywhere:
+ * they're read straight from the program image (which may be in flash) or the digit sprites, or as zeros.
+ * The first write to a page copies it into the next page of the pool, and the page table is pointed at it.
+ * Most programs only ever write to a page or two (e.g. with BCD and REG_DUMP), so this frees most of the
+ * RAM a flat memory would take on the Arduino.
+ *
+ * Should a program write to more pages than the pool holds, writes to those pages are dropped and
+ * pool_exhausted is set.
+ *
+ * With CHIP8_XO_CHIP, flat memory is 64KB, and addresses wrap around at its end as they do when paged.
+ *
+ * The core's interpreters, the ahead-of-time runtime, snapshots and traces work with either. The JIT,
+ * the batch engine and the code emitted by the AOT translator access memory directly, and need it flat.
+ */
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "chip8.h"
+
+#ifdef CHIP8_PAGED_MEMORY
+
+/**
+ * @def MEMORY_UNWRITTEN
+ * @brief The page table entry of pages that haven't been written, and so aren't in the pool
+ */
+#define MEMORY_UNWRITTEN 0xFF
+
+/**
+ * @def CHIP8_PROGRAM_READ
+ * @brief Reads a byte of the program image. From flash on AVR, where the image is expected to be in PROGMEM
+ */
+#ifndef CHIP8_PROGRAM_READ
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define CHIP8_PROGRAM_READ(address) pgm_read_byte(address)
+#else
+#define CHIP8_PROGRAM_READ(address) (*(address))
+#endif
+#endif
+
+/**
+ * @brief Reads a byte of a page that hasn't been written
+ */
+uint8_t memory_read_unwritten(state *state, uint16_t address);
+
+/**
+ * @brief Writes a byte of memory, copying its page into the pool if it's the first write to it
+ */
+void memory_write(state *state, uint16_t address, uint8_t value);
+
+/**
+ * @brief Forgets every page written, so that memory reads as the digit sprites and the program again
+ */
+static inline void memory_reset(state *state)
+{
+    memset(state->page_table, MEMORY_UNWRITTEN, MEMORY_PAGE_COUNT);
+    state->pages_used = 0;
+    state->pool_exhausted = 0;
+}
+
+/**
+ * @brief Reads a byte of memory. Addresses past RAM_SIZE wrap around
+ */
+static inline uint8_t memory_read(state *state, uint16_t address)
+{
+    address &= RAM_SIZE - 1;
+    uint8_t page = state->page_table[address >> MEMORY_PAGE_SHIFT];
+    if (page != MEMORY_UNWRITTEN)
+        return state->memory[(page << MEMORY_PAGE_SHIFT) | (address & (MEMORY_PAGE_SIZE - 1))];
+    return memory_read_unwritten(state, address);
+}
+
+/**
+ * @def MEMORY_READ
+ * @brief Reads the byte of the given state's memory at the given address
+ */
+#define MEMORY_READ(state, address) memory_read(state, address)
+
+/**
+ * @def MEMORY_WRITE
+ * @brief Writes the given byte to the given state's memory at the given address
+ */
+#define MEMORY_WRITE(state, address, value) memory_write(state, address, value)
+
+#elif defined(CHIP8_XO_CHIP)
+
+// Addresses are 16 bits, so those past the end of the 64KB of memory wrap around to its start
+#define MEMORY_READ(state, address) ((state)->memory[(uint16_t)(address)])
+#define MEMORY_WRITE(state, address, value) ((state)->memory[(uint16_t)(address)] = (value))
+
+#else
+
+#define MEMORY_READ(state, address) ((state)->memory[address])
+#define MEMORY_WRITE(state, address, value) ((state)->memory[address] = (value))
+
+#endif
+
+/**
+ * @brief Copies the given number of bytes of memory, from the given address, out to a buffer
+ */
+static inline void memory_load(state *state, uint8_t *destination, uint16_t address, uint32_t length)
+{
+#if defined(CHIP8_PAGED_MEMORY) || defined(CHIP8_XO_CHIP)
+    for (uint32_t i = 0; i < length; i++)
+        destination[i] = MEMORY_READ(state, address + i);
+#else
+    memcpy(destination, &state->memory[address], length);
+#endif
+}
+
+/**
+ * @brief Copies the given number of bytes from a buffer into memory, at the given address
+ */
+static inline void memory_store(state *state, uint16_t address, const uint8_t *source, uint32_t length)
+{
+#if defined(CHIP8_PAGED_MEMORY) || defined(CHIP8_XO_CHIP)
+    for (uint32_t i = 0; i < length; i++)
+        MEMORY_WRITE(state, address + i, source[i]);
+#else
+    memcpy(&state->memory[address], source, length);
+#endif
+}
+
+/**
+ * @brief Skips the PC over the next instruction. With CHIP8_XO_CHIP, that's all four bytes of an F000 NNNN
+ */
+static inline void skip_instruction(state *state)
+{
+#ifdef CHIP8_XO_CHIP
+    if (MEMORY_READ(state, state->PC) == 0xF0 && MEMORY_READ(state, state->PC + 1) == 0x00)
+        state->PC += 2;
+#endif
+    state->PC += 2;
+}
+
+#endif
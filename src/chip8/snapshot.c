@@ -0,0 +1,142 @@
+/**
+ * @file snapshot.c
+ * @brief This module implements saving and restoring the state of a CHIP-8 device
+ */
+#include "snapshot.h"
+#include "memory.h"
+
+static uint8_t *put8(uint8_t *p, uint8_t value)
+{
+    *p = value;
+    return p + 1;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+    return p + 2;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t value)
+{
+    p = put16(p, value & 0xFFFF);
+    return put16(p, value >> 16);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+size_t chip8_snapshot_into(chip8 *cpu, uint8_t *buffer, size_t size)
+{
+    state *state = &cpu->state;
+    uint8_t *p = buffer;
+
+    if (size < SNAPSHOT_SIZE)
+        return 0;
+
+    memcpy(p, SNAPSHOT_MAGIC, 4);
+    p = put16(p + 4, SNAPSHOT_VERSION);
+    p = put32(p, RAM_SIZE);
+    p = put8(p, SCREEN_PLANES);
+
+    p = put16(p, state->PC);
+    p = put16(p, state->I);
+    p = put8(p, state->SP);
+    p = put8(p, state->delay_timer);
+    p = put8(p, state->audio_timer);
+    p = put8(p, state->buzzer_on);
+    p = put16(p, state->frame_cycles);
+    p = put16(p, cpu->cycles_per_frame);
+    p = put8(p, state->hires);
+    p = put8(p, state->planes);
+    for (int i = 0; i < STACK_COUNT; i++)
+        p = put16(p, state->stack[i]);
+    memcpy(p, state->V, REGISTER_COUNT);
+    p += REGISTER_COUNT;
+
+    memcpy(p, state->screen, SCREEN_BYTES);
+    p += SCREEN_BYTES;
+    memory_load(state, p, 0, RAM_SIZE);
+
+    return SNAPSHOT_SIZE;
+}
+
+uint8_t *chip8_snapshot(chip8 *cpu)
+{
+    uint8_t *buffer = malloc(SNAPSHOT_SIZE);
+    if (buffer != NULL)
+        chip8_snapshot_into(cpu, buffer, SNAPSHOT_SIZE);
+    return buffer;
+}
+
+int chip8_restore(chip8 *cpu, const uint8_t *buffer, size_t size)
+{
+    state *state = &cpu->state;
+    const uint8_t *p = buffer + SNAPSHOT_HEADER_SIZE;
+
+    if (size < SNAPSHOT_SIZE || memcmp(buffer, SNAPSHOT_MAGIC, 4) != 0 || get16(buffer + 4) != SNAPSHOT_VERSION)
+        return -1;
+    // Builds with another size of memory or number of planes lay snapshots out differently
+    if (get32(buffer + 6) != RAM_SIZE || buffer[10] != SCREEN_PLANES)
+        return -1;
+    // The SP indexes the stack directly
+    if (p[4] >= STACK_COUNT)
+        return -1;
+
+    state->PC = get16(p);
+    state->I = get16(p + 2);
+    state->SP = p[4];
+    state->delay_timer = p[5];
+    state->audio_timer = p[6];
+    uint8_t buzzer_on = p[7];
+    state->frame_cycles = get16(p + 8);
+    uint16_t cycles_per_frame = get16(p + 10);
+    if (cycles_per_frame > 0)
+        cpu->cycles_per_frame = cycles_per_frame;
+    uint8_t hires = p[12] != 0;
+    state->planes = p[13] & ((1 << SCREEN_PLANES) - 1);
+    p += 14;
+    for (int i = 0; i < STACK_COUNT; i++, p += 2)
+        state->stack[i] = get16(p);
+    memcpy(state->V, p, REGISTER_COUNT);
+    p += REGISTER_COUNT;
+
+    memcpy(state->screen, p, SCREEN_BYTES);
+    p += SCREEN_BYTES;
+#ifdef CHIP8_PAGED_MEMORY
+    // Only the pages that differ from the program are taken from the pool
+    memory_reset(state);
+#endif
+    memory_store(state, 0, p, RAM_SIZE);
+#ifdef CHIP8_PAGED_MEMORY
+    // The pages that didn't fit in the pool were dropped, so memory isn't what was snapshot
+    if (state->pool_exhausted)
+        return -1;
+#endif
+
+    if (hires != state->hires)
+    {
+        state->hires = hires;
+        if (cpu->peripherals->resolution != NULL)
+            cpu->peripherals->resolution(cpu->peripherals->user, hires);
+    }
+    // Whatever was decoded or displayed before doesn't match the restored memory and screen
+    invalidate_decode_cache(state, 0, DECODE_CACHE_SIZE);
+    mark_dirty(state, 0, SCREEN_H);
+
+    if (buzzer_on != state->buzzer_on)
+    {
+        state->buzzer_on = buzzer_on;
+        if (cpu->peripherals->buzzer != NULL)
+            cpu->peripherals->buzzer(cpu->peripherals->user, buzzer_on);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file snapshot.h
+ * @brief Saving and restoring the state of a CHIP-8 device
+ *
+ * A snapshot is a fixed-size binary image of everything a running device depends on: its registers,
+ * timers, stack, every plane of the screen and RAM_SIZE bytes of memory. Fields are written one at a time, with multi-byte
+ * values little-endian, so that snapshots don't depend on the layout of `state` or on the host they were
+ * taken on. Every snapshot starts with the SNAPSHOT_MAGIC bytes, the SNAPSHOT_VERSION it was written with,
+ * and the RAM_SIZE and SCREEN_PLANES of the build that took it, since those change its layout (e.g. with
+ * CHIP8_XO_CHIP). Snapshots are only restored by builds with the same layout.
+ *
+ * Snapshots may be taken into a buffer supplied by the caller, with no allocation, or into a newly
+ * allocated one.
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "chip8.h"
+
+/**
+ * @def SNAPSHOT_MAGIC
+ * @brief The bytes every snapshot starts with
+ */
+#define SNAPSHOT_MAGIC "C8SS"
+
+/**
+ * @def SNAPSHOT_VERSION
+ * @brief The version of the snapshot format. Snapshots of any other version are refused
+ */
+#define SNAPSHOT_VERSION 4
+
+/**
+ * @def SNAPSHOT_HEADER_SIZE
+ * @brief The size, in bytes, of the magic bytes, the version, the size of memory (32 bits) and the number
+ *  of screen planes
+ */
+#define SNAPSHOT_HEADER_SIZE 11
+
+/**
+ * @def SNAPSHOT_REGISTERS_SIZE
+ * @brief The size, in bytes, of PC, I, SP, the timers, the buzzer, frame_cycles, cycles_per_frame,
+ *  the screen's resolution and selected planes, the stack and the V registers
+ */
+#define SNAPSHOT_REGISTERS_SIZE (14 + (STACK_COUNT * 2) + REGISTER_COUNT)
+
+/**
+ * @def SNAPSHOT_SIZE
+ * @brief The size, in bytes, of every snapshot
+ */
+#define SNAPSHOT_SIZE (SNAPSHOT_HEADER_SIZE + SNAPSHOT_REGISTERS_SIZE + SCREEN_BYTES + RAM_SIZE)
+
+/**
+ * @brief Writes a snapshot of the given instance into the given buffer
+ *
+ * @param cpu - The instance to be saved
+ * @param buffer - The buffer to be written to
+ * @param size - The size of the buffer in bytes
+ * @returns The number of bytes written, SNAPSHOT_SIZE. 0 if the buffer is too small
+ */
+size_t chip8_snapshot_into(chip8 *cpu, uint8_t *buffer, size_t size);
+
+/**
+ * @brief Writes a snapshot of the given instance into a newly allocated buffer, to be freed by the caller
+ *
+ * @param cpu - The instance to be saved
+ * @returns The snapshot, SNAPSHOT_SIZE bytes long. NULL if it couldn't be allocated
+ */
+uint8_t *chip8_snapshot(chip8 *cpu);
+
+/**
+ * @brief Restores the given instance to the state held by a snapshot. The instance keeps its own memory
+ * buffer and peripherals, and its whole screen is displayed again when next presented. Any decode cache
+ * is invalidated, and the buzzer peripheral is told if the snapshot's buzzer differs
+ *
+ * @param cpu - The instance to be restored
+ * @param buffer - The snapshot
+ * @param size - The size of the snapshot in bytes
+ * @returns 0 on success. -1 if the snapshot is too small, isn't a snapshot, is of another version, was
+ *  taken by a build with another size of memory or number of screen planes, or holds an invalid stack
+ *  pointer, in which case the instance is left untouched. With CHIP8_PAGED_MEMORY, also -1 if the snapshot's
+ *  memory was written to more pages than fit in the pool, in which case the instance is only partly
+ *  restored, and should be reset or restored from another snapshot
+ */
+int chip8_restore(chip8 *cpu, const uint8_t *buffer, size_t size);
+
+#endif
@@ -0,0 +1,299 @@
+/**
+ * @file threaded.c
+ * @brief This module implements the direct-threaded interpreter engine
+ */
+#include "threaded.h"
+#include "instrument.h"
+#include "trace.h"
+#include "memory.h"
+
+/**
+ * The handler used by each operation type.
+ * Handlers of operations that call peripherals or write to memory delegate to execute.
+ */
+#define THREADED_OPS(X)                 \
+    X(CLEAR_DISPLAY, op_execute)        \
+    X(RET, op_ret)                      \
+    X(JUMP, op_jump)                    \
+    X(CALL, op_call)                    \
+    X(SET_REG, op_set_reg)              \
+    X(ADD_REG, op_add_reg)              \
+    X(SET_I_REG, op_set_i_reg)          \
+    X(IF_EQ, op_if_eq)                  \
+    X(IF_NEQ, op_if_neq)                \
+    X(IF_EQ_REG, op_if_eq_reg)          \
+    X(SET_REG_BY_REG, op_set_reg_by_reg) \
+    X(OR, op_or)                        \
+    X(AND, op_and)                      \
+    X(XOR, op_xor)                      \
+    X(ADD_BY_REG, op_add_by_reg)        \
+    X(SUB, op_sub)                      \
+    X(SHIFT_RIGHT, op_shift_right)      \
+    X(SUBN, op_subn)                    \
+    X(SHIFT_LEFT, op_shift_left)        \
+    X(SKIP_NEQ, op_skip_neq)            \
+    X(BNNN, op_bnnn)                    \
+    X(RANDOM, op_execute)               \
+    X(DRAW_SPRITE, op_execute)          \
+    X(SKIP_IF_KEY, op_execute)          \
+    X(SKIP_IF_NKEY, op_execute)         \
+    X(GET_DELAY, op_get_delay)          \
+    X(GET_KEY, op_execute)              \
+    X(SET_DELAY, op_set_delay)          \
+    X(SET_AUDIO, op_set_audio)          \
+    X(ADVANCE_I, op_advance_i)          \
+    X(SET_I_HEX_SPRITE, op_set_i_hex_sprite) \
+    X(BCD, op_execute)                  \
+    X(REG_DUMP, op_execute)             \
+    X(REG_LOAD, op_reg_load)            \
+    X(SCROLL_DOWN, op_execute)          \
+    X(SCROLL_RIGHT, op_execute)         \
+    X(SCROLL_LEFT, op_execute)          \
+    X(LORES, op_execute)                \
+    X(HIRES, op_execute)                \
+    X(SELECT_PLANES, op_execute)        \
+    X(LONG_I, op_execute)               \
+    X(NOOP, op_noop)                    \
+    X(UNDECODED, op_noop)
+
+#define V_X (state->V[decoded_op->x])
+#define V_Y (state->V[decoded_op->y])
+
+static inline void op_execute(state *state, op *decoded_op, peripherals *peripherals)
+{
+    execute(decoded_op, state, peripherals);
+}
+
+static inline void op_ret(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->SP -= (state->SP > 0) ? 1 : 0; // Min SP is 0
+    state->PC = state->stack[state->SP];
+}
+
+static inline void op_jump(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->PC = decoded_op->nnn;
+}
+
+static inline void op_call(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->stack[state->SP] = state->PC;
+    state->SP += (state->SP < 15) ? 1 : 0; // Max SP is 15
+    state->PC = decoded_op->nnn;
+}
+
+static inline void op_set_reg(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X = decoded_op->nn;
+}
+
+static inline void op_add_reg(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X += decoded_op->nn;
+}
+
+static inline void op_set_i_reg(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->I = decoded_op->nnn;
+}
+
+static inline void op_if_eq(state *state, op *decoded_op, peripherals *peripherals)
+{
+    if (V_X == decoded_op->nn)
+        skip_instruction(state);
+}
+
+static inline void op_if_neq(state *state, op *decoded_op, peripherals *peripherals)
+{
+    if (V_X != decoded_op->nn)
+        skip_instruction(state);
+}
+
+static inline void op_if_eq_reg(state *state, op *decoded_op, peripherals *peripherals)
+{
+    if (V_X == V_Y)
+        skip_instruction(state);
+}
+
+static inline void op_set_reg_by_reg(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X = V_Y;
+}
+
+static inline void op_or(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X |= V_Y;
+}
+
+static inline void op_and(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X &= V_Y;
+}
+
+static inline void op_xor(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X ^= V_Y;
+}
+
+static inline void op_add_by_reg(state *state, op *decoded_op, peripherals *peripherals)
+{
+    uint8_t temp = ((uint8_t)(V_X + V_Y) < V_X); // Carry
+    V_X += V_Y;
+    state->V[0xF] = temp;
+}
+
+static inline void op_sub(state *state, op *decoded_op, peripherals *peripherals)
+{
+    uint8_t temp = (V_X > V_Y); // NOT borrow
+    V_X -= V_Y;
+    state->V[0xF] = temp;
+}
+
+static inline void op_shift_right(state *state, op *decoded_op, peripherals *peripherals)
+{
+    uint8_t temp = V_X & 0x01; // LSB was set
+    V_X >>= 1;
+    state->V[0xF] = temp;
+}
+
+static inline void op_subn(state *state, op *decoded_op, peripherals *peripherals)
+{
+    uint8_t temp = (V_Y > V_X);
+    V_X = V_Y - V_X;
+    state->V[0xF] = temp;
+}
+
+static inline void op_shift_left(state *state, op *decoded_op, peripherals *peripherals)
+{
+    uint8_t temp = (V_X & 0b10000000) >> 7; // MSB was set
+    V_X <<= 1;
+    state->V[0xF] = temp;
+}
+
+static inline void op_skip_neq(state *state, op *decoded_op, peripherals *peripherals)
+{
+    if (V_X != V_Y)
+        skip_instruction(state);
+}
+
+static inline void op_bnnn(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->PC = decoded_op->nnn + state->V[0];
+}
+
+static inline void op_get_delay(state *state, op *decoded_op, peripherals *peripherals)
+{
+    V_X = state->delay_timer;
+}
+
+static inline void op_set_delay(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->delay_timer = V_X;
+}
+
+static inline void op_set_audio(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->audio_timer = V_X;
+}
+
+static inline void op_advance_i(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->I += V_X;
+}
+
+static inline void op_set_i_hex_sprite(state *state, op *decoded_op, peripherals *peripherals)
+{
+    state->I = DIGIT_SPRITES_OFFSET + (V_X * 5);
+}
+
+static inline void op_reg_load(state *state, op *decoded_op, peripherals *peripherals)
+{
+    memory_load(state, state->V, state->I, decoded_op->x + 1);
+}
+
+static inline void op_noop(state *state, op *decoded_op, peripherals *peripherals)
+{
+    // The instruction is either not yet implemented or it is invalid
+}
+
+/**
+ * Fetches and decodes the next instruction, through the decode cache when one is attached
+ */
+static inline op *next_op(state *state, op *scratch)
+{
+    uint8_t instruction[2];
+    op *decoded_op = scratch;
+
+    if (state->decode_cache != NULL)
+    {
+        decoded_op = fetch_decoded(state);
+    }
+    else
+    {
+        fetch(state, instruction);
+        decode(instruction, scratch);
+    }
+    INSTRUMENT_OP(state, state->PC - 2, decoded_op->type);
+    TRACE_BEFORE(state, decoded_op);
+    return decoded_op;
+}
+
+#ifdef THREADED_COMPUTED_GOTO
+
+void threaded_run(chip8 *cpu, uint32_t cycles)
+{
+#define LABEL_ENTRY(type, handler) [type] = &&handle_##type,
+    static void *const labels[] = {THREADED_OPS(LABEL_ENTRY)};
+#undef LABEL_ENTRY
+
+    state *state = &cpu->state;
+    peripherals *peripherals = cpu->peripherals;
+    op scratch;
+    op *decoded_op;
+
+#define DISPATCH()                              \
+    do                                          \
+    {                                           \
+        if (cycles-- == 0)                      \
+            return;                             \
+        decoded_op = next_op(state, &scratch);  \
+        goto *labels[decoded_op->type];         \
+    } while (0)
+
+#define LABEL_BODY(type, handler)                \
+    handle_##type:                               \
+    handler(state, decoded_op, peripherals);     \
+    TRACE_AFTER(state, decoded_op);              \
+    DISPATCH();
+
+    DISPATCH();
+    THREADED_OPS(LABEL_BODY)
+
+#undef LABEL_BODY
+#undef DISPATCH
+}
+
+#else
+
+typedef void (*handler)(state *, op *, peripherals *);
+
+#define TABLE_ENTRY(type, handler) [type] = &handler,
+static const handler handlers[] = {THREADED_OPS(TABLE_ENTRY)};
+#undef TABLE_ENTRY
+
+void threaded_run(chip8 *cpu, uint32_t cycles)
+{
+    state *state = &cpu->state;
+    peripherals *peripherals = cpu->peripherals;
+    op scratch;
+    op *decoded_op;
+
+    while (cycles-- > 0)
+    {
+        decoded_op = next_op(state, &scratch);
+        handlers[decoded_op->type](state, decoded_op, peripherals);
+        TRACE_AFTER(state, decoded_op);
+    }
+}
+
+#endif
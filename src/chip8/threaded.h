@@ -0,0 +1,42 @@
+/**
+ * @file threaded.h
+ * @brief A direct-threaded interpreter engine for the CHIP-8 device
+ *
+ * This engine is an alternative to the `execute` switch. Each operation type has its own handler,
+ * and every handler dispatches straight to the handler of the following instruction, rather than
+ * returning to a central loop. This trades one shared, hard to predict branch for one branch per
+ * handler, which branch predictors cope with far better.
+ *
+ * Where the compiler supports it (GCC/Clang "labels as values"), handlers are labels dispatched to
+ * with computed gotos. Otherwise a portable table of handler functions is used.
+ *
+ * Operations that call peripherals or write to memory are delegated to `execute`, so that
+ * both engines share a single implementation of them.
+ *
+ * The engine is compiled alongside the switch engine. Define CHIP8_THREADED to have chip8_run_cycles
+ * use it. @see chip8_run_cycles
+ */
+#ifndef THREADED_H
+#define THREADED_H
+
+#include "chip8.h"
+
+/**
+ * @def THREADED_COMPUTED_GOTO
+ * @brief Defined when the engine dispatches with computed gotos rather than a table of handler functions.
+ *  Define CHIP8_NO_COMPUTED_GOTO to force the portable implementation
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CHIP8_NO_COMPUTED_GOTO)
+#define THREADED_COMPUTED_GOTO
+#endif
+
+/**
+ * @brief Performs the given number of cycles against the given CHIP-8 instance using the threaded engine.
+ * The timers are not ticked, @see chip8_run_cycles
+ *
+ * @param cpu - The given CHIP-8 instance to run cycles on
+ * @param cycles - The number of instructions to execute
+ */
+void threaded_run(chip8 *cpu, uint32_t cycles);
+
+#endif
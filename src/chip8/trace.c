@@ -0,0 +1,49 @@
+/**
+ * @file trace.c
+ * @brief This module implements flushing the trace buffer of CHIP8_TRACE_LEVEL builds
+ */
+#include "trace.h"
+
+#if CHIP8_TRACE_LEVEL > 0
+
+void chip8_trace_attach(state *state, trace_buffer *trace, trace_sink sink, void *user)
+{
+    state->trace = trace;
+    if (trace == NULL)
+        return;
+
+    trace->sink = sink;
+    trace->user = user;
+    trace->head = 0;
+    trace->count = 0;
+    trace->overflowed = 0;
+    trace->fault = TRACE_REQUESTED;
+}
+
+void chip8_trace_flush(trace_buffer *trace, uint8_t reason)
+{
+    if (trace->sink == NULL)
+        return;
+
+    uint8_t header[TRACE_HEADER_SIZE] = {
+        TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3],
+        CHIP8_TRACE_LEVEL, TRACE_ENTRY_SIZE, reason, trace->overflowed,
+        trace->count & 0xFF, trace->count >> 8,
+    };
+    trace->sink(trace->user, header, sizeof(header));
+
+    // The oldest entry is count entries behind the head, which may mean wrapping around the end of the buffer
+    uint16_t tail = (trace->head + CHIP8_TRACE_ENTRIES - trace->count) % CHIP8_TRACE_ENTRIES;
+    uint16_t first = CHIP8_TRACE_ENTRIES - tail;
+    if (first > trace->count)
+        first = trace->count;
+    if (first > 0)
+        trace->sink(trace->user, &trace->entries[tail * TRACE_ENTRY_SIZE], first * TRACE_ENTRY_SIZE);
+    if (trace->count > first)
+        trace->sink(trace->user, trace->entries, (trace->count - first) * TRACE_ENTRY_SIZE);
+
+    trace->count = 0;
+    trace->overflowed = 0;
+}
+
+#endif
@@ -0,0 +1,227 @@
+/**
+ * @file trace.h
+ * @brief A ring buffer of the last instructions a CHIP-8 device ran, compiled in with CHIP8_TRACE_LEVEL
+ *
+ * CHIP8_TRACE_LEVEL selects what's traced:
+ * - 0 (the default): nothing. The hooks in the core expand to nothing
+ * - 1: the address and opcode of every instruction run
+ * - 2: as well, the values of V[X], V[0xF] and I once the instruction has run
+ *
+ * Each instruction is written as a fixed-size entry into a ring buffer in memory, overwriting the oldest,
+ * so that tracing costs a few stores per instruction and may be left on, even on the Arduino. Entries are
+ * held as the bytes they're flushed as, so a flush is a copy of the buffer.
+ *
+ * Each device traces into the buffer attached to it with chip8_trace_attach, and isn't traced while none is.
+ * The buffer is flushed, oldest entry first, to the sink attached with it, as a header followed by the entries:
+ * - TRACE_MAGIC, the trace level, the size of an entry, the reason for the flush, whether entries were
+ *   overwritten before they could be flushed, and the number of entries as 16 bits, little-endian
+ * - Each entry: the address (16 bits, little-endian) and the opcode's two bytes as they are in memory.
+ *   At level 2, followed by V[X], V[0xF] and I (16 bits, little-endian)
+ *
+ * Flushes are made on demand, and as soon as the device faults: overflowing or underflowing its stack,
+ * or running an instruction that isn't one. The device runs on as usual after a fault.
+ *
+ * @see tracedump.c for the host decoder of flushes
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "chip8.h"
+#include "memory.h"
+
+#ifndef CHIP8_TRACE_LEVEL
+#define CHIP8_TRACE_LEVEL 0
+#endif
+
+/**
+ * @def TRACE_MAGIC
+ * @brief The bytes every flushed block starts with
+ */
+#define TRACE_MAGIC "C8TR"
+
+/**
+ * @def TRACE_HEADER_SIZE
+ * @brief The size, in bytes, of the header of every flushed block
+ */
+#define TRACE_HEADER_SIZE 10
+
+/**
+ * @enum trace_reason
+ * @brief Why the trace buffer was flushed
+ */
+enum trace_reason
+{
+    /**
+     * @brief chip8_trace_flush was called
+     */
+    TRACE_REQUESTED,
+    /**
+     * @brief A CALL was run with the stack already full
+     */
+    TRACE_STACK_OVERFLOW,
+    /**
+     * @brief A RET was run with the stack empty
+     */
+    TRACE_STACK_UNDERFLOW,
+    /**
+     * @brief An instruction was run that doesn't decode to any operation
+     */
+    TRACE_INVALID_OP,
+};
+
+#if CHIP8_TRACE_LEVEL > 0
+
+/**
+ * @def CHIP8_TRACE_ENTRIES
+ * @brief The number of instructions held by the ring buffer. May be defined at build time
+ */
+#ifndef CHIP8_TRACE_ENTRIES
+#define CHIP8_TRACE_ENTRIES 64
+#endif
+
+/**
+ * @def TRACE_ENTRY_SIZE
+ * @brief The size, in bytes, of each entry at the trace level built with
+ */
+#if CHIP8_TRACE_LEVEL >= 2
+#define TRACE_ENTRY_SIZE 8
+#else
+#define TRACE_ENTRY_SIZE 4
+#endif
+
+/**
+ * @brief Called with each block of bytes that's flushed. A flush is made up of one or more blocks
+ */
+typedef void (*trace_sink)(void *user, const uint8_t *block, uint16_t size);
+
+/**
+ * @struct trace_buffer
+ * @brief The ring buffer of traced instructions
+ */
+typedef struct trace_buffer
+{
+    /**
+     * @brief The entries, each TRACE_ENTRY_SIZE bytes
+     */
+    uint8_t entries[CHIP8_TRACE_ENTRIES * TRACE_ENTRY_SIZE];
+    /**
+     * @brief The index of the entry to be written next
+     */
+    uint16_t head;
+    /**
+     * @brief The number of entries held since the last flush
+     */
+    uint16_t count;
+    /**
+     * @brief Set if entries were overwritten since the last flush
+     */
+    uint8_t overflowed;
+    /**
+     * @brief The trace_reason of a fault made by the instruction being run, to be flushed once it has run.
+     *  TRACE_REQUESTED if there's none
+     */
+    uint8_t fault;
+    /**
+     * @brief Where the buffer is flushed to. NULL if it isn't attached
+     */
+    trace_sink sink;
+    /**
+     * @brief Passed, untouched, to the sink
+     */
+    void *user;
+} trace_buffer;
+
+/**
+ * @brief Attaches the given buffer to the state, to trace the instructions it runs into, and sets where the
+ * buffer is flushed to. Any entries the buffer held are forgotten
+ *
+ * @param state - The state of the device to be traced
+ * @param trace - The buffer. NULL stops tracing the device
+ * @param sink - Called with each block that's flushed. NULL to never flush
+ * @param user - Passed, untouched, to the sink
+ */
+void chip8_trace_attach(state *state, trace_buffer *trace, trace_sink sink, void *user);
+
+/**
+ * @brief Flushes the entries held to the sink, oldest first, and forgets them. Nothing is done if there's no sink
+ *
+ * @param trace - The buffer to be flushed
+ * @param reason - The trace_reason written in the header
+ */
+void chip8_trace_flush(trace_buffer *trace, uint8_t reason);
+
+/**
+ * @brief Called by the core before an instruction is run, once it's been fetched
+ */
+static inline void trace_before(state *state, op *decoded_op)
+{
+    trace_buffer *trace = state->trace;
+    if (trace == NULL)
+        return;
+
+    uint8_t *entry = &trace->entries[trace->head * TRACE_ENTRY_SIZE];
+    uint16_t address = state->PC - 2;
+
+    entry[0] = address & 0xFF;
+    entry[1] = address >> 8;
+    entry[2] = MEMORY_READ(state, address);
+    entry[3] = MEMORY_READ(state, address + 1);
+
+    if (++trace->head == CHIP8_TRACE_ENTRIES)
+        trace->head = 0;
+    if (trace->count < CHIP8_TRACE_ENTRIES)
+        trace->count++;
+    else
+        trace->overflowed = 1;
+
+    if (decoded_op->type == CALL && state->SP >= STACK_COUNT - 1)
+        trace->fault = TRACE_STACK_OVERFLOW;
+    else if (decoded_op->type == RET && state->SP == 0)
+        trace->fault = TRACE_STACK_UNDERFLOW;
+    else if (decoded_op->type == NOOP && (entry[2] >> 4) != 0)
+        trace->fault = TRACE_INVALID_OP; // Only 0NNN machine code routines are ignored on purpose
+}
+
+/**
+ * @brief Called by the core once an instruction has run
+ */
+static inline void trace_after(state *state, op *decoded_op)
+{
+    trace_buffer *trace = state->trace;
+    if (trace == NULL)
+        return;
+
+#if CHIP8_TRACE_LEVEL >= 2
+    uint8_t *entry = &trace->entries[((trace->head > 0) ? trace->head - 1 : CHIP8_TRACE_ENTRIES - 1) * TRACE_ENTRY_SIZE];
+    entry[4] = state->V[decoded_op->x];
+    entry[5] = state->V[0xF];
+    entry[6] = state->I & 0xFF;
+    entry[7] = state->I >> 8;
+#endif
+    if (trace->fault != TRACE_REQUESTED)
+    {
+        chip8_trace_flush(trace, trace->fault);
+        trace->fault = TRACE_REQUESTED;
+    }
+}
+
+/**
+ * @def TRACE_BEFORE
+ * @brief Traces the instruction about to be run
+ */
+#define TRACE_BEFORE(state, decoded_op) trace_before(state, decoded_op)
+
+/**
+ * @def TRACE_AFTER
+ * @brief Completes the trace of the instruction that has just run
+ */
+#define TRACE_AFTER(state, decoded_op) trace_after(state, decoded_op)
+
+#else
+
+#define TRACE_BEFORE(state, decoded_op) ((void)0)
+#define TRACE_AFTER(state, decoded_op) ((void)0)
+
+#endif
+
+#endif
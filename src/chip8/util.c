@@ -13,7 +13,7 @@ void print_screen(uint8_t *screen)
         printf("%d", i % 10);
     printf("\n");
     uint8_t pixel_mask = 0b10000000;
-    for (int i = 0; i < SCREEN_BYTES; i++)
+    for (int i = 0; i < SCREEN_PLANE_BYTES; i++)
     {
         if (i % H_OFFSET == 0)
             printf("\n%d\t", i / H_OFFSET);
@@ -0,0 +1,637 @@
+/**
+ * @file batch.c
+ * @brief This module implements the lockstep batch engine
+ */
+#include "batch.h"
+#include "batch_avx2.h"
+#include "host_util.h"
+
+#define V_ROW(batch, reg) (&(batch)->V[(reg) * (batch)->stride])
+
+/**
+ * Each of the following runs an operation across count machines, given their register arrays.
+ * x may be the same array as y or as f, so every array is read before any is written.
+ * If the CPU has AVX2, the AVX2 kernels run whole blocks of 32 machines first, and the remainder is run here.
+ */
+
+static void lanes_add_imm(const batch *batch, uint8_t *x, uint8_t nn, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_add_imm(x, nn, count) : 0; i < count; i++)
+        x[i] += nn;
+}
+
+/**
+ * Runs OR (1), AND (2) or XOR (3)
+ */
+static void lanes_logic(const batch *batch, uint8_t *x, const uint8_t *y, uint8_t operation, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_logic(x, y, operation, count) : 0; i < count; i++)
+        x[i] = (operation == 1) ? (x[i] | y[i]) : (operation == 2) ? (x[i] & y[i]) : (x[i] ^ y[i]);
+}
+
+static void lanes_add(const batch *batch, uint8_t *x, const uint8_t *y, uint8_t *f, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_add(x, y, f, count) : 0; i < count; i++)
+    {
+        uint8_t carry = (uint8_t)(x[i] + y[i]) < x[i];
+        x[i] += y[i];
+        f[i] = carry;
+    }
+}
+
+/**
+ * Runs SUB (x = x - y) or, if reversed, SUBN (x = y - x)
+ */
+static void lanes_sub(const batch *batch, uint8_t *x, const uint8_t *y, uint8_t *f, uint8_t reversed, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_sub(x, y, f, reversed, count) : 0; i < count; i++)
+    {
+        uint8_t a = reversed ? y[i] : x[i];
+        uint8_t b = reversed ? x[i] : y[i];
+        x[i] = a - b;
+        f[i] = (a > b);
+    }
+}
+
+static void lanes_shift_right(const batch *batch, uint8_t *x, uint8_t *f, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_shift_right(x, f, count) : 0; i < count; i++)
+    {
+        uint8_t lsb = x[i] & 0x01;
+        x[i] >>= 1;
+        f[i] = lsb;
+    }
+}
+
+static void lanes_shift_left(const batch *batch, uint8_t *x, uint8_t *f, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_shift_left(x, f, count) : 0; i < count; i++)
+    {
+        uint8_t msb = (x[i] & 0b10000000) >> 7;
+        x[i] <<= 1;
+        f[i] = msb;
+    }
+}
+
+/**
+ * Writes 0xFF to the mask of every machine where x == y (or x != y, if inverted), and 0 elsewhere
+ */
+static void lanes_compare(const batch *batch, uint8_t *mask, const uint8_t *x, const uint8_t *y, uint8_t inverted, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_compare(mask, x, y, inverted, count) : 0; i < count; i++)
+        mask[i] = ((x[i] == y[i]) != inverted) ? 0xFF : 0;
+}
+
+static void lanes_compare_imm(const batch *batch, uint8_t *mask, const uint8_t *x, uint8_t nn, uint8_t inverted, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_compare_imm(mask, x, nn, inverted, count) : 0; i < count; i++)
+        mask[i] = ((x[i] == nn) != inverted) ? 0xFF : 0;
+}
+
+/**
+ * Skips the next instruction of every machine with a set mask
+ */
+static void lanes_skip(uint16_t *PC, const uint8_t *mask, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        PC[i] += mask[i] & 2;
+}
+
+static void lanes_fill(uint16_t *values, uint16_t value, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        values[i] = value;
+}
+
+static void lanes_tick(const batch *batch, uint8_t *timer, uint32_t count)
+{
+    for (uint32_t i = batch->avx2 ? avx2_tick(timer, count) : 0; i < count; i++)
+        timer[i] -= (timer[i] > 0) ? 1 : 0;
+}
+
+static uint8_t lane_random(void *user)
+{
+    return xorshift_next(&((batch_lane *)user)->rng_state);
+}
+
+static uint8_t lane_is_key_pressed(void *user, uint8_t key)
+{
+    return (((batch_lane *)user)->keys >> (key & 0xF)) & 1;
+}
+
+static uint8_t lane_get_key_pressed(void *user)
+{
+    uint16_t keys = ((batch_lane *)user)->keys;
+    for (uint8_t key = 0; key < 16; key++)
+        if ((keys >> key) & 1)
+            return key;
+    return 0;
+}
+
+static void *batch_alloc(size_t size)
+{
+    size = (size + BATCH_ALIGNMENT - 1) & ~(size_t)(BATCH_ALIGNMENT - 1);
+    return aligned_alloc(BATCH_ALIGNMENT, size);
+}
+
+int batch_init(batch *batch, uint32_t count, uint8_t *program, uint16_t cycles_per_frame)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->count = count;
+    batch->stride = (count + BATCH_ALIGNMENT - 1) & ~(uint32_t)(BATCH_ALIGNMENT - 1);
+    batch->cycles_per_frame = (cycles_per_frame > 0) ? cycles_per_frame : CYCLES_PER_FRAME;
+    batch->avx2 = batch_avx2_supported();
+
+    batch->V = batch_alloc((size_t)REGISTER_COUNT * batch->stride);
+    batch->PC = batch_alloc(batch->stride * sizeof(uint16_t));
+    batch->I = batch_alloc(batch->stride * sizeof(uint16_t));
+    batch->delay_timer = batch_alloc(batch->stride);
+    batch->audio_timer = batch_alloc(batch->stride);
+    batch->mask = batch_alloc(batch->stride);
+    batch->memory = batch_alloc((size_t)count * RAM_SIZE);
+    batch->lanes = batch_alloc(count * sizeof(batch_lane));
+    batch->slots = batch_alloc(batch->stride * sizeof(batch_lane *));
+    batch->order = batch_alloc(batch->stride * sizeof(uint32_t));
+    batch->scratch = batch_alloc(batch->stride * sizeof(batch_lane *));
+    batch->group_offsets = batch_alloc(batch->stride * sizeof(uint32_t));
+    batch->pc_groups = calloc(RAM_SIZE, sizeof(uint32_t));
+    if (!batch->V || !batch->PC || !batch->I || !batch->delay_timer || !batch->audio_timer || !batch->mask ||
+        !batch->memory || !batch->lanes || !batch->slots || !batch->order || !batch->scratch ||
+        !batch->group_offsets || !batch->pc_groups)
+    {
+        batch_free(batch);
+        return -1;
+    }
+
+    memset(batch->V, 0, (size_t)REGISTER_COUNT * batch->stride);
+    lanes_fill(batch->PC, PROGRAM_OFFSET, batch->stride);
+    lanes_fill(batch->I, 0, batch->stride);
+    memset(batch->delay_timer, 0, batch->stride);
+    memset(batch->audio_timer, 0, batch->stride);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        batch_lane *lane = &batch->lanes[i];
+        init_state(&lane->state, &batch->memory[(size_t)i * RAM_SIZE], program);
+        lane->peripherals = (peripherals){
+            .user = lane,
+            .present_mode = PRESENT_VBLANK,
+            .random = &lane_random,
+            .is_key_pressed = &lane_is_key_pressed,
+            .get_key_pressed = &lane_get_key_pressed,
+        };
+        lane->keys = 0;
+        lane->rng_state = i + 1;
+        lane->slot = i;
+        batch->slots[i] = lane;
+    }
+    return 0;
+}
+
+void batch_set_keys(batch *batch, uint32_t lane, uint16_t keys)
+{
+    batch->lanes[lane].keys = keys;
+}
+
+void batch_seed(batch *batch, uint32_t lane, uint32_t seed)
+{
+    batch->lanes[lane].rng_state = xorshift_seed(seed);
+}
+
+/**
+ * Copies the structure-of-arrays registers at the given slot into its machine's state, or back out of it
+ */
+static void gather(batch *batch, uint32_t i, state *state)
+{
+    for (int reg = 0; reg < REGISTER_COUNT; reg++)
+        state->V[reg] = V_ROW(batch, reg)[i];
+    state->PC = batch->PC[i];
+    state->I = batch->I[i];
+    state->delay_timer = batch->delay_timer[i];
+    state->audio_timer = batch->audio_timer[i];
+}
+
+static void scatter(batch *batch, uint32_t i, state *state)
+{
+    for (int reg = 0; reg < REGISTER_COUNT; reg++)
+        V_ROW(batch, reg)[i] = state->V[reg];
+    batch->PC[i] = state->PC;
+    batch->I[i] = state->I;
+    batch->delay_timer[i] = state->delay_timer;
+    batch->audio_timer[i] = state->audio_timer;
+}
+
+static void mark_written(batch *batch, uint16_t address, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++)
+        batch->written[((address + i) % RAM_SIZE) / 64] = 1;
+}
+
+/**
+ * Steps the machine at the given slot the given number of times with the core's execute
+ */
+static void step_lane(batch *batch, uint32_t i, uint32_t steps)
+{
+    batch_lane *lane = batch->slots[i];
+    state *state = &lane->state;
+    uint8_t instruction[2];
+    op decoded_op;
+
+    gather(batch, i, state);
+    for (uint32_t step = 0; step < steps; step++)
+    {
+        fetch(state, instruction);
+        decode(instruction, &decoded_op);
+
+        if (decoded_op.type == GET_KEY && lane->keys == 0)
+        {
+            // Wait, by running this instruction again
+            state->PC -= 2;
+            continue;
+        }
+
+        execute(&decoded_op, state, &lane->peripherals);
+        if (decoded_op.type == BCD)
+            mark_written(batch, state->I, 3);
+        else if (decoded_op.type == REG_DUMP)
+            mark_written(batch, state->I, decoded_op.x + 1);
+    }
+    scatter(batch, i, state);
+    batch->scalar_steps += steps;
+}
+
+/**
+ * Determines whether every machine of the group of count slots from first is about to run the same
+ * instruction, and if so, decodes it
+ */
+static int is_uniform(batch *batch, uint32_t first, uint32_t count, op *decoded_op)
+{
+    uint16_t *PC = &batch->PC[first];
+    uint16_t pc = PC[0];
+    uint16_t differences = 0;
+    uint8_t *memory = batch->slots[first]->state.memory;
+
+    if (pc >= RAM_SIZE - 1)
+        return 0;
+    // Accumulated without branching, so that the comparison is vectorized
+    for (uint32_t i = 1; i < count; i++)
+        differences |= PC[i] ^ pc;
+    if (differences != 0)
+        return 0;
+
+    // Only memory that has been written to may hold a different instruction
+    if (batch->written[pc / 64] || batch->written[(pc + 1) / 64])
+    {
+        for (uint32_t i = 1; i < count; i++)
+        {
+            uint8_t *lane_memory = batch->slots[first + i]->state.memory;
+            if (lane_memory[pc] != memory[pc] || lane_memory[pc + 1] != memory[pc + 1])
+                return 0;
+        }
+    }
+
+    decode(&memory[pc], decoded_op);
+    return 1;
+}
+
+#define PERMUTE_ROW(batch, row, type, first, count)                         \
+    do                                                                      \
+    {                                                                       \
+        type *permuted = (type *)(batch)->scratch;                          \
+        for (uint32_t j = 0; j < (count); j++)                              \
+            permuted[j] = (row)[(batch)->order[j]];                         \
+        memcpy(&(row)[first], permuted, (count) * sizeof(type));            \
+    } while (0)
+
+/**
+ * Reorders the machines of the group of count slots from first by their PC, so that the machines about
+ * to run the same instruction are next to one another. Machines at the same PC keep their order, and the
+ * PCs are in the order they were first found in
+ */
+static void group_by_pc(batch *batch, uint32_t first, uint32_t count)
+{
+    uint16_t *PC = &batch->PC[first];
+    uint32_t *offsets = batch->group_offsets;
+    uint32_t groups = 0;
+
+    // Counted into a group per PC, found by its entry in pc_groups
+    for (uint32_t j = 0; j < count; j++)
+    {
+        uint32_t *group = &batch->pc_groups[PC[j]];
+        if (*group == 0)
+        {
+            *group = ++groups;
+            offsets[groups - 1] = 0;
+        }
+        offsets[*group - 1]++;
+    }
+    for (uint32_t k = 0, offset = 0; k < groups; k++)
+    {
+        uint32_t size = offsets[k];
+        offsets[k] = offset;
+        offset += size;
+    }
+
+    uint32_t moved = 0;
+    for (uint32_t j = 0; j < count; j++)
+    {
+        uint32_t position = offsets[batch->pc_groups[PC[j]] - 1]++;
+        batch->order[position] = first + j;
+        moved |= position ^ j;
+    }
+    for (uint32_t j = 0; j < count; j++)
+        batch->pc_groups[PC[j]] = 0;
+    if (moved == 0)
+        return;
+
+    for (int reg = 0; reg < REGISTER_COUNT; reg++)
+        PERMUTE_ROW(batch, V_ROW(batch, reg), uint8_t, first, count);
+    PERMUTE_ROW(batch, batch->PC, uint16_t, first, count);
+    PERMUTE_ROW(batch, batch->I, uint16_t, first, count);
+    PERMUTE_ROW(batch, batch->delay_timer, uint8_t, first, count);
+    PERMUTE_ROW(batch, batch->audio_timer, uint8_t, first, count);
+    PERMUTE_ROW(batch, batch->slots, batch_lane *, first, count);
+    for (uint32_t j = first; j < first + count; j++)
+        batch->slots[j]->slot = j;
+}
+
+/**
+ * Runs the given instruction, which reads no more than PC, I, V[X], V[Y] and V[0xF] and writes no more than
+ * PC and V[0xF] of the registers, on each machine of the group of count slots from first with the core's
+ * execute. Only those registers are copied to each machine's state and back, rather than all of them
+ */
+static void step_lanes_state(batch *batch, uint32_t first, uint32_t count, op *decoded_op)
+{
+    uint8_t *x = &V_ROW(batch, decoded_op->x)[first];
+    uint8_t *y = &V_ROW(batch, decoded_op->y)[first];
+    uint8_t *f = &V_ROW(batch, 0xF)[first];
+    uint16_t *PC = &batch->PC[first];
+    uint16_t *I = &batch->I[first];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        batch_lane *lane = batch->slots[first + i];
+        state *state = &lane->state;
+        state->PC = PC[i] + 2;
+        state->I = I[i];
+        state->V[0xF] = f[i];
+        state->V[decoded_op->x] = x[i];
+        state->V[decoded_op->y] = y[i];
+        execute(decoded_op, state, &lane->peripherals);
+        PC[i] = state->PC;
+        f[i] = state->V[0xF];
+    }
+}
+
+/**
+ * Runs the given instruction across every machine of the group of count slots from first at once.
+ * Returns 0, having run nothing, for operations that must be run one machine at a time
+ */
+static int step_lockstep(batch *batch, uint32_t first, uint32_t count, op *decoded_op)
+{
+    uint8_t *x = &V_ROW(batch, decoded_op->x)[first];
+    uint8_t *y = &V_ROW(batch, decoded_op->y)[first];
+    uint8_t *f = &V_ROW(batch, 0xF)[first];
+    uint8_t *v0 = &batch->V[first];
+    uint16_t *PC = &batch->PC[first];
+    uint16_t *I = &batch->I[first];
+    uint8_t *delay_timer = &batch->delay_timer[first];
+    uint8_t *audio_timer = &batch->audio_timer[first];
+    uint8_t *mask = &batch->mask[first];
+    uint16_t next_pc = PC[0] + 2;
+
+    switch (decoded_op->type)
+    {
+    case JUMP:
+        lanes_fill(PC, decoded_op->nnn, count);
+        break;
+    case BNNN:
+        for (uint32_t i = 0; i < count; i++)
+            PC[i] = decoded_op->nnn + v0[i];
+        break;
+    case IF_EQ:
+    case IF_NEQ:
+        lanes_compare_imm(batch, mask, x, decoded_op->nn, decoded_op->type == IF_NEQ, count);
+        lanes_fill(PC, next_pc, count);
+        lanes_skip(PC, mask, count);
+        break;
+    case IF_EQ_REG:
+    case SKIP_NEQ:
+        lanes_compare(batch, mask, x, y, decoded_op->type == SKIP_NEQ, count);
+        lanes_fill(PC, next_pc, count);
+        lanes_skip(PC, mask, count);
+        break;
+    case SKIP_IF_KEY:
+    case SKIP_IF_NKEY:
+        // The keys held are per machine, but are only read
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint8_t pressed = (batch->slots[first + i]->keys >> (x[i] & 0xF)) & 1;
+            mask[i] = (pressed != (decoded_op->type == SKIP_IF_NKEY)) ? 0xFF : 0;
+        }
+        lanes_fill(PC, next_pc, count);
+        lanes_skip(PC, mask, count);
+        break;
+    case RANDOM:
+        for (uint32_t i = 0; i < count; i++)
+            x[i] = lane_random(batch->slots[first + i]) & decoded_op->nn;
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SET_REG:
+        memset(x, decoded_op->nn, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case ADD_REG:
+        lanes_add_imm(batch, x, decoded_op->nn, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SET_I_REG:
+        lanes_fill(I, decoded_op->nnn, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SET_REG_BY_REG:
+        memmove(x, y, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case OR:
+        lanes_logic(batch, x, y, 1, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case AND:
+        lanes_logic(batch, x, y, 2, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case XOR:
+        lanes_logic(batch, x, y, 3, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case ADD_BY_REG:
+        lanes_add(batch, x, y, f, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SUB:
+    case SUBN:
+        lanes_sub(batch, x, y, f, decoded_op->type == SUBN, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SHIFT_RIGHT:
+        lanes_shift_right(batch, x, f, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SHIFT_LEFT:
+        lanes_shift_left(batch, x, f, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case GET_DELAY:
+        memcpy(x, delay_timer, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SET_DELAY:
+        memcpy(delay_timer, x, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SET_AUDIO:
+        memcpy(audio_timer, x, count);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case ADVANCE_I:
+        for (uint32_t i = 0; i < count; i++)
+            I[i] += x[i];
+        lanes_fill(PC, next_pc, count);
+        break;
+    case SET_I_HEX_SPRITE:
+        for (uint32_t i = 0; i < count; i++)
+            I[i] = DIGIT_SPRITES_OFFSET + (x[i] * 5);
+        lanes_fill(PC, next_pc, count);
+        break;
+    case NOOP:
+    case UNDECODED:
+        lanes_fill(PC, next_pc, count);
+        break;
+    case BCD:
+        for (uint32_t i = 0; i < count; i++)
+            mark_written(batch, I[i], 3);
+        step_lanes_state(batch, first, count, decoded_op);
+        break;
+    case CLEAR_DISPLAY:
+    case RET:
+    case CALL:
+    case DRAW_SPRITE:
+    case SCROLL_DOWN:
+    case SCROLL_RIGHT:
+    case SCROLL_LEFT:
+    case LORES:
+    case HIRES:
+        // The stack and screen are per machine, but these read and write few enough registers
+        step_lanes_state(batch, first, count, decoded_op);
+        break;
+    default:
+        // Waiting for a key, and loading or dumping every register
+        return 0;
+    }
+
+    batch->lockstep_steps += count;
+    return 1;
+}
+
+/**
+ * Runs the given number of steps on the group of count slots from first: in lockstep while its machines
+ * agree on the instruction, and once they don't, split into the groups of machines at the same PC, each
+ * run on in turn
+ */
+static void run_group(batch *batch, uint32_t first, uint32_t count, uint32_t steps)
+{
+    op decoded_op;
+
+    while (steps > 0)
+    {
+        if (count < BATCH_MIN_GROUP)
+        {
+            for (uint32_t i = first; i < first + count; i++)
+                step_lane(batch, i, steps);
+            return;
+        }
+        if (!is_uniform(batch, first, count, &decoded_op))
+        {
+            uint32_t end = first + count;
+            group_by_pc(batch, first, count);
+            if (batch->PC[first] == batch->PC[end - 1])
+            {
+                // The machines are at the same PC, but have written different instructions there
+                for (uint32_t i = first; i < end; i++)
+                    step_lane(batch, i, steps);
+                return;
+            }
+            for (uint32_t start = first, next; start < end; start = next)
+            {
+                for (next = start + 1; next < end && batch->PC[next] == batch->PC[start]; next++)
+                    ;
+                run_group(batch, start, next - start, steps);
+            }
+            return;
+        }
+
+        if (!step_lockstep(batch, first, count, &decoded_op))
+            for (uint32_t i = first; i < first + count; i++)
+                step_lane(batch, i, 1);
+        steps--;
+    }
+}
+
+void batch_run_cycles(batch *batch, uint32_t cycles)
+{
+    uint32_t steps;
+
+    while (cycles > 0)
+    {
+        // Machines are regrouped every few instructions, rather than every one, so that each group runs on
+        // for a while. They can't run past the end of the frame, as the timers are ticked together
+        steps = batch->cycles_per_frame - batch->frame_cycles;
+        steps = (steps < BATCH_DIVERGED_CYCLES) ? steps : BATCH_DIVERGED_CYCLES;
+        steps = (steps < cycles) ? steps : cycles;
+        run_group(batch, 0, batch->count, steps);
+
+        cycles -= steps;
+        batch->frame_cycles += steps;
+        if (batch->frame_cycles >= batch->cycles_per_frame)
+        {
+            batch->frame_cycles = 0;
+            lanes_tick(batch, batch->delay_timer, batch->count);
+            lanes_tick(batch, batch->audio_timer, batch->count);
+        }
+    }
+}
+
+void batch_run_frame(batch *batch)
+{
+    batch_run_cycles(batch, batch->cycles_per_frame - batch->frame_cycles);
+}
+
+uint8_t *batch_screen(batch *batch, uint32_t lane)
+{
+    return batch->lanes[lane].state.screen;
+}
+
+void batch_get_state(batch *batch, uint32_t lane, state *state)
+{
+    *state = batch->lanes[lane].state;
+    gather(batch, batch->lanes[lane].slot, state);
+}
+
+void batch_free(batch *batch)
+{
+    free(batch->V);
+    free(batch->PC);
+    free(batch->I);
+    free(batch->delay_timer);
+    free(batch->audio_timer);
+    free(batch->mask);
+    free(batch->memory);
+    free(batch->lanes);
+    free(batch->slots);
+    free(batch->order);
+    free(batch->scratch);
+    free(batch->group_offsets);
+    free(batch->pc_groups);
+    memset(batch, 0, sizeof(*batch));
+}
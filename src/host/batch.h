@@ -0,0 +1,235 @@
+/**
+ * @file batch.h
+ * @brief This module is used by host builds to step many CHIP-8 devices running the same program in lockstep
+ *
+ * The hot registers of every machine (V, PC, I and the timers) are stored as structure-of-arrays, so that
+ * register V[x] of every machine is one contiguous array. While every machine is at the same PC, and so
+ * about to run the same instruction, arithmetic, skips and jumps are run across all machines at once.
+ * On x86 hosts whose CPU has AVX2 that is 32 machines per instruction: the AVX2 kernels are built into a
+ * module of their own, and chosen at run time. @see batch_avx2.h
+ *
+ * Once machines diverge, they're regrouped by PC: their registers are reordered so that the machines about
+ * to run the same instruction are next to one another, and each of those groups is run on in lockstep.
+ * Groups too small to be worth it, and operations that touch memory, the screen or the stack, are stepped
+ * one machine at a time by the core's execute. The screen, stack and memory of each machine are kept in a
+ * state of its own for this purpose.
+ *
+ * Machines are driven by their inputs: a bitmask of the keys held, and the seed of a random generator.
+ * Waiting for a key (FX0A) repeats the instruction until one is held. Nothing is displayed or sounded,
+ * the screens and audio timers are read back instead. @see batch_screen
+ *
+ * The lockstep engine reads programs straight from flat memory and only implements CHIP-8 and SUPER-CHIP,
+ * so it can't be built with CHIP8_PAGED_MEMORY or CHIP8_XO_CHIP.
+ */
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../chip8/chip8.h"
+
+#if defined(CHIP8_PAGED_MEMORY) || defined(CHIP8_XO_CHIP)
+#error "The batch engine needs the flat memory of CHIP-8 and SUPER-CHIP builds"
+#endif
+
+/**
+ * @def BATCH_ALIGNMENT
+ * @brief The alignment, in bytes, of every structure-of-arrays register. The width of an AVX2 register
+ */
+#define BATCH_ALIGNMENT 32
+
+/**
+ * @def BATCH_DIVERGED_CYCLES
+ * @brief The most instructions run before every machine is regrouped. Machines that have diverged from the
+ * rest of their group only converge again with others in between
+ */
+#define BATCH_DIVERGED_CYCLES 16
+
+/**
+ * @def BATCH_MIN_GROUP
+ * @brief The fewest machines at the same PC that are run in lockstep. Smaller groups are stepped one
+ * machine at a time
+ */
+#define BATCH_MIN_GROUP 4
+
+/**
+ * @struct batch_lane
+ * @brief The state of a single machine of a batch that isn't stored as structure-of-arrays
+ */
+typedef struct batch_lane
+{
+    /**
+     * @brief The screen, stack, SP and memory of the machine. Its registers and timers are only up to date
+     * while the machine is being stepped on its own
+     */
+    state state;
+    /**
+     * @brief The peripherals of the machine. Their user context is this lane
+     */
+    peripherals peripherals;
+    /**
+     * @brief A bitmask of the keys held. Bit N is set while key N is held
+     */
+    uint16_t keys;
+    /**
+     * @brief The state of the xorshift generator used by the random peripheral
+     */
+    uint32_t rng_state;
+    /**
+     * @brief The index of the machine's structure-of-arrays registers, which changes as machines are regrouped
+     */
+    uint32_t slot;
+} batch_lane;
+
+/**
+ * @struct batch
+ * @brief A set of CHIP-8 machines stepped in lockstep
+ */
+typedef struct batch
+{
+    /**
+     * @brief The number of machines
+     */
+    uint32_t count;
+    /**
+     * @brief The distance, in elements, between register V[x] and V[x + 1] of the same machine.
+     * count rounded up to BATCH_ALIGNMENT
+     */
+    uint32_t stride;
+    /**
+     * @brief The V registers of every machine. Register x of the machine at slot i is V[x * stride + i]
+     */
+    uint8_t *V;
+    /**
+     * @brief The program counter of every machine
+     */
+    uint16_t *PC;
+    /**
+     * @brief The I register of every machine
+     */
+    uint16_t *I;
+    /**
+     * @brief The delay timer of every machine
+     */
+    uint8_t *delay_timer;
+    /**
+     * @brief The audio timer of every machine
+     */
+    uint8_t *audio_timer;
+    /**
+     * @brief Scratch space of a byte per machine, used for the results of comparisons
+     */
+    uint8_t *mask;
+    /**
+     * @brief The RAM_SIZE bytes of memory of every machine, back to back
+     */
+    uint8_t *memory;
+    /**
+     * @brief The remaining state of every machine, indexed by machine rather than by slot
+     */
+    batch_lane *lanes;
+    /**
+     * @brief The machine whose registers are at each index of the structure-of-arrays ones
+     */
+    batch_lane **slots;
+    /**
+     * @brief Scratch space for regrouping machines: the slot each is moved from
+     */
+    uint32_t *order;
+    /**
+     * @brief Scratch space for regrouping machines: a register array as it's reordered
+     */
+    void *scratch;
+    /**
+     * @brief Scratch space for regrouping machines: the size, then the first slot, of each group
+     */
+    uint32_t *group_offsets;
+    /**
+     * @brief The group, counted from 1, of the machines at each of the RAM_SIZE PCs as they're regrouped.
+     * 0 at every PC in between
+     */
+    uint32_t *pc_groups;
+    /**
+     * @brief Flags of which 64 byte blocks of memory have been written to by any machine. Instructions in
+     * these blocks may differ between machines, so they are compared before being run in lockstep
+     */
+    uint8_t written[RAM_SIZE / 64];
+    /**
+     * @brief The number of instructions executed per frame, @see chip8
+     */
+    uint16_t cycles_per_frame;
+    /**
+     * @brief The number of instructions executed since the timers were last ticked
+     */
+    uint16_t frame_cycles;
+    /**
+     * @brief Whether the AVX2 kernels are used. Set by batch_init if the CPU has AVX2, and may be cleared
+     */
+    uint8_t avx2;
+    /**
+     * @brief The number of instructions that were run in lockstep, counted once per machine
+     */
+    unsigned long long lockstep_steps;
+    /**
+     * @brief The number of instructions that were run one machine at a time
+     */
+    unsigned long long scalar_steps;
+} batch;
+
+/**
+ * @brief Allocates a batch of the given number of machines, each loaded with the given program.
+ * The random generator of machine i is seeded with i + 1, and no keys are held
+ *
+ * @param batch - The batch to be initialized
+ * @param count - The number of machines
+ * @param program - The program to be loaded. Must be PROGRAM_SIZE bytes long
+ * @param cycles_per_frame - The number of instructions executed per frame. CYCLES_PER_FRAME is used if 0
+ * @returns 0 on success. -1 if the batch couldn't be allocated
+ */
+int batch_init(batch *batch, uint32_t count, uint8_t *program, uint16_t cycles_per_frame);
+
+/**
+ * @brief Sets the keys held by the given machine
+ *
+ * @param batch - The batch holding the machine
+ * @param lane - The index of the machine
+ * @param keys - A bitmask of the keys held. Bit N is set while key N is held
+ */
+void batch_set_keys(batch *batch, uint32_t lane, uint16_t keys);
+
+/**
+ * @brief Seeds the random generator of the given machine
+ */
+void batch_seed(batch *batch, uint32_t lane, uint32_t seed);
+
+/**
+ * @brief Performs the given number of cycles on every machine of the batch, ticking the timers of every
+ * machine once every cycles_per_frame cycles
+ *
+ * @param batch - The batch to run cycles on
+ * @param cycles - The number of instructions executed by each machine
+ */
+void batch_run_cycles(batch *batch, uint32_t cycles);
+
+/**
+ * @brief Runs every machine of the batch until its timers are next ticked, @see chip8_run_frame
+ */
+void batch_run_frame(batch *batch);
+
+/**
+ * @brief Returns the screen buffer of the given machine
+ */
+uint8_t *batch_screen(batch *batch, uint32_t lane);
+
+/**
+ * @brief Copies the given machine out of the batch into the given state, for inspection.
+ * The state's memory points into the batch
+ */
+void batch_get_state(batch *batch, uint32_t lane, state *state);
+
+/**
+ * @brief Frees the memory of the given batch
+ */
+void batch_free(batch *batch);
+
+#endif
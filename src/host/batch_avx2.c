@@ -0,0 +1,206 @@
+/**
+ * @file batch_avx2.c
+ * @brief This module implements the AVX2 kernels of the lockstep batch engine
+ *
+ * x may be the same array as y or as f, so every block is read before any is written. A group of machines may
+ * start anywhere in the arrays, so the loads and stores are unaligned.
+ */
+#include "batch_avx2.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+int batch_avx2_supported(void)
+{
+#if defined(__AVX2__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return 0;
+#endif
+}
+
+#ifdef __AVX2__
+
+uint32_t avx2_add_imm(uint8_t *x, uint8_t nn, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i n = _mm256_set1_epi8(nn);
+    for (; i + 32 <= count; i += 32)
+        _mm256_storeu_si256((__m256i *)&x[i], _mm256_add_epi8(_mm256_loadu_si256((__m256i *)&x[i]), n));
+    return i;
+}
+
+uint32_t avx2_logic(uint8_t *x, const uint8_t *y, uint8_t operation, uint32_t count)
+{
+    uint32_t i = 0;
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((__m256i *)&x[i]);
+        __m256i b = _mm256_loadu_si256((__m256i *)&y[i]);
+        a = (operation == 1) ? _mm256_or_si256(a, b) : (operation == 2) ? _mm256_and_si256(a, b) : _mm256_xor_si256(a, b);
+        _mm256_storeu_si256((__m256i *)&x[i], a);
+    }
+    return i;
+}
+
+uint32_t avx2_add(uint8_t *x, const uint8_t *y, uint8_t *f, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i one = _mm256_set1_epi8(1);
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((__m256i *)&x[i]);
+        __m256i b = _mm256_loadu_si256((__m256i *)&y[i]);
+        __m256i sum = _mm256_add_epi8(a, b);
+        // The sum carried wherever it differs from the saturated sum
+        __m256i no_carry = _mm256_cmpeq_epi8(sum, _mm256_adds_epu8(a, b));
+        _mm256_storeu_si256((__m256i *)&x[i], sum);
+        _mm256_storeu_si256((__m256i *)&f[i], _mm256_andnot_si256(no_carry, one));
+    }
+    return i;
+}
+
+uint32_t avx2_sub(uint8_t *x, const uint8_t *y, uint8_t *f, uint8_t reversed, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i one = _mm256_set1_epi8(1);
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((__m256i *)&x[i]);
+        __m256i b = _mm256_loadu_si256((__m256i *)&y[i]);
+        if (reversed)
+        {
+            __m256i t = a;
+            a = b;
+            b = t;
+        }
+        // a > b wherever the saturated difference isn't 0
+        __m256i not_greater = _mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), zero);
+        _mm256_storeu_si256((__m256i *)&x[i], _mm256_sub_epi8(a, b));
+        _mm256_storeu_si256((__m256i *)&f[i], _mm256_andnot_si256(not_greater, one));
+    }
+    return i;
+}
+
+uint32_t avx2_shift_right(uint8_t *x, uint8_t *f, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i one = _mm256_set1_epi8(1);
+    __m256i low_bits = _mm256_set1_epi8(0x7F);
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((__m256i *)&x[i]);
+        // There's no 8 bit shift, so shift 16 bits and clear what crossed between bytes
+        _mm256_storeu_si256((__m256i *)&x[i], _mm256_and_si256(_mm256_srli_epi16(a, 1), low_bits));
+        _mm256_storeu_si256((__m256i *)&f[i], _mm256_and_si256(a, one));
+    }
+    return i;
+}
+
+uint32_t avx2_shift_left(uint8_t *x, uint8_t *f, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i one = _mm256_set1_epi8(1);
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((__m256i *)&x[i]);
+        _mm256_storeu_si256((__m256i *)&x[i], _mm256_add_epi8(a, a));
+        _mm256_storeu_si256((__m256i *)&f[i], _mm256_and_si256(_mm256_srli_epi16(a, 7), one));
+    }
+    return i;
+}
+
+uint32_t avx2_compare(uint8_t *mask, const uint8_t *x, const uint8_t *y, uint8_t inverted, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i invert = _mm256_set1_epi8(inverted ? 0xFF : 0);
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)&x[i]), _mm256_loadu_si256((__m256i *)&y[i]));
+        _mm256_storeu_si256((__m256i *)&mask[i], _mm256_xor_si256(equal, invert));
+    }
+    return i;
+}
+
+uint32_t avx2_compare_imm(uint8_t *mask, const uint8_t *x, uint8_t nn, uint8_t inverted, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i n = _mm256_set1_epi8(nn);
+    __m256i invert = _mm256_set1_epi8(inverted ? 0xFF : 0);
+    for (; i + 32 <= count; i += 32)
+    {
+        __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)&x[i]), n);
+        _mm256_storeu_si256((__m256i *)&mask[i], _mm256_xor_si256(equal, invert));
+    }
+    return i;
+}
+
+uint32_t avx2_tick(uint8_t *timer, uint32_t count)
+{
+    uint32_t i = 0;
+    __m256i one = _mm256_set1_epi8(1);
+    for (; i + 32 <= count; i += 32)
+        _mm256_storeu_si256((__m256i *)&timer[i], _mm256_subs_epu8(_mm256_loadu_si256((__m256i *)&timer[i]), one));
+    return i;
+}
+
+#else
+
+// Without AVX2 every kernel runs no machines, and batch_avx2_supported keeps them from being called anyway
+
+uint32_t avx2_add_imm(uint8_t *x, uint8_t nn, uint32_t count)
+{
+    (void)x, (void)nn, (void)count;
+    return 0;
+}
+
+uint32_t avx2_logic(uint8_t *x, const uint8_t *y, uint8_t operation, uint32_t count)
+{
+    (void)x, (void)y, (void)operation, (void)count;
+    return 0;
+}
+
+uint32_t avx2_add(uint8_t *x, const uint8_t *y, uint8_t *f, uint32_t count)
+{
+    (void)x, (void)y, (void)f, (void)count;
+    return 0;
+}
+
+uint32_t avx2_sub(uint8_t *x, const uint8_t *y, uint8_t *f, uint8_t reversed, uint32_t count)
+{
+    (void)x, (void)y, (void)f, (void)reversed, (void)count;
+    return 0;
+}
+
+uint32_t avx2_shift_right(uint8_t *x, uint8_t *f, uint32_t count)
+{
+    (void)x, (void)f, (void)count;
+    return 0;
+}
+
+uint32_t avx2_shift_left(uint8_t *x, uint8_t *f, uint32_t count)
+{
+    (void)x, (void)f, (void)count;
+    return 0;
+}
+
+uint32_t avx2_compare(uint8_t *mask, const uint8_t *x, const uint8_t *y, uint8_t inverted, uint32_t count)
+{
+    (void)mask, (void)x, (void)y, (void)inverted, (void)count;
+    return 0;
+}
+
+uint32_t avx2_compare_imm(uint8_t *mask, const uint8_t *x, uint8_t nn, uint8_t inverted, uint32_t count)
+{
+    (void)mask, (void)x, (void)nn, (void)inverted, (void)count;
+    return 0;
+}
+
+uint32_t avx2_tick(uint8_t *timer, uint32_t count)
+{
+    (void)timer, (void)count;
+    return 0;
+}
+
+#endif
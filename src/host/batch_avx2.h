@@ -0,0 +1,52 @@
+/**
+ * @file batch_avx2.h
+ * @brief This module holds the AVX2 kernels of the lockstep batch engine
+ *
+ * The module is built with -mavx2 on x86 hosts, and nothing else is, so that the rest of the engine runs on
+ * any CPU. The batch engine only calls these kernels once batch_avx2_supported has said the CPU can run them.
+ *
+ * Each kernel runs an operation across as many whole blocks of 32 machines as fit in count, given their
+ * register arrays, and returns the number of machines it ran. The batch engine runs the remainder.
+ * @see batch.c
+ */
+#ifndef BATCH_AVX2_H
+#define BATCH_AVX2_H
+
+#include <stdint.h>
+
+/**
+ * @brief Returns whether the AVX2 kernels may be run: the module was built with AVX2, and the CPU has it
+ */
+int batch_avx2_supported(void);
+
+uint32_t avx2_add_imm(uint8_t *x, uint8_t nn, uint32_t count);
+
+/**
+ * @brief Runs OR (1), AND (2) or XOR (3)
+ */
+uint32_t avx2_logic(uint8_t *x, const uint8_t *y, uint8_t operation, uint32_t count);
+
+uint32_t avx2_add(uint8_t *x, const uint8_t *y, uint8_t *f, uint32_t count);
+
+/**
+ * @brief Runs SUB (x = x - y) or, if reversed, SUBN (x = y - x)
+ */
+uint32_t avx2_sub(uint8_t *x, const uint8_t *y, uint8_t *f, uint8_t reversed, uint32_t count);
+
+uint32_t avx2_shift_right(uint8_t *x, uint8_t *f, uint32_t count);
+
+uint32_t avx2_shift_left(uint8_t *x, uint8_t *f, uint32_t count);
+
+/**
+ * @brief Writes 0xFF to the mask of every machine where x == y (or x != y, if inverted), and 0 elsewhere
+ */
+uint32_t avx2_compare(uint8_t *mask, const uint8_t *x, const uint8_t *y, uint8_t inverted, uint32_t count);
+
+uint32_t avx2_compare_imm(uint8_t *mask, const uint8_t *x, uint8_t nn, uint8_t inverted, uint32_t count);
+
+/**
+ * @brief Counts the given timers down by one, stopping at 0
+ */
+uint32_t avx2_tick(uint8_t *timer, uint32_t count);
+
+#endif
@@ -0,0 +1,353 @@
+/**
+ * @file headless.c
+ * @brief The entrypoint for the headless runner of the CHIP-8 device
+ *
+ * This runs a program for a fixed number of cycles or frames, as fast as possible, with no window,
+ * audio or keyboard. The peripherals are stand-ins that only count how often they're called.
+ * Once finished, throughput statistics and a hash of the final screen are reported.
+ *
+ * Usage: chip8_headless program.ch8 [--cycles N | --frames N] [--cpf N] [--seed N] [--vblank] [--jit | --aot]
+ *                       [--record FILE | --replay FILE] [--trace FILE]
+ *
+ * --aot runs the program's ahead-of-time translation, if the runner was built with AOT=1 and the
+ * program is one of those translated. @see aot.h
+ *
+ * --record logs the inputs of every frame run to the given file. --replay runs the frames of a recording
+ * (made here or by the desktop app) with the inputs that were recorded, at the cycles per frame it was
+ * recorded with, until it ends. @see recording.h
+ *
+ * --trace writes the trace buffer to the given file whenever the program faults, and once finished, if the
+ * runner was built with TRACE=1 or 2. @see trace.h, and tracedump.c for reading it back
+ *
+ * When built with INSTRUMENT=1, a report of the instructions run and the peripheral calls made follows.
+ * @see instrument.h
+ */
+#include <time.h>
+#include "../chip8/chip8.h"
+#include "rom.h"
+#include "host_util.h"
+#include "jit.h"
+#include "../chip8/aot.h"
+#include "../chip8/instrument.h"
+#include "../chip8/trace.h"
+#include "recording.h"
+
+/**
+ * @def DEFAULT_FRAMES
+ * @brief The number of frames run when neither --cycles nor --frames are given
+ */
+#define DEFAULT_FRAMES 600
+
+/**
+ * @def REPORTED_ADDRESSES
+ * @brief The number of the most run addresses listed by the report of instrumented builds
+ */
+#define REPORTED_ADDRESSES 16
+
+/**
+ * @struct runner
+ * @brief The context given to the headless runner's peripherals
+ */
+typedef struct runner
+{
+    /**
+     * @brief The number of times the display peripherals have been called
+     */
+    unsigned long draw_calls;
+    /**
+     * @brief The number of times the buzzer peripheral has been called
+     */
+    unsigned long buzzer_calls;
+    /**
+     * @brief The state of the xorshift generator used by the random peripheral
+     */
+    uint32_t rng_state;
+} runner;
+
+void count_display(void *user, uint8_t *screen)
+{
+    ((runner *)user)->draw_calls++;
+}
+
+void count_display_region(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count)
+{
+    ((runner *)user)->draw_calls++;
+}
+
+void count_buzzer(void *user, uint8_t on)
+{
+    ((runner *)user)->buzzer_calls++;
+}
+
+uint8_t next_random(void *user)
+{
+    runner *runner = user;
+    return xorshift_next(&runner->rng_state);
+}
+
+uint8_t no_key_pressed(void *user, uint8_t key)
+{
+    return 0;
+}
+
+uint8_t first_key(void *user)
+{
+    // There is nobody to wait on
+    return 0;
+}
+
+/**
+ * @brief The trace sink, appending each block to the trace file given as the user context
+ */
+void write_trace(void *user, const uint8_t *block, uint16_t size)
+{
+    fwrite(block, 1, size, (FILE *)user);
+}
+
+double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long cycles = 0;
+    unsigned long frames = 0;
+    uint16_t cycles_per_frame = CYCLES_PER_FRAME;
+    uint8_t use_jit = 0;
+    uint8_t use_aot = 0;
+    const char *record_file = NULL;
+    const char *replay_file = NULL;
+    const char *trace_file = NULL;
+    runner runner = {
+        .rng_state = 1
+    };
+    peripherals peripherals = {
+        .user = &runner,
+        .display = &count_display,
+        .display_region = &count_display_region,
+        .present_mode = PRESENT_IMMEDIATE,
+        .buzzer = &count_buzzer,
+        .random = &next_random,
+        .is_key_pressed = &no_key_pressed,
+        .get_key_pressed = &first_key,
+    };
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s program.ch8 [--cycles N | --frames N] [--cpf N] [--seed N] [--vblank] [--jit | --aot] [--record FILE | --replay FILE] [--trace FILE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            cycles = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--cpf") == 0 && i + 1 < argc)
+            cycles_per_frame = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            runner.rng_state = xorshift_seed(strtoul(argv[++i], NULL, 0));
+        else if (strcmp(argv[i], "--vblank") == 0)
+            peripherals.present_mode = PRESENT_VBLANK;
+        else if (strcmp(argv[i], "--jit") == 0)
+            use_jit = 1;
+        else if (strcmp(argv[i], "--aot") == 0)
+            use_aot = 1;
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_file = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replay_file = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace_file = argv[++i];
+        else
+        {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((record_file != NULL || replay_file != NULL) && cycles > 0)
+    {
+        fprintf(stderr, "Recordings are of whole frames, use --frames instead of --cycles\n");
+        return EXIT_FAILURE;
+    }
+    if (cycles == 0 && frames == 0)
+        frames = DEFAULT_FRAMES;
+
+    // Setup
+    uint8_t memory[RAM_SIZE];
+    uint8_t program_memory[PROGRAM_SIZE];
+    op *decode_cache = malloc(DECODE_CACHE_SIZE * sizeof(op));
+    if (decode_cache == NULL)
+    {
+        fprintf(stderr, "Could not allocate the decode cache\n");
+        return EXIT_FAILURE;
+    }
+    if (load_rom(argv[1], program_memory) < 0)
+    {
+        fprintf(stderr, "Could not load %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    // Either way, the device is wired to the recording, which passes calls on to the runner's peripherals
+    recording recording;
+    struct peripherals *device_peripherals = &peripherals;
+    if (record_file != NULL)
+    {
+        if (recording_start(&recording, record_file, &peripherals, program_memory, cycles_per_frame) < 0)
+        {
+            fprintf(stderr, "Could not record to %s\n", record_file);
+            return EXIT_FAILURE;
+        }
+        device_peripherals = &recording.peripherals;
+    }
+    else if (replay_file != NULL)
+    {
+        if (replay_start(&recording, replay_file, &peripherals, program_memory, &cycles_per_frame) < 0)
+        {
+            fprintf(stderr, "Could not replay %s, it isn't a recording of %s\n", replay_file, argv[1]);
+            return EXIT_FAILURE;
+        }
+        device_peripherals = &recording.peripherals;
+        // Replays run until the recording ends
+        frames = (unsigned long)-1;
+    }
+
+#if CHIP8_TRACE_LEVEL > 0
+    FILE *trace = NULL;
+    if (trace_file != NULL)
+    {
+        trace = fopen(trace_file, "wb");
+        if (trace == NULL)
+        {
+            fprintf(stderr, "Could not trace to %s\n", trace_file);
+            return EXIT_FAILURE;
+        }
+    }
+#else
+    if (trace_file != NULL)
+        fprintf(stderr, "Tracing wasn't built in (see TRACE=1), not tracing\n");
+#endif
+
+    chip8_config config = {device_peripherals, memory, program_memory, decode_cache, cycles_per_frame};
+    chip8 cpu = chip8_init(&config);
+#ifdef CHIP8_INSTRUMENT
+    // Large enough not to be kept on the stack
+    static chip8_stats stats;
+    chip8_stats_attach(&cpu.state, &stats);
+#endif
+#if CHIP8_TRACE_LEVEL > 0
+    static trace_buffer trace_buffer;
+    if (trace != NULL)
+        chip8_trace_attach(&cpu.state, &trace_buffer, &write_trace, trace);
+#endif
+
+    jit *jit = NULL;
+    if (use_jit)
+    {
+        jit = malloc(sizeof(*jit));
+        if (jit == NULL)
+        {
+            fprintf(stderr, "Could not allocate the recompiler\n");
+            return EXIT_FAILURE;
+        }
+        if (jit_init(jit, &cpu) < 0)
+        {
+            fprintf(stderr, "The recompiler isn't supported here, falling back to the interpreter\n");
+            free(jit);
+            jit = NULL;
+        }
+    }
+
+    aot aot;
+    uint8_t aot_ready = 0;
+    if (use_aot && jit == NULL)
+    {
+#ifdef CHIP8_AOT
+        const aot_program *program = aot_find(&cpu, aot_programs, aot_program_count);
+        aot_ready = program != NULL && aot_init(&aot, &cpu, program) == 0;
+        if (!aot_ready)
+            fprintf(stderr, "%s hasn't been translated, falling back to the interpreter\n", argv[1]);
+#else
+        fprintf(stderr, "Translated programs weren't built in (see AOT=1), falling back to the interpreter\n");
+#endif
+    }
+
+    // Run
+    double start = seconds_now();
+    if (cycles > 0)
+    {
+        // The engines count cycles in 32 bits, so longer runs are given to them in parts
+        for (unsigned long left = cycles; left > 0;)
+        {
+            uint32_t part = left > UINT32_MAX ? UINT32_MAX : left;
+            if (jit != NULL)
+                jit_run_cycles(jit, part);
+            else if (aot_ready)
+                aot_run_cycles(&aot, part);
+            else
+                chip8_run_cycles(&cpu, part);
+            left -= part;
+        }
+        frames = cycles / cpu.cycles_per_frame;
+    }
+    else
+    {
+        unsigned long i;
+        for (i = 0; i < frames; i++)
+        {
+            if (device_peripherals != &peripherals && recording_frame(&recording) < 0)
+                break;
+
+            if (jit != NULL)
+                jit_run_frame(jit);
+            else if (aot_ready)
+                aot_run_frame(&aot);
+            else
+                chip8_run_frame(&cpu);
+        }
+        frames = i;
+        cycles = frames * cpu.cycles_per_frame;
+    }
+    double elapsed = seconds_now() - start;
+
+    // Report
+    printf("rom: %s\n", argv[1]);
+    printf("engine: %s\n", (jit != NULL) ? "jit" : aot_ready ? "aot" : "interpreter");
+    printf("instructions: %lu\n", cycles);
+    printf("frames: %lu\n", frames);
+    printf("seconds: %.6f\n", elapsed);
+    printf("instructions_per_second: %.0f\n", (elapsed > 0) ? cycles / elapsed : 0);
+    printf("draw_calls: %lu\n", runner.draw_calls);
+    printf("buzzer_calls: %lu\n", runner.buzzer_calls);
+    printf("screen_hash: %016llx\n", (unsigned long long)hash_screen(cpu.state.screen));
+    if (replay_file != NULL)
+        printf("replay: %s\n", recording.diverged ? "diverged" : "matched");
+#ifdef CHIP8_INSTRUMENT
+    chip8_stats_report(stdout, &stats, REPORTED_ADDRESSES);
+#endif
+
+    if (device_peripherals != &peripherals)
+        recording_close(&recording);
+
+#if CHIP8_TRACE_LEVEL > 0
+    if (trace != NULL)
+    {
+        chip8_trace_flush(&trace_buffer, TRACE_REQUESTED);
+        chip8_trace_attach(&cpu.state, NULL, NULL, NULL);
+        fclose(trace);
+    }
+#endif
+
+    if (jit != NULL)
+    {
+        jit_free(jit);
+        free(jit);
+    }
+    free(decode_cache);
+    return 0;
+}
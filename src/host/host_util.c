@@ -0,0 +1,29 @@
+/**
+ * @file host_util.c
+ * @brief This module implements the random generator and screen hash shared by host builds
+ */
+#include "host_util.h"
+
+uint8_t xorshift_next(uint32_t *rng_state)
+{
+    *rng_state ^= *rng_state << 13;
+    *rng_state ^= *rng_state >> 17;
+    *rng_state ^= *rng_state << 5;
+    return *rng_state & 0xFF;
+}
+
+uint32_t xorshift_seed(uint32_t seed)
+{
+    return seed | 1;
+}
+
+uint64_t hash_screen(const uint8_t *screen)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < SCREEN_BYTES; i++)
+    {
+        hash ^= screen[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
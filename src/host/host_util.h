@@ -0,0 +1,30 @@
+/**
+ * @file host_util.h
+ * @brief This module holds the helpers that host builds use to run devices reproducibly: the random
+ * generator their peripherals are seeded with, and the hash their screens are compared by
+ */
+#ifndef HOST_UTIL_H
+#define HOST_UTIL_H
+
+#include <stdint.h>
+#include "../chip8/chip8.h"
+
+/**
+ * @brief Advances the given xorshift generator
+ *
+ * @param rng_state - The state of the generator. Must not be 0 @see xorshift_seed
+ * @returns The low byte of the new state
+ */
+uint8_t xorshift_next(uint32_t *rng_state);
+
+/**
+ * @brief Returns the state of a xorshift generator for the given seed. xorshift must not be seeded with 0
+ */
+uint32_t xorshift_seed(uint32_t seed);
+
+/**
+ * @brief Hashes the given screen buffer with 64 bit FNV-1a
+ */
+uint64_t hash_screen(const uint8_t *screen);
+
+#endif
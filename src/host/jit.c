@@ -0,0 +1,765 @@
+/**
+ * @file jit.c
+ * @brief This module implements the x86-64 dynamic recompiler
+ */
+#include "jit.h"
+#include <stddef.h>
+
+#ifdef JIT_SUPPORTED
+#include <sys/mman.h>
+
+/**
+ * The space reserved in the code cache before a block is translated. Larger than the largest block can be
+ */
+#define BLOCK_RESERVE 16384
+
+#define OFFSET_V offsetof(state, V)
+#define OFFSET_PC offsetof(state, PC)
+#define OFFSET_I offsetof(state, I)
+#define OFFSET_DELAY offsetof(state, delay_timer)
+#define OFFSET_AUDIO offsetof(state, audio_timer)
+
+enum host_register
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+/**
+ * The host registers V registers may be held in. RBX holds the state and R15 the remaining cycles.
+ * RAX, RCX and RDX are scratch. The caller saved registers are fine to use, as every V register is written
+ * back to the state before calling out to execute anyway
+ */
+static const uint8_t cache_registers[] = {RBP, R12, R13, R14, RSI, RDI, R8, R9, R10, R11};
+#define CACHE_COUNT (sizeof(cache_registers) / sizeof(cache_registers[0]))
+
+typedef struct emitter
+{
+    uint8_t *p;
+    /**
+     * The host register holding each V register, or -1 if it's accessed in the state
+     */
+    int8_t host[REGISTER_COUNT];
+} emitter;
+
+static void emit8(emitter *e, uint8_t byte)
+{
+    *e->p++ = byte;
+}
+
+static void emit16(emitter *e, uint16_t value)
+{
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+static void emit32(emitter *e, uint32_t value)
+{
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+static void emit64(emitter *e, uint64_t value)
+{
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+/**
+ * Emits a REX prefix if either register is R8-R15, or if forced (to address SPL-DIL as bytes)
+ */
+static void emit_rex(emitter *e, uint8_t reg, uint8_t rm, uint8_t force)
+{
+    uint8_t rex = 0x40 | ((reg >= 8) << 2) | (rm >= 8);
+    if (rex != 0x40 || force)
+        emit8(e, rex);
+}
+
+static void emit_modrm(emitter *e, uint8_t mod, uint8_t reg, uint8_t rm)
+{
+    emit8(e, (mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+/**
+ * Emits the ModRM byte and displacement of [RBX + disp]
+ */
+static void emit_state_operand(emitter *e, uint8_t reg, uint32_t disp)
+{
+    emit_modrm(e, 2, reg, RBX);
+    emit32(e, disp);
+}
+
+// movzx dst, byte [rbx + disp]
+static void load_byte(emitter *e, uint8_t dst, uint32_t disp)
+{
+    emit_rex(e, dst, 0, 0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_state_operand(e, dst, disp);
+}
+
+// mov byte [rbx + disp], src
+static void store_byte(emitter *e, uint8_t src, uint32_t disp)
+{
+    emit_rex(e, src, 0, src >= RSP && src <= RDI);
+    emit8(e, 0x88);
+    emit_state_operand(e, src, disp);
+}
+
+// movzx dst, word [rbx + disp]
+static void load_word(emitter *e, uint8_t dst, uint32_t disp)
+{
+    emit_rex(e, dst, 0, 0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB7);
+    emit_state_operand(e, dst, disp);
+}
+
+// mov word [rbx + disp], src
+static void store_word(emitter *e, uint8_t src, uint32_t disp)
+{
+    emit8(e, 0x66);
+    emit_rex(e, src, 0, 0);
+    emit8(e, 0x89);
+    emit_state_operand(e, src, disp);
+}
+
+// mov word [rbx + disp], value
+static void store_word_imm(emitter *e, uint32_t disp, uint16_t value)
+{
+    emit8(e, 0x66);
+    emit8(e, 0xC7);
+    emit_state_operand(e, 0, disp);
+    emit16(e, value);
+}
+
+// mov dst, src (32 bit)
+static void mov_reg(emitter *e, uint8_t dst, uint8_t src)
+{
+    emit_rex(e, src, dst, 0);
+    emit8(e, 0x89);
+    emit_modrm(e, 3, src, dst);
+}
+
+// mov dst, value (32 bit)
+static void mov_imm(emitter *e, uint8_t dst, uint32_t value)
+{
+    emit_rex(e, 0, dst, 0);
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, value);
+}
+
+// movzx dst, src (AL or DL)
+static void movzx_byte_reg(emitter *e, uint8_t dst, uint8_t src)
+{
+    emit_rex(e, dst, src, 0);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit_modrm(e, 3, dst, src);
+}
+
+// <opcode> dst, src, for the ALU opcodes that take r/m32, r32
+static void alu(emitter *e, uint8_t opcode, uint8_t dst, uint8_t src)
+{
+    emit_rex(e, src, dst, 0);
+    emit8(e, opcode);
+    emit_modrm(e, 3, src, dst);
+}
+
+#define ALU_ADD 0x01
+#define ALU_OR 0x09
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_XOR 0x31
+#define ALU_CMP 0x39
+
+static void load_v(emitter *e, uint8_t dst, uint8_t x)
+{
+    if (e->host[x] >= 0)
+        mov_reg(e, dst, e->host[x]);
+    else
+        load_byte(e, dst, OFFSET_V + x);
+}
+
+/**
+ * Stores the low byte of src (AL or DL) to V[x]
+ */
+static void store_v(emitter *e, uint8_t x, uint8_t src)
+{
+    if (e->host[x] >= 0)
+        movzx_byte_reg(e, e->host[x], src);
+    else
+        store_byte(e, src, OFFSET_V + x);
+}
+
+static void spill(emitter *e)
+{
+    for (int x = 0; x < REGISTER_COUNT; x++)
+        if (e->host[x] >= 0)
+            store_byte(e, e->host[x], OFFSET_V + x);
+}
+
+static void reload(emitter *e)
+{
+    for (int x = 0; x < REGISTER_COUNT; x++)
+        if (e->host[x] >= 0)
+            load_byte(e, e->host[x], OFFSET_V + x);
+}
+
+/**
+ * Emits a skip: PC is set to the address after next if the flags hold the given condition (0x4 = equal,
+ * 0x5 = not equal), and to the next address otherwise
+ */
+static void emit_skip(emitter *e, uint8_t condition, uint16_t next)
+{
+    // Neither mov touches the flags of the comparison before them
+    mov_imm(e, RCX, next);
+    mov_imm(e, RDX, next + 2);
+    emit8(e, 0x0F);
+    emit8(e, 0x40 | condition); // cmovcc ecx, edx
+    emit_modrm(e, 3, RCX, RDX);
+    store_word(e, RCX, OFFSET_PC);
+}
+
+/**
+ * Emits a call out to the core's execute for the given operation
+ */
+static void emit_execute(emitter *e, jit *jit, op *decoded_op, uint16_t next)
+{
+    // Just as though the instruction had been fetched
+    store_word_imm(e, OFFSET_PC, next);
+    spill(e);
+
+    emit8(e, 0x48); // mov rdi, decoded_op
+    emit8(e, 0xBF);
+    emit64(e, (uint64_t)(uintptr_t)decoded_op);
+    emit8(e, 0x48); // mov rsi, rbx
+    emit8(e, 0x89);
+    emit_modrm(e, 3, RBX, RSI);
+    emit8(e, 0x48); // mov rdx, peripherals
+    emit8(e, 0xBA);
+    emit64(e, (uint64_t)(uintptr_t)jit->cpu->peripherals);
+    emit8(e, 0x48); // mov rax, execute
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)&execute);
+    emit8(e, 0xFF); // call rax
+    emit_modrm(e, 3, 2, RAX);
+
+    reload(e);
+}
+
+/**
+ * Emits the given operation. Returns 1 if it ends the block
+ */
+static int emit_op(emitter *e, jit *jit, op *decoded_op, uint16_t address)
+{
+    uint16_t next = address + 2;
+
+    switch (decoded_op->type)
+    {
+    case JUMP:
+        store_word_imm(e, OFFSET_PC, decoded_op->nnn);
+        return 1;
+    case IF_EQ:
+    case IF_NEQ:
+        load_v(e, RAX, decoded_op->x);
+        emit8(e, 0x3D); // cmp eax, nn
+        emit32(e, decoded_op->nn);
+        emit_skip(e, (decoded_op->type == IF_EQ) ? 0x4 : 0x5, next);
+        return 1;
+    case IF_EQ_REG:
+    case SKIP_NEQ:
+        load_v(e, RAX, decoded_op->x);
+        load_v(e, RDX, decoded_op->y);
+        alu(e, ALU_CMP, RAX, RDX);
+        emit_skip(e, (decoded_op->type == IF_EQ_REG) ? 0x4 : 0x5, next);
+        return 1;
+    case SET_REG:
+        mov_imm(e, RAX, decoded_op->nn);
+        store_v(e, decoded_op->x, RAX);
+        return 0;
+    case ADD_REG:
+        load_v(e, RAX, decoded_op->x);
+        emit8(e, 0x05); // add eax, nn
+        emit32(e, decoded_op->nn);
+        store_v(e, decoded_op->x, RAX);
+        return 0;
+    case SET_I_REG:
+        store_word_imm(e, OFFSET_I, decoded_op->nnn);
+        return 0;
+    case SET_REG_BY_REG:
+        load_v(e, RAX, decoded_op->y);
+        store_v(e, decoded_op->x, RAX);
+        return 0;
+    case OR:
+    case AND:
+    case XOR:
+        load_v(e, RAX, decoded_op->x);
+        load_v(e, RCX, decoded_op->y);
+        alu(e, (decoded_op->type == OR) ? ALU_OR : (decoded_op->type == AND) ? ALU_AND : ALU_XOR, RAX, RCX);
+        store_v(e, decoded_op->x, RAX);
+        return 0;
+    case ADD_BY_REG:
+        load_v(e, RAX, decoded_op->x);
+        load_v(e, RCX, decoded_op->y);
+        alu(e, ALU_ADD, RAX, RCX);
+        mov_reg(e, RDX, RAX);
+        emit8(e, 0xC1); // shr edx, 8 (the carry)
+        emit_modrm(e, 3, 5, RDX);
+        emit8(e, 8);
+        store_v(e, decoded_op->x, RAX);
+        store_v(e, 0xF, RDX);
+        return 0;
+    case SUB:
+    case SUBN:
+    {
+        // SUBN is SUB with the operands swapped
+        uint8_t minuend = (decoded_op->type == SUB) ? RAX : RCX;
+        uint8_t subtrahend = (decoded_op->type == SUB) ? RCX : RAX;
+        load_v(e, RAX, decoded_op->x);
+        load_v(e, RCX, decoded_op->y);
+        alu(e, ALU_XOR, RDX, RDX);
+        alu(e, ALU_CMP, minuend, subtrahend);
+        emit8(e, 0x0F); // seta dl (NOT borrow)
+        emit8(e, 0x97);
+        emit_modrm(e, 3, 0, RDX);
+        alu(e, ALU_SUB, minuend, subtrahend);
+        store_v(e, decoded_op->x, minuend);
+        store_v(e, 0xF, RDX);
+        return 0;
+    }
+    case SHIFT_RIGHT:
+        load_v(e, RAX, decoded_op->x);
+        mov_reg(e, RDX, RAX);
+        emit8(e, 0x83); // and edx, 1 (LSB was set)
+        emit_modrm(e, 3, 4, RDX);
+        emit8(e, 1);
+        emit8(e, 0xD1); // shr eax, 1
+        emit_modrm(e, 3, 5, RAX);
+        store_v(e, decoded_op->x, RAX);
+        store_v(e, 0xF, RDX);
+        return 0;
+    case SHIFT_LEFT:
+        load_v(e, RAX, decoded_op->x);
+        mov_reg(e, RDX, RAX);
+        emit8(e, 0xC1); // shr edx, 7 (MSB was set)
+        emit_modrm(e, 3, 5, RDX);
+        emit8(e, 7);
+        emit8(e, 0xD1); // shl eax, 1
+        emit_modrm(e, 3, 4, RAX);
+        store_v(e, decoded_op->x, RAX);
+        store_v(e, 0xF, RDX);
+        return 0;
+    case GET_DELAY:
+        load_byte(e, RAX, OFFSET_DELAY);
+        store_v(e, decoded_op->x, RAX);
+        return 0;
+    case SET_DELAY:
+    case SET_AUDIO:
+        load_v(e, RAX, decoded_op->x);
+        store_byte(e, RAX, (decoded_op->type == SET_DELAY) ? OFFSET_DELAY : OFFSET_AUDIO);
+        return 0;
+    case ADVANCE_I:
+        load_v(e, RAX, decoded_op->x);
+        load_word(e, RCX, OFFSET_I);
+        alu(e, ALU_ADD, RCX, RAX);
+        store_word(e, RCX, OFFSET_I);
+        return 0;
+    case SET_I_HEX_SPRITE:
+        load_v(e, RAX, decoded_op->x);
+        emit8(e, 0x8D); // lea ecx, [rax + rax * 4]
+        emit8(e, 0x0C);
+        emit8(e, 0x80);
+        emit8(e, 0x81); // add ecx, DIGIT_SPRITES_OFFSET
+        emit_modrm(e, 3, 0, RCX);
+        emit32(e, DIGIT_SPRITES_OFFSET);
+        store_word(e, RCX, OFFSET_I);
+        return 0;
+    case NOOP:
+    case UNDECODED:
+        return 0;
+    case BCD:
+    case REG_DUMP:
+        // These write to memory that may hold this or other blocks. Once the block returns, the blocks
+        // holding the written memory are discarded
+        emit_execute(e, jit, decoded_op, next);
+        emit8(e, 0x48); // mov rax, &jit->written
+        emit8(e, 0xB8);
+        emit64(e, (uint64_t)(uintptr_t)&jit->written);
+        emit8(e, 0x48); // mov rcx, decoded_op
+        emit8(e, 0xB9);
+        emit64(e, (uint64_t)(uintptr_t)decoded_op);
+        emit8(e, 0x48); // mov [rax], rcx
+        emit8(e, 0x89);
+        emit_modrm(e, 0, RCX, RAX);
+        return 1;
+    case CALL:
+    case RET:
+    case BNNN:
+    case SKIP_IF_KEY:
+    case SKIP_IF_NKEY:
+        emit_execute(e, jit, decoded_op, next);
+        return 1;
+    default:
+        emit_execute(e, jit, decoded_op, next);
+        return 0;
+    }
+}
+
+/**
+ * Counts the uses of each V register by the given operation
+ */
+static void count_uses(op *decoded_op, uint16_t uses[REGISTER_COUNT])
+{
+    switch (decoded_op->type)
+    {
+    case IF_EQ_REG:
+    case SKIP_NEQ:
+    case SET_REG_BY_REG:
+    case OR:
+    case AND:
+    case XOR:
+        uses[decoded_op->x]++;
+        uses[decoded_op->y]++;
+        break;
+    case ADD_BY_REG:
+    case SUB:
+    case SUBN:
+        uses[decoded_op->y]++;
+        // fall through
+    case SHIFT_RIGHT:
+    case SHIFT_LEFT:
+        uses[decoded_op->x]++;
+        uses[0xF]++;
+        break;
+    case IF_EQ:
+    case IF_NEQ:
+    case SET_REG:
+    case ADD_REG:
+    case GET_DELAY:
+    case SET_DELAY:
+    case SET_AUDIO:
+    case ADVANCE_I:
+    case SET_I_HEX_SPRITE:
+        uses[decoded_op->x]++;
+        break;
+    default:
+        break;
+    }
+}
+
+static void mark_pages(jit *jit, uint16_t start, uint16_t end, int delta)
+{
+    for (uint16_t page = start / 64; page <= (end - 1) / 64 && page < RAM_SIZE / 64; page++)
+        jit->code_pages[page] += delta;
+}
+
+static void compile(jit *jit, uint16_t address)
+{
+    uint8_t *memory = jit->cpu->state.memory;
+    uint16_t uses[REGISTER_COUNT] = {0};
+    uint8_t length = 0;
+    uint16_t end = address;
+    int terminated = 0;
+
+    if (jit->code_used + BLOCK_RESERVE > JIT_CODE_SIZE)
+        jit_flush(jit);
+
+    // Find the extent of the block
+    while (!terminated && length < JIT_MAX_BLOCK && end < RAM_SIZE - 1)
+    {
+        op *decoded_op = &jit->ops[end];
+        decode(&memory[end], decoded_op);
+        count_uses(decoded_op, uses);
+        switch (decoded_op->type)
+        {
+        case JUMP:
+        case CALL:
+        case RET:
+        case BNNN:
+        case IF_EQ:
+        case IF_NEQ:
+        case IF_EQ_REG:
+        case SKIP_NEQ:
+        case SKIP_IF_KEY:
+        case SKIP_IF_NKEY:
+        case BCD:
+        case REG_DUMP:
+            terminated = 1;
+            break;
+        default:
+            break;
+        }
+        length++;
+        end += 2;
+    }
+
+    // Hold the most used V registers in host registers
+    emitter e = {.p = &jit->code[jit->code_used]};
+    memset(e.host, -1, sizeof(e.host));
+    for (size_t i = 0; i < CACHE_COUNT; i++)
+    {
+        int best = -1;
+        for (int x = 0; x < REGISTER_COUNT; x++)
+            if (e.host[x] < 0 && uses[x] > 0 && (best < 0 || uses[x] > uses[best]))
+                best = x;
+        if (best < 0)
+            break;
+        e.host[best] = cache_registers[i];
+    }
+
+    uint8_t *entry = e.p;
+    // Prologue: push rbx, rbp, r12-r15, keeping the stack 16 byte aligned for calls
+    emit8(&e, 0x53);
+    emit8(&e, 0x55);
+    for (uint8_t r = R12; r <= R15; r++)
+    {
+        emit8(&e, 0x41);
+        emit8(&e, 0x50 + (r & 7));
+    }
+    emit8(&e, 0x48); // sub rsp, 8
+    emit8(&e, 0x83);
+    emit_modrm(&e, 3, 5, RSP);
+    emit8(&e, 8);
+    emit8(&e, 0x48); // mov rbx, rdi
+    emit8(&e, 0x89);
+    emit_modrm(&e, 3, RDI, RBX);
+    mov_reg(&e, R15, RSI);
+    // Blocks chain into one another here, as they all share the same stack frame
+    uint8_t *chain_entry = e.p;
+    reload(&e);
+
+    // Body. After every instruction but the last, leave the block if no cycles remain
+    uint8_t *exits[JIT_MAX_BLOCK];
+    uint8_t *epilogue_jumps[3];
+    int epilogue_jump_count = 0;
+    uint16_t address_of_op = address;
+    for (uint8_t i = 0; i < length; i++, address_of_op += 2)
+    {
+        op *decoded_op = &jit->ops[address_of_op];
+        int ends = emit_op(&e, jit, decoded_op, address_of_op);
+        if (i + 1 == length && !ends)
+            store_word_imm(&e, OFFSET_PC, address_of_op + 2);
+
+        emit8(&e, 0x41); // sub r15d, 1
+        emit8(&e, 0x83);
+        emit_modrm(&e, 3, 5, R15);
+        emit8(&e, 1);
+        if (i + 1 < length)
+        {
+            emit8(&e, 0x0F); // jz exit_i
+            emit8(&e, 0x84);
+            exits[i] = e.p;
+            emit32(&e, 0);
+        }
+        else if (decoded_op->type != BCD && decoded_op->type != REG_DUMP)
+        {
+            // With cycles remaining, chain straight into the block at the new PC, if it's been translated
+            emit8(&e, 0x0F); // jz epilogue
+            emit8(&e, 0x84);
+            epilogue_jumps[epilogue_jump_count++] = e.p;
+            emit32(&e, 0);
+            spill(&e);
+            load_word(&e, RAX, OFFSET_PC);
+            emit8(&e, 0x3D); // cmp eax, RAM_SIZE - 1
+            emit32(&e, RAM_SIZE - 1);
+            emit8(&e, 0x0F); // jae epilogue
+            emit8(&e, 0x83);
+            epilogue_jumps[epilogue_jump_count++] = e.p;
+            emit32(&e, 0);
+            emit8(&e, 0x48); // mov rcx, jit->chain
+            emit8(&e, 0xB9);
+            emit64(&e, (uint64_t)(uintptr_t)jit->chain);
+            emit8(&e, 0x48); // mov rax, [rcx + rax * 8]
+            emit8(&e, 0x8B);
+            emit8(&e, 0x04);
+            emit8(&e, 0xC1);
+            emit8(&e, 0x48); // test rax, rax
+            emit8(&e, 0x85);
+            emit_modrm(&e, 3, RAX, RAX);
+            emit8(&e, 0x0F); // jz epilogue
+            emit8(&e, 0x84);
+            epilogue_jumps[epilogue_jump_count++] = e.p;
+            emit32(&e, 0);
+            emit8(&e, 0xFF); // jmp rax
+            emit_modrm(&e, 3, 4, RAX);
+        }
+    }
+
+    // Epilogue, returning the remaining cycles
+    uint8_t *epilogue = e.p;
+    for (int i = 0; i < epilogue_jump_count; i++)
+    {
+        int32_t offset = (int32_t)(epilogue - (epilogue_jumps[i] + 4));
+        memcpy(epilogue_jumps[i], &offset, sizeof(offset));
+    }
+    spill(&e);
+    mov_reg(&e, RAX, R15);
+    emit8(&e, 0x48); // add rsp, 8
+    emit8(&e, 0x83);
+    emit_modrm(&e, 3, 0, RSP);
+    emit8(&e, 8);
+    for (uint8_t r = R15; r >= R12; r--)
+    {
+        emit8(&e, 0x41);
+        emit8(&e, 0x58 + (r & 7));
+    }
+    emit8(&e, 0x5D);
+    emit8(&e, 0x5B);
+    emit8(&e, 0xC3);
+
+    // Early exits set the PC to the instruction they left before
+    for (uint8_t i = 0; i + 1 < length; i++)
+    {
+        int32_t offset = (int32_t)(e.p - (exits[i] + 4));
+        memcpy(exits[i], &offset, sizeof(offset));
+        store_word_imm(&e, OFFSET_PC, address + (i + 1) * 2);
+        emit8(&e, 0xE9); // jmp epilogue
+        emit32(&e, (uint32_t)(int32_t)(epilogue - (e.p + 4)));
+    }
+
+    jit->code_used = e.p - jit->code;
+    jit->blocks[address] = (jit_block){
+        .code = (jit_code)(uintptr_t)entry,
+        .end = end,
+        .length = length,
+    };
+    jit->chain[address] = chain_entry;
+    mark_pages(jit, address, end, 1);
+}
+
+/**
+ * Discards every block holding any of the given memory
+ */
+static void invalidate(jit *jit, uint16_t address, uint16_t length)
+{
+    uint32_t last = (uint32_t)address + length - 1;
+    int holds_code = 0;
+    for (uint32_t page = address / 64; page <= last / 64 && page < RAM_SIZE / 64; page++)
+        holds_code |= (jit->code_pages[page] != 0);
+    if (!holds_code)
+        return;
+
+    for (uint32_t start = 0; start < RAM_SIZE; start++)
+    {
+        jit_block *block = &jit->blocks[start];
+        if (block->code != NULL && start <= last && block->end > address)
+        {
+            mark_pages(jit, start, block->end, -1);
+            block->code = NULL;
+            jit->chain[start] = NULL;
+        }
+    }
+}
+
+/**
+ * Discards the blocks the given operation, having just been run, wrote over
+ */
+static void after_write(jit *jit, op *decoded_op)
+{
+    jit->written = NULL;
+    state *state = &jit->cpu->state;
+    if (decoded_op->type == BCD)
+        invalidate(jit, state->I, 3);
+    else if (decoded_op->type == REG_DUMP)
+        invalidate(jit, state->I, decoded_op->x + 1);
+}
+
+int jit_init(jit *jit, chip8 *cpu)
+{
+    memset(jit, 0, sizeof(*jit));
+    jit->cpu = cpu;
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        jit->code = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Runs the given number of cycles without ticking the timers
+ */
+static void run(void *user, uint32_t cycles)
+{
+    jit *jit = user;
+    state *state = &jit->cpu->state;
+    uint8_t instruction[2];
+    op decoded_op;
+
+    while (cycles > 0)
+    {
+        if (state->PC < RAM_SIZE - 1)
+        {
+            jit_block *block = &jit->blocks[state->PC];
+            if (block->code == NULL)
+                compile(jit, state->PC);
+
+            uint32_t remaining = block->code(state, cycles);
+            jit->compiled_steps += cycles - remaining;
+            if (jit->written != NULL)
+                after_write(jit, jit->written);
+            cycles = remaining;
+            continue;
+        }
+
+        // Instructions at the very end of memory are left to the interpreter
+        fetch(state, instruction);
+        decode(instruction, &decoded_op);
+        execute(&decoded_op, state, jit->cpu->peripherals);
+        after_write(jit, &decoded_op);
+        jit->interpreted_steps++;
+        cycles--;
+    }
+}
+
+void jit_flush(jit *jit)
+{
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    memset(jit->chain, 0, sizeof(jit->chain));
+    memset(jit->code_pages, 0, sizeof(jit->code_pages));
+    jit->code_used = 0;
+}
+
+void jit_free(jit *jit)
+{
+    if (jit->code != NULL)
+        munmap(jit->code, JIT_CODE_SIZE);
+    jit->code = NULL;
+}
+
+#else
+
+int jit_init(jit *jit, chip8 *cpu)
+{
+    memset(jit, 0, sizeof(*jit));
+    jit->cpu = cpu;
+    return -1;
+}
+
+static void run(void *user, uint32_t cycles)
+{
+    // Unreachable, as jit_init fails on unsupported hosts
+}
+
+void jit_flush(jit *jit)
+{
+}
+
+void jit_free(jit *jit)
+{
+}
+
+#endif
+
+void jit_run_cycles(jit *jit, uint32_t cycles)
+{
+    chip8_run_cycles_with(jit->cpu, cycles, &run, jit);
+}
+
+void jit_run_frame(jit *jit)
+{
+    state *state = &jit->cpu->state;
+    jit_run_cycles(jit, (jit->cpu->cycles_per_frame > state->frame_cycles) ? jit->cpu->cycles_per_frame - state->frame_cycles : 1);
+}
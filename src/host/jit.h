@@ -0,0 +1,158 @@
+/**
+ * @file jit.h
+ * @brief This module is used by host builds to run the CHIP-8 device with a dynamic recompiler
+ *
+ * Starting at the PC, instructions are translated into x86-64 machine code a basic block at a time.
+ * A block ends with the first jump, call, return or skip (or after JIT_MAX_BLOCK instructions), and is
+ * kept in an executable code cache, keyed by its address, to be run again the next time the PC reaches it.
+ * While cycles remain, a block jumps straight into the block at its new PC, rather than returning.
+ *
+ * Within a block, the most used V registers are held in host registers, and arithmetic, loads of I and the
+ * timers are run natively. Every other operation, including those that call the display, random and key
+ * peripherals, is run by a call out to the core's execute.
+ *
+ * Blocks may be left after any instruction, so that the timers are ticked after exactly cycles_per_frame
+ * instructions, just as with the interpreter. Once BCD or REG_DUMP have written to memory that holds a
+ * block, every block holding the written memory is discarded.
+ *
+ * The recompiler requires an x86-64 host using the System V calling convention (Linux, macOS, BSD), and
+ * memory that may be mapped both writable and executable. Elsewhere, jit_init fails and the interpreter
+ * should be used instead.
+ */
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../chip8/chip8.h"
+
+/**
+ * @def JIT_SUPPORTED
+ * @brief Defined when the recompiler is available for this host. Translated code accesses memory directly,
+ *  so it isn't with CHIP8_PAGED_MEMORY, and only implements CHIP-8 and SUPER-CHIP, so it isn't with CHIP8_XO_CHIP
+ */
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__)) && \
+    !defined(CHIP8_PAGED_MEMORY) && !defined(CHIP8_XO_CHIP)
+#define JIT_SUPPORTED
+#endif
+
+/**
+ * @def JIT_CODE_SIZE
+ * @brief The size, in bytes, of the code cache. Once full, every block is discarded
+ */
+#define JIT_CODE_SIZE (1 << 20)
+
+/**
+ * @def JIT_MAX_BLOCK
+ * @brief The most instructions translated into a single block
+ */
+#define JIT_MAX_BLOCK 32
+
+/**
+ * @brief A translated block. It's given the state and the most instructions it may execute, and returns
+ * how many of those remain
+ */
+typedef uint32_t (*jit_code)(state *, uint32_t);
+
+/**
+ * @struct jit_block
+ * @brief A block of the code cache
+ */
+typedef struct jit_block
+{
+    /**
+     * @brief The translated code of the block. NULL if the address hasn't been translated
+     */
+    jit_code code;
+    /**
+     * @brief The address following the last instruction of the block
+     */
+    uint16_t end;
+    /**
+     * @brief The number of instructions in the block
+     */
+    uint8_t length;
+} jit_block;
+
+/**
+ * @struct jit
+ * @brief The recompiler of a single CHIP-8 instance
+ */
+typedef struct jit
+{
+    /**
+     * @brief The instance being run
+     */
+    chip8 *cpu;
+    /**
+     * @brief The executable code cache
+     */
+    uint8_t *code;
+    /**
+     * @brief The number of bytes of the code cache in use
+     */
+    size_t code_used;
+    /**
+     * @brief The block starting at each address of memory
+     */
+    jit_block blocks[RAM_SIZE];
+    /**
+     * @brief Where each translated block may be jumped into from the end of another. NULL if untranslated
+     */
+    void *chain[RAM_SIZE];
+    /**
+     * @brief The decoded instruction at each address of memory, for blocks that call out to execute
+     */
+    op ops[RAM_SIZE];
+    /**
+     * @brief The number of blocks holding memory in each 64 byte page of memory
+     */
+    uint16_t code_pages[RAM_SIZE / 64];
+    /**
+     * @brief The BCD or REG_DUMP last run by a block, whose written memory is yet to be checked for blocks
+     */
+    op *written;
+    /**
+     * @brief The number of instructions run by translated blocks
+     */
+    unsigned long long compiled_steps;
+    /**
+     * @brief The number of instructions run by the interpreter, as they were too near the end of memory to translate
+     */
+    unsigned long long interpreted_steps;
+} jit;
+
+/**
+ * @brief Creates the code cache of a recompiler for the given instance
+ *
+ * @param jit - The recompiler to be initialized
+ * @param cpu - The instance to be run
+ * @returns 0 on success. -1 if the host isn't supported or executable memory couldn't be mapped
+ */
+int jit_init(jit *jit, chip8 *cpu);
+
+/**
+ * @brief Performs the given number of cycles against the recompiler's instance, ticking the timers once every
+ * cycles_per_frame cycles, @see chip8_run_cycles
+ *
+ * @param jit - The recompiler of the instance to run cycles on
+ * @param cycles - The number of instructions to execute
+ */
+void jit_run_cycles(jit *jit, uint32_t cycles);
+
+/**
+ * @brief Runs the recompiler's instance until its timers are next ticked, @see chip8_run_frame
+ */
+void jit_run_frame(jit *jit);
+
+/**
+ * @brief Discards every translated block
+ */
+void jit_flush(jit *jit);
+
+/**
+ * @brief Unmaps the code cache of the given recompiler
+ */
+void jit_free(jit *jit);
+
+#endif
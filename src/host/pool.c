@@ -0,0 +1,239 @@
+/**
+ * @file pool.c
+ * @brief This module implements the multi-threaded instance pool
+ */
+#include "pool.h"
+#include "host_util.h"
+#include <time.h>
+
+/**
+ * A worker's share of the instances, as the half-open range [head, tail), packed into a single word so that
+ * it can be claimed from atomically. The worker takes instances from the head, and thieves from the tail.
+ */
+#define RANGE(head, tail) (((uint64_t)(tail) << 32) | (uint32_t)(head))
+#define RANGE_HEAD(range) ((uint32_t)(range))
+#define RANGE_TAIL(range) ((uint32_t)((range) >> 32))
+
+typedef struct worker
+{
+    _Alignas(POOL_CACHE_LINE) _Atomic uint64_t range;
+    pthread_t thread;
+    pool *pool;
+    struct worker *workers;
+    unsigned int index;
+    unsigned int count;
+    uint32_t frames;
+    unsigned long long instructions;
+    unsigned long steals;
+} worker;
+
+static void count_display(void *user, uint8_t *screen)
+{
+    ((pool_instance *)user)->draw_calls++;
+}
+
+static void count_display_region(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count)
+{
+    ((pool_instance *)user)->draw_calls++;
+}
+
+static void count_buzzer(void *user, uint8_t on)
+{
+    ((pool_instance *)user)->buzzer_calls++;
+}
+
+static uint8_t next_random(void *user)
+{
+    return xorshift_next(&((pool_instance *)user)->rng_state);
+}
+
+static uint8_t no_key_pressed(void *user, uint8_t key)
+{
+    return 0;
+}
+
+static uint8_t first_key(void *user)
+{
+    // There is nobody to wait on
+    return 0;
+}
+
+static size_t align_up(size_t size)
+{
+    return (size + POOL_CACHE_LINE - 1) & ~(size_t)(POOL_CACHE_LINE - 1);
+}
+
+int pool_init(pool *pool, uint32_t count, uint8_t use_decode_cache)
+{
+    size_t instances_size = align_up(count * sizeof(pool_instance));
+    size_t memory_size = align_up((size_t)count * RAM_SIZE);
+    size_t caches_size = use_decode_cache ? align_up((size_t)count * DECODE_CACHE_SIZE * sizeof(op)) : 0;
+
+    pool->slab = aligned_alloc(POOL_CACHE_LINE, instances_size + memory_size + caches_size + POOL_CACHE_LINE);
+    if (pool->slab == NULL)
+        return -1;
+
+    pool->instances = pool->slab;
+    pool->memory = (uint8_t *)pool->slab + instances_size;
+    pool->decode_caches = use_decode_cache ? (op *)(pool->memory + memory_size) : NULL;
+    pool->count = count;
+    return 0;
+}
+
+void pool_load(pool *pool, uint32_t index, uint8_t *program, uint16_t cycles_per_frame, uint32_t seed)
+{
+    pool_instance *instance = &pool->instances[index];
+
+    instance->peripherals = (peripherals){
+        .user = instance,
+        .display = &count_display,
+        .display_region = &count_display_region,
+        .present_mode = PRESENT_IMMEDIATE,
+        .buzzer = &count_buzzer,
+        .random = &next_random,
+        .is_key_pressed = &no_key_pressed,
+        .get_key_pressed = &first_key,
+    };
+    instance->rng_state = xorshift_seed(seed);
+    instance->draw_calls = 0;
+    instance->buzzer_calls = 0;
+
+    op *decode_cache = (pool->decode_caches != NULL) ? &pool->decode_caches[(size_t)index * DECODE_CACHE_SIZE] : NULL;
+    chip8_config config = {&instance->peripherals, &pool->memory[(size_t)index * RAM_SIZE], program,
+                           decode_cache, cycles_per_frame};
+    instance->cpu = chip8_init(&config);
+}
+
+/**
+ * Claims the next instance from the head of the given worker's range
+ */
+static int take(worker *worker, uint32_t *index)
+{
+    uint64_t range = atomic_load(&worker->range);
+    while (RANGE_HEAD(range) < RANGE_TAIL(range))
+    {
+        if (atomic_compare_exchange_weak(&worker->range, &range, RANGE(RANGE_HEAD(range) + 1, RANGE_TAIL(range))))
+        {
+            *index = RANGE_HEAD(range);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Moves half of the remaining instances of another worker onto the given (idle) worker's range
+ */
+static int steal(worker *thief)
+{
+    for (unsigned int i = 1; i < thief->count; i++)
+    {
+        worker *victim = &thief->workers[(thief->index + i) % thief->count];
+        uint64_t range = atomic_load(&victim->range);
+        while (RANGE_HEAD(range) < RANGE_TAIL(range))
+        {
+            uint32_t half = (RANGE_TAIL(range) - RANGE_HEAD(range) + 1) / 2;
+            uint32_t split = RANGE_TAIL(range) - half;
+            if (atomic_compare_exchange_weak(&victim->range, &range, RANGE(RANGE_HEAD(range), split)))
+            {
+                // Nobody takes from an empty range, so it's safe to replace
+                atomic_store(&thief->range, RANGE(split, split + half));
+                thief->steals++;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void *work(void *arg)
+{
+    worker *worker = arg;
+    uint32_t index;
+
+    do
+    {
+        while (take(worker, &index))
+        {
+            chip8 *cpu = &worker->pool->instances[index].cpu;
+            for (uint32_t i = 0; i < worker->frames; i++)
+                chip8_run_frame(cpu);
+            worker->instructions += (unsigned long long)worker->frames * cpu->cycles_per_frame;
+        }
+    } while (steal(worker));
+
+    return NULL;
+}
+
+static double seconds_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int pool_run(pool *pool, unsigned int threads, uint32_t frames, pool_stats *stats)
+{
+    int result = 0;
+    unsigned int started = 1;
+    if (threads == 0)
+        threads = 1;
+
+    worker *workers = aligned_alloc(POOL_CACHE_LINE, threads * sizeof(worker));
+    if (workers == NULL)
+        return -1;
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+        workers[i] = (worker){
+            .pool = pool,
+            .workers = workers,
+            .index = i,
+            .count = threads,
+            .frames = frames,
+        };
+        atomic_init(&workers[i].range, RANGE((uint64_t)pool->count * i / threads,
+                                             (uint64_t)pool->count * (i + 1) / threads));
+    }
+
+    double start = seconds_now();
+    // The calling thread is the first worker
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&workers[started].thread, NULL, &work, &workers[started]) != 0)
+        {
+            // The workers that did start steal the share of those that didn't
+            result = -1;
+            break;
+        }
+    }
+    work(&workers[0]);
+    for (unsigned int i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+    double elapsed = seconds_now() - start;
+
+    if (stats != NULL)
+    {
+        *stats = (pool_stats){.seconds = elapsed};
+        for (unsigned int i = 0; i < threads; i++)
+        {
+            stats->instructions += workers[i].instructions;
+            stats->steals += workers[i].steals;
+        }
+        stats->frames = (unsigned long long)frames * pool->count;
+        stats->instructions_per_second = (elapsed > 0) ? stats->instructions / elapsed : 0;
+    }
+
+    free(workers);
+    return result;
+}
+
+void pool_free(pool *pool)
+{
+    free(pool->slab);
+    pool->slab = NULL;
+    pool->instances = NULL;
+    pool->memory = NULL;
+    pool->decode_caches = NULL;
+    pool->count = 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file pool.h
+ * @brief This module is used by host builds to run many independent CHIP-8 devices in parallel
+ *
+ * Every instance of a pool, along with its 4K of memory (and optionally its decode cache), is allocated
+ * from a single cache-line-aligned slab, so that no two instances share a cache line.
+ * Instances are run on a pool of worker threads. Each worker is given an even share of the instances,
+ * and once it has run out, it steals half of the remaining instances of another worker.
+ *
+ * The instances are headless: their peripherals only count draw and buzzer calls, random bytes are
+ * produced by a per-instance xorshift generator, and no key is ever pressed.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "../chip8/chip8.h"
+
+/**
+ * @def POOL_CACHE_LINE
+ * @brief The alignment, in bytes, of instances and of their memory
+ */
+#define POOL_CACHE_LINE 64
+
+/**
+ * @struct pool_instance
+ * @brief A CHIP-8 device run by a pool, and the context of its peripherals
+ */
+typedef struct pool_instance
+{
+    /**
+     * @brief The device. Its memory points into the pool's slab
+     */
+    _Alignas(POOL_CACHE_LINE) chip8 cpu;
+    /**
+     * @brief The peripherals of the device. Their user context is this instance
+     */
+    peripherals peripherals;
+    /**
+     * @brief The state of the xorshift generator used by the random peripheral
+     */
+    uint32_t rng_state;
+    /**
+     * @brief The number of times the display peripherals have been called
+     */
+    unsigned long draw_calls;
+    /**
+     * @brief The number of times the buzzer peripheral has been called
+     */
+    unsigned long buzzer_calls;
+} pool_instance;
+
+/**
+ * @struct pool_stats
+ * @brief The aggregate results of running a pool
+ */
+typedef struct pool_stats
+{
+    /**
+     * @brief The number of instructions executed by every instance
+     */
+    unsigned long long instructions;
+    /**
+     * @brief The number of frames run by every instance
+     */
+    unsigned long long frames;
+    /**
+     * @brief The wall clock time taken to run the pool
+     */
+    double seconds;
+    /**
+     * @brief The number of instructions executed per second, across all instances
+     */
+    double instructions_per_second;
+    /**
+     * @brief The number of times a worker stole instances from another
+     */
+    unsigned long steals;
+} pool_stats;
+
+/**
+ * @struct pool
+ * @brief A set of CHIP-8 instances that share a single allocation
+ */
+typedef struct pool
+{
+    /**
+     * @brief The slab that instances, memory and decode caches are allocated from
+     */
+    void *slab;
+    /**
+     * @brief The instances of the pool. These are at the start of the slab
+     */
+    pool_instance *instances;
+    /**
+     * @brief The RAM_SIZE bytes of memory of each instance, back to back
+     */
+    uint8_t *memory;
+    /**
+     * @brief The DECODE_CACHE_SIZE operations of decode cache of each instance, back to back. NULL if unused
+     */
+    op *decode_caches;
+    /**
+     * @brief The number of instances in the pool
+     */
+    uint32_t count;
+} pool;
+
+/**
+ * @brief Allocates the slab of a pool of the given number of instances. The instances must be loaded
+ * before the pool is run @see pool_load
+ *
+ * @param pool - The pool to be initialized
+ * @param count - The number of instances
+ * @param use_decode_cache - 1 to give every instance a decode cache. 0 otherwise
+ * @returns 0 on success. -1 if the slab couldn't be allocated
+ */
+int pool_init(pool *pool, uint32_t count, uint8_t use_decode_cache);
+
+/**
+ * @brief Initializes the given instance of the pool with the given program, through chip8_init
+ *
+ * @param pool - The pool holding the instance
+ * @param index - The index of the instance
+ * @param program - The program to be loaded. Must be PROGRAM_SIZE bytes long. With CHIP8_PAGED_MEMORY, it's
+ *  read from as the instance runs, and must outlive the pool
+ * @param cycles_per_frame - The number of instructions executed per frame. CYCLES_PER_FRAME is used if 0
+ * @param seed - The seed of the instance's random peripheral
+ */
+void pool_load(pool *pool, uint32_t index, uint8_t *program, uint16_t cycles_per_frame, uint32_t seed);
+
+/**
+ * @brief Runs every instance of the pool for the given number of frames, across the given number of threads
+ *
+ * @param pool - The pool to be run
+ * @param threads - The number of worker threads, including the calling thread. 1 is used if 0
+ * @param frames - The number of frames run by each instance
+ * @param stats - Written with the aggregate results of the run. May be NULL
+ * @returns 0 on success. -1 if the worker threads couldn't be started
+ */
+int pool_run(pool *pool, unsigned int threads, uint32_t frames, pool_stats *stats);
+
+/**
+ * @brief Frees the slab of the given pool
+ */
+void pool_free(pool *pool);
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * @file pool_runner.c
+ * @brief The entrypoint for running many headless instances of the CHIP-8 device in parallel
+ *
+ * One instance is created for every combination of the given programs and seeds. Every instance is run
+ * for the same number of frames on a pool of worker threads, and the aggregate throughput is reported.
+ * @see pool.h
+ *
+ * Usage: chip8_pool [--threads N] [--frames N] [--cpf N] [--seeds N] [--no-cache] [--hashes] program.ch8...
+ */
+#include <unistd.h>
+#include "pool.h"
+#include "rom.h"
+#include "host_util.h"
+
+/**
+ * @def DEFAULT_FRAMES
+ * @brief The number of frames each instance is run for, unless otherwise given
+ */
+#define DEFAULT_FRAMES 600
+
+int main(int argc, char *argv[])
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t frames = DEFAULT_FRAMES;
+    uint16_t cycles_per_frame = CYCLES_PER_FRAME;
+    uint32_t seeds = 1;
+    uint8_t use_decode_cache = 1;
+    uint8_t print_hashes = 0;
+    int first_program = argc;
+
+    for (int i = 1; i < argc && first_program == argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--cpf") == 0 && i + 1 < argc)
+            cycles_per_frame = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--seeds") == 0 && i + 1 < argc)
+            seeds = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "--no-cache") == 0)
+            use_decode_cache = 0;
+        else if (strcmp(argv[i], "--hashes") == 0)
+            print_hashes = 1;
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        else
+            first_program = i;
+    }
+
+    if (first_program == argc || seeds == 0)
+    {
+        fprintf(stderr, "Usage: %s [--threads N] [--frames N] [--cpf N] [--seeds N] [--no-cache] [--hashes] program.ch8...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (threads < 1)
+        threads = 1;
+
+    // Setup
+    uint32_t program_count = argc - first_program;
+    pool pool;
+    if (pool_init(&pool, program_count * seeds, use_decode_cache) < 0)
+    {
+        fprintf(stderr, "Could not allocate %u instances\n", program_count * seeds);
+        return EXIT_FAILURE;
+    }
+
+    // Each program is kept for as long as the pool, as paged builds read it as they run
+    uint8_t *program_memory = malloc((size_t)program_count * PROGRAM_SIZE);
+    if (program_memory == NULL)
+    {
+        fprintf(stderr, "Could not allocate %u programs\n", program_count);
+        pool_free(&pool);
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < program_count; i++)
+    {
+        uint8_t *program = &program_memory[(size_t)i * PROGRAM_SIZE];
+        if (load_rom(argv[first_program + i], program) < 0)
+        {
+            fprintf(stderr, "Could not load %s\n", argv[first_program + i]);
+            free(program_memory);
+            pool_free(&pool);
+            return EXIT_FAILURE;
+        }
+        for (uint32_t seed = 0; seed < seeds; seed++)
+            pool_load(&pool, i * seeds + seed, program, cycles_per_frame, seed + 1);
+    }
+
+    // Run
+    pool_stats stats;
+    if (pool_run(&pool, threads, frames, &stats) < 0)
+        fprintf(stderr, "Not every worker thread could be started\n");
+
+    // Report
+    if (print_hashes)
+    {
+        for (uint32_t i = 0; i < pool.count; i++)
+            printf("%s seed %u: %016llx\n", argv[first_program + i / seeds], i % seeds + 1,
+                   (unsigned long long)hash_screen(pool.instances[i].cpu.state.screen));
+    }
+    printf("instances: %u\n", pool.count);
+    printf("threads: %ld\n", threads);
+    printf("instructions: %llu\n", stats.instructions);
+    printf("frames: %llu\n", stats.frames);
+    printf("seconds: %.6f\n", stats.seconds);
+    printf("instructions_per_second: %.0f\n", stats.instructions_per_second);
+    printf("steals: %lu\n", stats.steals);
+
+    free(program_memory);
+    pool_free(&pool);
+    return 0;
+}
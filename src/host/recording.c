@@ -0,0 +1,249 @@
+/**
+ * @file recording.c
+ * @brief This module implements recording and replaying the inputs of a CHIP-8 device
+ */
+#include "recording.h"
+
+/**
+ * The size of the header, in bytes: the magic bytes, version, cycles per frame and program hash
+ */
+#define HEADER_SIZE 12
+
+/**
+ * The tags of each event of a recording
+ */
+enum recording_tag
+{
+    /**
+     * A frame, with the same keys held as the last
+     */
+    TAG_FRAME = 1,
+    /**
+     * A frame, followed by the 16 bit mask of the keys held
+     */
+    TAG_FRAME_KEYS,
+    /**
+     * A byte from the random peripheral follows
+     */
+    TAG_RANDOM,
+    /**
+     * A key waited on by GET_KEY follows
+     */
+    TAG_KEY,
+};
+
+/**
+ * Hashes the program with 32 bit FNV-1a
+ */
+static uint32_t hash_program(uint8_t *program)
+{
+    uint32_t hash = 0x811c9dc5UL;
+    for (int i = 0; i < PROGRAM_SIZE; i++)
+    {
+        hash ^= program[i];
+        hash *= 0x01000193UL;
+    }
+    return hash;
+}
+
+/**
+ * Returns the next byte of the replayed recording, if it's of the given tag, moving past both.
+ * Otherwise, the recording has diverged, and 0 is returned
+ */
+static uint8_t replay_byte(recording *recording, uint8_t tag)
+{
+    if (recording->position + 2 > recording->size || recording->data[recording->position] != tag)
+    {
+        recording->diverged = 1;
+        return 0;
+    }
+    uint8_t value = recording->data[recording->position + 1];
+    recording->position += 2;
+    return value;
+}
+
+static uint8_t recorded_random(void *user)
+{
+    recording *recording = user;
+    if (recording->mode == RECORDING_REPLAY)
+        return replay_byte(recording, TAG_RANDOM);
+
+    uint8_t value = recording->inner->random(recording->inner->user);
+    fputc(TAG_RANDOM, recording->file);
+    fputc(value, recording->file);
+    return value;
+}
+
+static uint8_t recorded_is_key_pressed(void *user, uint8_t key)
+{
+    return (((recording *)user)->keys >> (key & 0xF)) & 1;
+}
+
+static uint8_t recorded_get_key_pressed(void *user)
+{
+    recording *recording = user;
+    if (recording->mode == RECORDING_REPLAY)
+        return replay_byte(recording, TAG_KEY);
+
+    uint8_t key = recording->inner->get_key_pressed(recording->inner->user);
+    fputc(TAG_KEY, recording->file);
+    fputc(key, recording->file);
+    return key;
+}
+
+static void passed_display(void *user, uint8_t *screen)
+{
+    peripherals *inner = ((recording *)user)->inner;
+    inner->display(inner->user, screen);
+}
+
+static void passed_display_region(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count)
+{
+    peripherals *inner = ((recording *)user)->inner;
+    inner->display_region(inner->user, rows, first_row, row_count);
+}
+
+static void passed_resolution(void *user, uint8_t hires)
+{
+    peripherals *inner = ((recording *)user)->inner;
+    inner->resolution(inner->user, hires);
+}
+
+static void passed_buzzer(void *user, uint8_t on)
+{
+    peripherals *inner = ((recording *)user)->inner;
+    inner->buzzer(inner->user, on);
+}
+
+/**
+ * Wires the recording's peripherals, passing display, resolution and buzzer calls on to the inner peripherals
+ */
+static void init_peripherals(recording *recording, peripherals *inner)
+{
+    recording->inner = inner;
+    recording->keys = 0;
+    recording->frames = 0;
+    recording->diverged = 0;
+    recording->peripherals = (peripherals){
+        .user = recording,
+        .display = (inner->display != NULL) ? &passed_display : NULL,
+        .display_region = (inner->display_region != NULL) ? &passed_display_region : NULL,
+        .resolution = (inner->resolution != NULL) ? &passed_resolution : NULL,
+        .present_mode = inner->present_mode,
+        .buzzer = (inner->buzzer != NULL) ? &passed_buzzer : NULL,
+        .random = &recorded_random,
+        .is_key_pressed = &recorded_is_key_pressed,
+        .get_key_pressed = &recorded_get_key_pressed,
+    };
+}
+
+int recording_start(recording *recording, const char *file_name, peripherals *live, uint8_t *program, uint16_t cycles_per_frame)
+{
+    recording->mode = RECORDING_RECORD;
+    recording->data = NULL;
+    recording->file = fopen(file_name, "wb");
+    if (recording->file == NULL)
+        return -1;
+    init_peripherals(recording, live);
+
+    uint32_t hash = hash_program(program);
+    uint8_t header[HEADER_SIZE] = {
+        RECORDING_MAGIC[0], RECORDING_MAGIC[1], RECORDING_MAGIC[2], RECORDING_MAGIC[3],
+        RECORDING_VERSION & 0xFF, RECORDING_VERSION >> 8,
+        cycles_per_frame & 0xFF, cycles_per_frame >> 8,
+        hash & 0xFF, (hash >> 8) & 0xFF, (hash >> 16) & 0xFF, hash >> 24,
+    };
+    fwrite(header, 1, sizeof(header), recording->file);
+    return 0;
+}
+
+int replay_start(recording *recording, const char *file_name, peripherals *outputs, uint8_t *program, uint16_t *cycles_per_frame)
+{
+    recording->mode = RECORDING_REPLAY;
+    recording->file = NULL;
+    recording->data = NULL;
+    init_peripherals(recording, outputs);
+
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL)
+        return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    recording->data = (size >= HEADER_SIZE) ? malloc(size) : NULL;
+    if (recording->data == NULL || fread(recording->data, 1, size, file) != (size_t)size)
+    {
+        fclose(file);
+        recording_close(recording);
+        return -1;
+    }
+    fclose(file);
+    recording->size = size;
+    recording->position = HEADER_SIZE;
+
+    uint8_t *header = recording->data;
+    uint32_t hash = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t)header[11] << 24);
+    if (memcmp(header, RECORDING_MAGIC, 4) != 0 || (header[4] | (header[5] << 8)) != RECORDING_VERSION ||
+        hash != hash_program(program))
+    {
+        recording_close(recording);
+        return -1;
+    }
+    *cycles_per_frame = header[6] | (header[7] << 8);
+    return 0;
+}
+
+int recording_frame(recording *recording)
+{
+    if (recording->mode == RECORDING_RECORD)
+    {
+        uint16_t keys = 0;
+        if (recording->inner->is_key_pressed != NULL)
+            for (uint8_t key = 0; key < 16; key++)
+                keys |= (recording->inner->is_key_pressed(recording->inner->user, key) == 1) << key;
+
+        if (keys == recording->keys && recording->frames > 0)
+        {
+            fputc(TAG_FRAME, recording->file);
+        }
+        else
+        {
+            fputc(TAG_FRAME_KEYS, recording->file);
+            fputc(keys & 0xFF, recording->file);
+            fputc(keys >> 8, recording->file);
+        }
+        recording->keys = keys;
+        recording->frames++;
+        return 0;
+    }
+
+    // Inputs recorded during the last frame that weren't asked for are skipped
+    while (recording->position < recording->size && recording->data[recording->position] != TAG_FRAME &&
+           recording->data[recording->position] != TAG_FRAME_KEYS)
+    {
+        recording->diverged = 1;
+        recording->position += 2;
+    }
+    if (recording->position >= recording->size)
+        return -1;
+
+    if (recording->data[recording->position++] == TAG_FRAME_KEYS)
+    {
+        if (recording->position + 2 > recording->size)
+            return -1;
+        recording->keys = recording->data[recording->position] | (recording->data[recording->position + 1] << 8);
+        recording->position += 2;
+    }
+    recording->frames++;
+    return 0;
+}
+
+void recording_close(recording *recording)
+{
+    if (recording->file != NULL)
+        fclose(recording->file);
+    free(recording->data);
+    recording->file = NULL;
+    recording->data = NULL;
+}
@@ -0,0 +1,134 @@
+/**
+ * @file recording.h
+ * @brief This module is used by host builds to record the inputs of a CHIP-8 device, and to replay them
+ *
+ * A device's only inputs are its keys and its random peripheral. While recording, the device is wired to
+ * the recording's peripherals, which pass calls on to the live ones and log their results to a file:
+ * the keys held at the start of every frame, every random byte, and every key waited on by GET_KEY.
+ * Key checks within a frame are all answered from the keys held at its start, so that they're the same
+ * whether recorded or replayed.
+ *
+ * While replaying, the same calls are answered from the file instead, so the device runs exactly as it
+ * did when recorded. Display and buzzer calls are passed on to the given peripherals either way.
+ *
+ * The file starts with RECORDING_MAGIC, the version, the cycles per frame and a hash of the program,
+ * followed by a tag byte for each event: a frame (with the keys, if they changed), a random byte or a key.
+ */
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../chip8/chip8.h"
+
+/**
+ * @def RECORDING_MAGIC
+ * @brief The bytes every recording starts with
+ */
+#define RECORDING_MAGIC "C8RP"
+
+/**
+ * @def RECORDING_VERSION
+ * @brief The version of the recording format. Recordings of any other version are refused
+ */
+#define RECORDING_VERSION 1
+
+/**
+ * @enum recording_mode
+ * @brief Whether a recording is being written or read
+ */
+enum recording_mode
+{
+    RECORDING_RECORD,
+    RECORDING_REPLAY,
+};
+
+/**
+ * @struct recording
+ * @brief A recording of the inputs of a single device
+ */
+typedef struct recording
+{
+    /**
+     * @brief Whether the recording is being written or read
+     */
+    enum recording_mode mode;
+    /**
+     * @brief The peripherals to be wired to the device. Their user context is this recording
+     */
+    peripherals peripherals;
+    /**
+     * @brief The peripherals calls are passed on to. While replaying, only the display and buzzer are used
+     */
+    peripherals *inner;
+    /**
+     * @brief The file being recorded to
+     */
+    FILE *file;
+    /**
+     * @brief The whole of the recording being replayed
+     */
+    uint8_t *data;
+    /**
+     * @brief The size of the recording being replayed in bytes
+     */
+    size_t size;
+    /**
+     * @brief The offset of the next event of the recording being replayed
+     */
+    size_t position;
+    /**
+     * @brief A bitmask of the keys held during the current frame. Bit N is set while key N is held
+     */
+    uint16_t keys;
+    /**
+     * @brief The number of frames recorded or replayed
+     */
+    unsigned long frames;
+    /**
+     * @brief Set if the device asked for an input the recording doesn't have next. It's been run differently
+     * than when it was recorded, e.g. with another build or interpreter
+     */
+    uint8_t diverged;
+} recording;
+
+/**
+ * @brief Starts recording to the given file
+ *
+ * @param recording - The recording to be initialized
+ * @param file_name - The path of the file to be recorded to. It's overwritten
+ * @param live - The peripherals whose inputs are recorded, and that every other call is passed on to
+ * @param program - The program being run. PROGRAM_SIZE bytes long
+ * @param cycles_per_frame - The number of instructions the device runs per frame
+ * @returns 0 on success. -1 if the file couldn't be created
+ */
+int recording_start(recording *recording, const char *file_name, peripherals *live, uint8_t *program, uint16_t cycles_per_frame);
+
+/**
+ * @brief Starts replaying the given file. It's read into memory in full
+ *
+ * @param recording - The recording to be initialized
+ * @param file_name - The path of the recording
+ * @param outputs - The peripherals display and buzzer calls are passed on to
+ * @param program - The program being run. PROGRAM_SIZE bytes long
+ * @param cycles_per_frame - Set to the number of instructions per frame the recording was made with
+ * @returns 0 on success. -1 if the file couldn't be read, isn't a recording of this version, or is of
+ *  another program
+ */
+int replay_start(recording *recording, const char *file_name, peripherals *outputs, uint8_t *program, uint16_t *cycles_per_frame);
+
+/**
+ * @brief Marks the start of a frame. Should be called before each frame is run.
+ * While recording, the keys held are sampled. While replaying, the keys held are read
+ *
+ * @param recording - The recording in progress
+ * @returns 0 on success. -1 if the replayed recording has no more frames
+ */
+int recording_frame(recording *recording);
+
+/**
+ * @brief Finishes the recording, flushing it to its file, or frees the replayed recording
+ */
+void recording_close(recording *recording);
+
+#endif
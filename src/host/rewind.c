@@ -0,0 +1,201 @@
+/**
+ * @file rewind.c
+ * @brief This module implements stepping a CHIP-8 device backwards through the frames it has run
+ */
+#include "rewind.h"
+
+/**
+ * The fewest unchanged bytes that end a literal run of the encoding. Shorter gaps are cheaper to
+ * include in the literal than to start another run for
+ */
+#define MIN_ZERO_RUN 4
+
+int rewind_init(rewind_buffer *rewind, size_t capacity, uint32_t max_frames)
+{
+    rewind->capacity = (capacity > 0) ? capacity : REWIND_BUFFER_SIZE;
+    rewind->max_frames = (max_frames > 0) ? max_frames : REWIND_SECONDS * TIMER_HZ;
+    rewind->tail = 0;
+    rewind->used = 0;
+    rewind->count = 0;
+    rewind->captured = 0;
+    rewind->data = malloc(rewind->capacity);
+    return (rewind->data != NULL) ? 0 : -1;
+}
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = value >> 8;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/**
+ * Returns the index of the first byte, from the given index, at which the two buffers differ
+ */
+static size_t skip_unchanged(const uint8_t *before, const uint8_t *after, size_t i, size_t size)
+{
+    uint64_t a, b;
+    for (; i + sizeof(a) <= size; i += sizeof(a))
+    {
+        memcpy(&a, &before[i], sizeof(a));
+        memcpy(&b, &after[i], sizeof(b));
+        if (a != b)
+            break;
+    }
+    while (i < size && before[i] == after[i])
+        i++;
+    return i;
+}
+
+/**
+ * Encodes the XOR of the two snapshots as runs of unchanged bytes, each followed by a literal run of
+ * XOR'd bytes. Each pair of runs is written as the two lengths, then the literal bytes. Runs too long for
+ * a 16-bit length are split, so a long unchanged run becomes several pairs with empty literals. Returns
+ * the size of the encoding
+ */
+static size_t encode(const uint8_t *before, const uint8_t *after, uint8_t *out)
+{
+    size_t size = 0;
+    size_t i = 0;
+
+    while (i < SNAPSHOT_SIZE)
+    {
+        size_t zero_start = i;
+        i = skip_unchanged(before, after, i, SNAPSHOT_SIZE);
+        if (i == SNAPSHOT_SIZE)
+            break;
+
+        size_t literal_start = i;
+        while (i < SNAPSHOT_SIZE && i - literal_start < UINT16_MAX - MIN_ZERO_RUN)
+        {
+            size_t unchanged = skip_unchanged(before, after, i, SNAPSHOT_SIZE) - i;
+            if (unchanged >= MIN_ZERO_RUN || i + unchanged == SNAPSHOT_SIZE)
+                break;
+            // Only changed bytes, or too few unchanged ones to be worth a run of their own
+            i += (unchanged > 0) ? unchanged : 1;
+        }
+
+        size_t zero_run = literal_start - zero_start;
+        for (; zero_run > UINT16_MAX; zero_run -= UINT16_MAX)
+        {
+            put16(&out[size], UINT16_MAX);
+            put16(&out[size + 2], 0);
+            size += 4;
+        }
+        put16(&out[size], zero_run);
+        put16(&out[size + 2], i - literal_start);
+        size += 4;
+        for (size_t j = literal_start; j < i; j++)
+            out[size++] = before[j] ^ after[j];
+    }
+    return size;
+}
+
+/**
+ * XORs an encoding into the given snapshot
+ */
+static void apply(uint8_t *snapshot, const uint8_t *encoded, size_t size)
+{
+    size_t i = 0;
+    for (size_t p = 0; p < size;)
+    {
+        i += get16(&encoded[p]);
+        uint16_t literal = get16(&encoded[p + 2]);
+        p += 4;
+        for (uint16_t j = 0; j < literal; j++)
+            snapshot[i++] ^= encoded[p++];
+    }
+}
+
+static void ring_write(rewind_buffer *rewind, size_t offset, const uint8_t *src, size_t size)
+{
+    size_t first = rewind->capacity - offset;
+    if (first > size)
+        first = size;
+    memcpy(&rewind->data[offset], src, first);
+    memcpy(rewind->data, &src[first], size - first);
+}
+
+static void ring_read(rewind_buffer *rewind, size_t offset, uint8_t *dst, size_t size)
+{
+    size_t first = rewind->capacity - offset;
+    if (first > size)
+        first = size;
+    memcpy(dst, &rewind->data[offset], first);
+    memcpy(&dst[first], rewind->data, size - first);
+}
+
+/**
+ * Forgets the oldest difference
+ */
+static void drop_oldest(rewind_buffer *rewind)
+{
+    uint8_t length[2];
+    ring_read(rewind, rewind->tail, length, sizeof(length));
+    size_t entry = get16(length) + 4;
+    rewind->tail = (rewind->tail + entry) % rewind->capacity;
+    rewind->used -= entry;
+    rewind->count--;
+}
+
+void rewind_capture(rewind_buffer *rewind, chip8 *cpu)
+{
+    chip8_snapshot_into(cpu, rewind->next, SNAPSHOT_SIZE);
+    if (!rewind->captured)
+    {
+        memcpy(rewind->current, rewind->next, SNAPSHOT_SIZE);
+        rewind->captured = 1;
+        return;
+    }
+
+    size_t size = encode(rewind->current, rewind->next, rewind->encoded);
+    size_t entry = size + 4;
+    memcpy(rewind->current, rewind->next, SNAPSHOT_SIZE);
+
+    if (entry > rewind->capacity || size > UINT16_MAX)
+    {
+        // Too big to keep at all. The frames before it can no longer be reached
+        rewind->tail = rewind->used = rewind->count = 0;
+        return;
+    }
+    while (rewind->count > 0 && (rewind->count >= rewind->max_frames || rewind->capacity - rewind->used < entry))
+        drop_oldest(rewind);
+
+    uint8_t length[2];
+    put16(length, size);
+    size_t head = (rewind->tail + rewind->used) % rewind->capacity;
+    ring_write(rewind, head, length, sizeof(length));
+    ring_write(rewind, (head + 2) % rewind->capacity, rewind->encoded, size);
+    ring_write(rewind, (head + 2 + size) % rewind->capacity, length, sizeof(length));
+    rewind->used += entry;
+    rewind->count++;
+}
+
+int rewind_step_back(rewind_buffer *rewind, chip8 *cpu)
+{
+    if (rewind->count == 0)
+        return -1;
+
+    // The newest difference ends at the head, with its length
+    size_t head = (rewind->tail + rewind->used) % rewind->capacity;
+    uint8_t length[2];
+    ring_read(rewind, (head + rewind->capacity - 2) % rewind->capacity, length, sizeof(length));
+    size_t size = get16(length);
+    size_t entry = size + 4;
+    ring_read(rewind, (head + rewind->capacity - entry + 2) % rewind->capacity, rewind->encoded, size);
+
+    apply(rewind->current, rewind->encoded, size);
+    rewind->used -= entry;
+    rewind->count--;
+    return chip8_restore(cpu, rewind->current, SNAPSHOT_SIZE);
+}
+
+void rewind_free(rewind_buffer *rewind)
+{
+    free(rewind->data);
+    rewind->data = NULL;
+}
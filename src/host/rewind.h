@@ -0,0 +1,114 @@
+/**
+ * @file rewind.h
+ * @brief This module is used by host builds to step a CHIP-8 device backwards, a frame at a time
+ *
+ * The state of the device is captured once per frame as a snapshot, @see snapshot.h. Rather than each
+ * snapshot being kept whole, only the difference from the one before it is: the two are XOR'd together,
+ * and the runs of zeros (the bytes that didn't change, which is nearly all of memory) are run-length encoded.
+ *
+ * The encoded differences are kept, newest last, in a fixed-size ring buffer of bytes. Once it's full, or
+ * holds max_frames of them, the oldest are dropped. Only the latest snapshot is kept whole. Stepping back
+ * XORs it with the newest difference, giving the snapshot of the frame before, which the device is restored to.
+ */
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../chip8/chip8.h"
+#include "../chip8/snapshot.h"
+
+/**
+ * @def REWIND_SECONDS
+ * @brief The number of seconds of frames kept by default
+ */
+#define REWIND_SECONDS 60
+
+/**
+ * @def REWIND_BUFFER_SIZE
+ * @brief The default size, in bytes, of the ring buffer of differences
+ */
+#define REWIND_BUFFER_SIZE (256 * 1024)
+
+/**
+ * @struct rewind_buffer
+ * @brief The frames a device may be stepped back through
+ */
+typedef struct rewind_buffer
+{
+    /**
+     * @brief The ring buffer of encoded differences. Each is stored as its length, its encoding, and its
+     * length again, so that the buffer may be walked from either end
+     */
+    uint8_t *data;
+    /**
+     * @brief The size of the ring buffer in bytes
+     */
+    size_t capacity;
+    /**
+     * @brief The offset of the oldest difference in the ring buffer
+     */
+    size_t tail;
+    /**
+     * @brief The number of bytes of the ring buffer in use
+     */
+    size_t used;
+    /**
+     * @brief The number of differences held, and so the number of frames that may be stepped back
+     */
+    uint32_t count;
+    /**
+     * @brief The most differences that are held
+     */
+    uint32_t max_frames;
+    /**
+     * @brief Whether a snapshot has been captured yet
+     */
+    uint8_t captured;
+    /**
+     * @brief The latest snapshot
+     */
+    uint8_t current[SNAPSHOT_SIZE];
+    /**
+     * @brief Space for the snapshot being captured
+     */
+    uint8_t next[SNAPSHOT_SIZE];
+    /**
+     * @brief Space for the difference being encoded or decoded. Large enough for the worst case encoding
+     */
+    uint8_t encoded[SNAPSHOT_SIZE * 2];
+} rewind_buffer;
+
+/**
+ * @brief Allocates the ring buffer of the given rewind buffer
+ *
+ * @param rewind - The rewind buffer to be initialized
+ * @param capacity - The size of the ring buffer in bytes. REWIND_BUFFER_SIZE is used if 0
+ * @param max_frames - The most frames that may be stepped back. REWIND_SECONDS worth of frames are used if 0
+ * @returns 0 on success. -1 if the ring buffer couldn't be allocated
+ */
+int rewind_init(rewind_buffer *rewind, size_t capacity, uint32_t max_frames);
+
+/**
+ * @brief Captures the state of the given device. Should be called once per frame
+ *
+ * @param rewind - The rewind buffer to capture to
+ * @param cpu - The device to be captured
+ */
+void rewind_capture(rewind_buffer *rewind, chip8 *cpu);
+
+/**
+ * @brief Restores the given device to the state captured before the latest one, and forgets the latest
+ *
+ * @param rewind - The rewind buffer to step back through
+ * @param cpu - The device to be restored
+ * @returns 0 on success. -1 if there's nothing earlier to step back to
+ */
+int rewind_step_back(rewind_buffer *rewind, chip8 *cpu);
+
+/**
+ * @brief Frees the ring buffer of the given rewind buffer
+ */
+void rewind_free(rewind_buffer *rewind);
+
+#endif
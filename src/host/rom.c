@@ -0,0 +1,68 @@
+/**
+ * @file rom.c
+ * @brief This module implements program loading for host builds
+ */
+#include "rom.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int rom_map(rom_image *rom, const char *file_name)
+{
+    struct stat info;
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || info.st_size > PROGRAM_SIZE)
+    {
+        close(fd);
+        return -1;
+    }
+
+    rom->size = info.st_size;
+    rom->data = NULL;
+    // Empty files can't be mapped, but are still (empty) programs
+    if (rom->size > 0)
+    {
+        void *mapping = mmap(NULL, rom->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        rom->data = mapping;
+    }
+
+    // The mapping outlives the descriptor
+    close(fd);
+    return 0;
+}
+
+void rom_unmap(rom_image *rom)
+{
+    if (rom->data != NULL)
+        munmap((void *)rom->data, rom->size);
+    rom->data = NULL;
+    rom->size = 0;
+}
+
+void rom_golden_image(const rom_image *rom, uint8_t *golden)
+{
+    init_golden_image(golden, rom->data, rom->size);
+}
+
+long load_rom(const char *file_name, uint8_t *program)
+{
+    rom_image rom;
+    if (rom_map(&rom, file_name) < 0)
+        return -1;
+
+    long size = rom.size;
+    if (size > 0)
+        memcpy(program, rom.data, size);
+    memset(&program[size], 0, PROGRAM_SIZE - size);
+    rom_unmap(&rom);
+    return size;
+}
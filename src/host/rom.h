@@ -0,0 +1,62 @@
+/**
+ * @file rom.h
+ * @brief This module is used by host (desktop/server) builds of the CHIP-8 device, regardless of frontend.
+ *  It is used to load program files from disk
+ */
+#ifndef ROM_H
+#define ROM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../chip8/chip8.h"
+
+/**
+ * @struct rom_image
+ * @brief A program file mapped into memory, read-only
+ */
+typedef struct rom_image
+{
+    /**
+     * @brief The bytes of the program. NULL if the file is empty
+     */
+    const uint8_t *data;
+    /**
+     * @brief The size of the program in bytes. At most PROGRAM_SIZE
+     */
+    size_t size;
+} rom_image;
+
+/**
+ * @brief Maps the given program file into memory, without reading it up front. The file must fit in PROGRAM_SIZE
+ *
+ * @param rom - Written with the mapping
+ * @param file_name - The path of the program file to be mapped
+ * @returns 0 on success. -1 if the file couldn't be opened or mapped, or is larger than PROGRAM_SIZE
+ */
+int rom_map(rom_image *rom, const char *file_name);
+
+/**
+ * @brief Unmaps the given program file
+ */
+void rom_unmap(rom_image *rom);
+
+/**
+ * @brief Writes the golden image of a device's memory once initialized with the given program.
+ * Devices that run the program may be reset to it @see chip8_reset
+ *
+ * @param rom - The mapped program
+ * @param golden - The RAM_SIZE bytes of the image to be written
+ */
+void rom_golden_image(const rom_image *rom, uint8_t *golden);
+
+/**
+ * @brief Reads the given program file into the given program memory. Any memory following the
+ * program is zeroed
+ *
+ * @param file_name - The path of the program file to be read from
+ * @param program - The program memory to be written to. Must be PROGRAM_SIZE bytes long
+ * @returns The size of the program in bytes. -1 if the file couldn't be read or doesn't fit in PROGRAM_SIZE
+ */
+long load_rom(const char *file_name, uint8_t *program);
+
+#endif
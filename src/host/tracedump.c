@@ -0,0 +1,85 @@
+/**
+ * @file tracedump.c
+ * @brief The entrypoint for the decoder of flushed CHIP-8 traces
+ *
+ * Reads the blocks flushed from a trace buffer, as captured from the Arduino's serial port or written by
+ * chip8_headless --trace, and prints each traced instruction, oldest first. The trace level of each block
+ * is read from its header, so the decoder needn't be built with the same level as whatever was traced.
+ * @see trace.h for the format
+ *
+ * Usage: chip8_tracedump trace.bin
+ */
+#include "../chip8/chip8.h"
+#include "../chip8/trace.h"
+
+const char *reason_names[] = {
+    [TRACE_REQUESTED] = "requested",
+    [TRACE_STACK_OVERFLOW] = "stack overflow",
+    [TRACE_STACK_UNDERFLOW] = "stack underflow",
+    [TRACE_INVALID_OP] = "invalid instruction",
+};
+
+/**
+ * @brief Prints a single traced instruction of the given size
+ */
+void print_entry(const uint8_t *entry, uint8_t entry_size)
+{
+    op decoded_op;
+    uint8_t instruction[2] = {entry[2], entry[3]};
+    decode(instruction, &decoded_op);
+
+    printf("0x%03X  %02X%02X  %-16s", entry[0] | (entry[1] << 8), entry[2], entry[3], op_type_names[decoded_op.type]);
+    if (entry_size >= 8)
+        printf("  V[%X]=%02X  V[F]=%02X  I=0x%03X", decoded_op.x, entry[4], entry[5], entry[6] | (entry[7] << 8));
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace.bin\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    uint8_t header[TRACE_HEADER_SIZE];
+    uint8_t entry[UINT8_MAX];
+    int blocks = 0;
+    while (fread(header, 1, sizeof(header), file) == sizeof(header))
+    {
+        uint8_t entry_size = header[5];
+        uint8_t reason = header[6];
+        uint16_t count = header[8] | (header[9] << 8);
+        if (memcmp(header, TRACE_MAGIC, 4) != 0 || entry_size < 4)
+        {
+            fprintf(stderr, "%s: block %d isn't a trace\n", argv[1], blocks);
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+
+        printf("block %d: level %u, %u instructions, flushed on %s%s\n", blocks, header[4], count,
+               (reason < sizeof(reason_names) / sizeof(*reason_names)) ? reason_names[reason] : "unknown",
+               header[7] ? " (earlier instructions were overwritten)" : "");
+        for (uint16_t i = 0; i < count; i++)
+        {
+            if (fread(entry, 1, entry_size, file) != entry_size)
+            {
+                fprintf(stderr, "%s: block %d is cut short\n", argv[1], blocks);
+                fclose(file);
+                return EXIT_FAILURE;
+            }
+            print_entry(entry, entry_size);
+        }
+        blocks++;
+    }
+
+    fclose(file);
+    return 0;
+}
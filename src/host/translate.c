@@ -0,0 +1,437 @@
+/**
+ * @file translate.c
+ * @brief This module implements the ahead-of-time translator of CHIP-8 programs into C
+ */
+#include "translate.h"
+
+/**
+ * Whether a whole instruction at the given address is within the program
+ */
+static int in_program(translation *t, uint32_t address)
+{
+    return address >= PROGRAM_OFFSET && address + 1 < (uint32_t)PROGRAM_OFFSET + t->size;
+}
+
+/**
+ * Whether the given operation ends a block. Those that write to memory end one, so that the runtime may
+ * fall back to the interpreter straight away if they wrote over translated code
+ */
+static int ends_block(enum op_type type)
+{
+    switch (type)
+    {
+    case RET:
+    case JUMP:
+    case CALL:
+    case IF_EQ:
+    case IF_NEQ:
+    case IF_EQ_REG:
+    case SKIP_NEQ:
+    case BNNN:
+    case SKIP_IF_KEY:
+    case SKIP_IF_NKEY:
+    case BCD:
+    case REG_DUMP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void add_leader(translation *t, uint16_t *worklist, int *pending, uint32_t address)
+{
+    if (address >= RAM_SIZE || t->leader[address])
+        return;
+    t->leader[address] = 1;
+    worklist[(*pending)++] = address;
+}
+
+void translate_walk(translation *t)
+{
+    // Each address is added as a leader at most once
+    static uint16_t worklist[RAM_SIZE];
+    int pending = 0;
+    add_leader(t, worklist, &pending, PROGRAM_OFFSET);
+
+    while (pending > 0)
+    {
+        uint16_t address = worklist[--pending];
+        for (; in_program(t, address); address += 2)
+        {
+            if (t->reached[address])
+            {
+                // Joined code that's already been walked, which now has to start a block of its own
+                t->leader[address] = 1;
+                break;
+            }
+
+            op *decoded_op = &t->ops[address];
+            t->reached[address] = 1;
+            decode(&t->memory[address], decoded_op);
+
+            switch (decoded_op->type)
+            {
+            case JUMP:
+                add_leader(t, worklist, &pending, decoded_op->nnn);
+                break;
+            case CALL:
+                add_leader(t, worklist, &pending, decoded_op->nnn);
+                add_leader(t, worklist, &pending, address + 2);
+                break;
+            case IF_EQ:
+            case IF_NEQ:
+            case IF_EQ_REG:
+            case SKIP_NEQ:
+            case SKIP_IF_KEY:
+            case SKIP_IF_NKEY:
+                add_leader(t, worklist, &pending, address + 2);
+                add_leader(t, worklist, &pending, address + 4);
+                break;
+            case BCD:
+            case REG_DUMP:
+                add_leader(t, worklist, &pending, address + 2);
+                break;
+            default:
+                break;
+            }
+            if (ends_block(decoded_op->type))
+                break;
+        }
+    }
+}
+
+/**
+ * Whether the given address is the start of a translated block
+ */
+static int is_block(translation *t, uint32_t address)
+{
+    return address < RAM_SIZE && t->leader[address] && t->reached[address];
+}
+
+/**
+ * The indentation of the statements of a block
+ */
+#define INDENT "            "
+
+/**
+ * Emits a count of one more instruction run, leaving with the PC at the given address if none remain
+ */
+static void emit_count(FILE *out, const char *indent, uint16_t next)
+{
+    fprintf(out, "%sif (--cycles == 0) { s->PC = 0x%03X; return 0; }\n", indent, next);
+}
+
+/**
+ * Emits a count of one more instruction run, then carries on at the given address
+ */
+static void emit_branch(FILE *out, const char *indent, translation *t, uint16_t target)
+{
+    emit_count(out, indent, target);
+    if (is_block(t, target))
+    {
+        fprintf(out, "%sgoto block_%03X;\n", indent, target);
+    }
+    else
+    {
+        fprintf(out, "%ss->PC = 0x%03X;\n", indent, target);
+        fprintf(out, "%sbreak;\n", indent);
+    }
+}
+
+/**
+ * Emits a skip, whose condition is given as C
+ */
+static void emit_skip(FILE *out, translation *t, uint16_t address, const char *condition)
+{
+    fprintf(out, INDENT "if (%s)\n" INDENT "{\n", condition);
+    emit_branch(out, INDENT "    ", t, address + 4);
+    fprintf(out, INDENT "}\n");
+    emit_branch(out, INDENT, t, address + 2);
+}
+
+/**
+ * Emits the given operation. Those that end the block emit their own count and branch
+ */
+static void emit_op(FILE *out, translation *t, uint16_t address)
+{
+    op *o = &t->ops[address];
+    char condition[64];
+
+    fprintf(out, "            // 0x%03X: %02X%02X\n", address, t->memory[address], t->memory[address + 1]);
+    switch (o->type)
+    {
+    case CLEAR_DISPLAY:
+    case DRAW_SPRITE:
+    case SCROLL_DOWN:
+    case SCROLL_RIGHT:
+    case SCROLL_LEFT:
+    case LORES:
+    case HIRES:
+        // Left to the core, which knows when to present the screen
+        fprintf(out, "            execute(&(op){%s, 0x%X, 0x%X, 0x%03X, 0x%02X, 0x%X}, s, p);\n",
+                op_type_names[o->type], o->x, o->y, o->nnn, o->nn, o->n);
+        break;
+    case RET:
+        fprintf(out, "            s->SP -= (s->SP > 0) ? 1 : 0;\n");
+        fprintf(out, "            s->PC = s->stack[s->SP];\n");
+        fprintf(out, "            if (--cycles == 0) return 0;\n");
+        fprintf(out, "            break;\n");
+        break;
+    case JUMP:
+        emit_branch(out, INDENT, t, o->nnn);
+        break;
+    case CALL:
+        fprintf(out, "            s->stack[s->SP] = 0x%03X;\n", address + 2);
+        fprintf(out, "            s->SP += (s->SP < 15) ? 1 : 0;\n");
+        emit_branch(out, INDENT, t, o->nnn);
+        break;
+    case SET_REG:
+        fprintf(out, "            V[0x%X] = 0x%02X;\n", o->x, o->nn);
+        break;
+    case ADD_REG:
+        fprintf(out, "            V[0x%X] += 0x%02X;\n", o->x, o->nn);
+        break;
+    case SET_I_REG:
+        fprintf(out, "            s->I = 0x%03X;\n", o->nnn);
+        break;
+    case IF_EQ:
+    case IF_NEQ:
+        snprintf(condition, sizeof(condition), "V[0x%X] %s 0x%02X", o->x, (o->type == IF_EQ) ? "==" : "!=", o->nn);
+        emit_skip(out, t, address, condition);
+        break;
+    case IF_EQ_REG:
+    case SKIP_NEQ:
+        snprintf(condition, sizeof(condition), "V[0x%X] %s V[0x%X]", o->x, (o->type == IF_EQ_REG) ? "==" : "!=", o->y);
+        emit_skip(out, t, address, condition);
+        break;
+    case SET_REG_BY_REG:
+        fprintf(out, "            V[0x%X] = V[0x%X];\n", o->x, o->y);
+        break;
+    case OR:
+        fprintf(out, "            V[0x%X] |= V[0x%X];\n", o->x, o->y);
+        break;
+    case AND:
+        fprintf(out, "            V[0x%X] &= V[0x%X];\n", o->x, o->y);
+        break;
+    case XOR:
+        fprintf(out, "            V[0x%X] ^= V[0x%X];\n", o->x, o->y);
+        break;
+    case ADD_BY_REG:
+        fprintf(out, "            flag = (V[0x%X] + V[0x%X]) > 0xFF;\n", o->x, o->y);
+        fprintf(out, "            V[0x%X] += V[0x%X];\n", o->x, o->y);
+        fprintf(out, "            V[0xF] = flag;\n");
+        break;
+    case SUB:
+        fprintf(out, "            flag = V[0x%X] > V[0x%X];\n", o->x, o->y);
+        fprintf(out, "            V[0x%X] -= V[0x%X];\n", o->x, o->y);
+        fprintf(out, "            V[0xF] = flag;\n");
+        break;
+    case SHIFT_RIGHT:
+        fprintf(out, "            flag = V[0x%X] & 0x01;\n", o->x);
+        fprintf(out, "            V[0x%X] >>= 1;\n", o->x);
+        fprintf(out, "            V[0xF] = flag;\n");
+        break;
+    case SUBN:
+        fprintf(out, "            flag = V[0x%X] > V[0x%X];\n", o->y, o->x);
+        fprintf(out, "            V[0x%X] = V[0x%X] - V[0x%X];\n", o->x, o->y, o->x);
+        fprintf(out, "            V[0xF] = flag;\n");
+        break;
+    case SHIFT_LEFT:
+        fprintf(out, "            flag = V[0x%X] >> 7;\n", o->x);
+        fprintf(out, "            V[0x%X] <<= 1;\n", o->x);
+        fprintf(out, "            V[0xF] = flag;\n");
+        break;
+    case BNNN:
+        fprintf(out, "            s->PC = 0x%03X + V[0x0];\n", o->nnn);
+        fprintf(out, "            if (--cycles == 0) return 0;\n");
+        fprintf(out, "            break;\n");
+        break;
+    case RANDOM:
+        fprintf(out, "            V[0x%X] = p->random(p->user) & 0x%02X;\n", o->x, o->nn);
+        break;
+    case SKIP_IF_KEY:
+    case SKIP_IF_NKEY:
+        snprintf(condition, sizeof(condition), "p->is_key_pressed(p->user, V[0x%X]) == %d", o->x, o->type == SKIP_IF_KEY);
+        emit_skip(out, t, address, condition);
+        break;
+    case GET_DELAY:
+        fprintf(out, "            V[0x%X] = s->delay_timer;\n", o->x);
+        break;
+    case GET_KEY:
+        fprintf(out, "            V[0x%X] = p->get_key_pressed(p->user);\n", o->x);
+        break;
+    case SET_DELAY:
+        fprintf(out, "            s->delay_timer = V[0x%X];\n", o->x);
+        break;
+    case SET_AUDIO:
+        fprintf(out, "            s->audio_timer = V[0x%X];\n", o->x);
+        break;
+    case ADVANCE_I:
+        fprintf(out, "            s->I += V[0x%X];\n", o->x);
+        break;
+    case SET_I_HEX_SPRITE:
+        fprintf(out, "            s->I = DIGIT_SPRITES_OFFSET + (V[0x%X] * 5);\n", o->x);
+        break;
+    case BCD:
+        fprintf(out, "            s->memory[s->I] = (V[0x%X] / 100) %% 10;\n", o->x);
+        fprintf(out, "            s->memory[s->I + 1] = (V[0x%X] / 10) %% 10;\n", o->x);
+        fprintf(out, "            s->memory[s->I + 2] = V[0x%X] %% 10;\n", o->x);
+        fprintf(out, "            aot_wrote(aot, s->I, 3);\n");
+        fprintf(out, "            s->PC = 0x%03X;\n", address + 2);
+        fprintf(out, "            if (--cycles == 0) return 0;\n");
+        fprintf(out, "            break;\n");
+        break;
+    case REG_DUMP:
+        fprintf(out, "            memcpy(&s->memory[s->I], V, %d);\n", o->x + 1);
+        fprintf(out, "            aot_wrote(aot, s->I, %d);\n", o->x + 1);
+        fprintf(out, "            s->PC = 0x%03X;\n", address + 2);
+        fprintf(out, "            if (--cycles == 0) return 0;\n");
+        fprintf(out, "            break;\n");
+        break;
+    case REG_LOAD:
+        fprintf(out, "            memcpy(V, &s->memory[s->I], %d);\n", o->x + 1);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Whether any reached instruction is of one of the given types
+ */
+static int uses(translation *t, enum op_type first, enum op_type second)
+{
+    for (int i = 0; i < RAM_SIZE; i++)
+        if (t->reached[i] && (t->ops[i].type == first || t->ops[i].type == second))
+            return 1;
+    return 0;
+}
+
+void translate_emit_program(FILE *out, translation *t, const char *name)
+{
+    uint32_t code_start = RAM_SIZE, code_end = 0;
+    for (uint32_t i = 0; i < RAM_SIZE; i++)
+    {
+        if (!t->reached[i])
+            continue;
+        if (i < code_start)
+            code_start = i;
+        if (i + 2 > code_end)
+            code_end = i + 2;
+    }
+    if (code_end < code_start)
+        code_start = code_end = PROGRAM_OFFSET;
+
+    // Which blocks are branched to directly, so that only those are given labels
+    for (uint32_t i = 0; i < RAM_SIZE; i++)
+    {
+        if (!t->reached[i])
+            continue;
+        op *o = &t->ops[i];
+        switch (o->type)
+        {
+        case JUMP:
+        case CALL:
+            t->targeted[o->nnn] = 1;
+            break;
+        case IF_EQ:
+        case IF_NEQ:
+        case IF_EQ_REG:
+        case SKIP_NEQ:
+        case SKIP_IF_KEY:
+        case SKIP_IF_NKEY:
+            t->targeted[i + 2] = 1;
+            if (i + 4 < RAM_SIZE)
+                t->targeted[i + 4] = 1;
+            break;
+        default:
+            // Blocks that end without branching carry on into the block that follows
+            if (!ends_block(o->type) && i + 2 < RAM_SIZE)
+                t->targeted[i + 2] = 1;
+            break;
+        }
+    }
+
+    fprintf(out, "/*\n * Translated from %s by chip8_aot. Do not edit\n */\n", name);
+    fprintf(out, "#include \"aot.h\"\n\n");
+
+    // Every byte of every reached instruction
+    fprintf(out, "static const uint8_t code_map[] = {");
+    uint32_t map_size = (code_end - code_start + 7) / 8;
+    for (uint32_t i = 0; i < map_size; i++)
+    {
+        uint8_t bits = 0;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            uint32_t address = code_start + i * 8 + bit;
+            if ((address < RAM_SIZE && t->reached[address]) ||
+                (address > 0 && address - 1 < RAM_SIZE && t->reached[address - 1]))
+                bits |= 1 << bit;
+        }
+        fprintf(out, "%s0x%02X,", (i % 12 == 0) ? "\n    " : " ", bits);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static uint32_t run(aot *aot, uint32_t cycles)\n{\n");
+    fprintf(out, "    state *s = &aot->cpu->state;\n");
+    if (uses(t, RANDOM, GET_KEY) || uses(t, SKIP_IF_KEY, SKIP_IF_NKEY) || uses(t, CLEAR_DISPLAY, DRAW_SPRITE) ||
+        uses(t, SCROLL_DOWN, SCROLL_RIGHT) || uses(t, SCROLL_LEFT, LORES) || uses(t, HIRES, HIRES))
+        fprintf(out, "    peripherals *p = aot->cpu->peripherals;\n");
+    fprintf(out, "    uint8_t *V = s->V;\n");
+    if (uses(t, ADD_BY_REG, SUB) || uses(t, SHIFT_RIGHT, SUBN) || uses(t, SHIFT_LEFT, SHIFT_LEFT))
+        fprintf(out, "    uint8_t flag;\n");
+    fprintf(out, "\n    while (!aot->modified)\n    {\n        switch (s->PC)\n        {\n");
+
+    for (int address = 0; address < RAM_SIZE; address++)
+    {
+        if (!is_block(t, address))
+            continue;
+
+        fprintf(out, "        case 0x%03X:\n", address);
+        if (t->targeted[address])
+            fprintf(out, "        block_%03X:\n", address);
+
+        for (uint16_t i = address;; i += 2)
+        {
+            emit_op(out, t, i);
+            if (ends_block(t->ops[i].type))
+                break;
+
+            uint16_t next = i + 2;
+            if (next < RAM_SIZE && t->reached[next] && !is_block(t, next))
+            {
+                emit_count(out, INDENT, next);
+                continue;
+            }
+
+            // Either carry on into the block that follows, or leave the rest to the interpreter
+            emit_branch(out, INDENT, t, next);
+            break;
+        }
+    }
+
+    fprintf(out, "        default:\n            return cycles;\n        }\n    }\n    return cycles;\n}\n\n");
+    fprintf(out, "const aot_program aot_rom_%s = {\n", name);
+    fprintf(out, "    .name = \"%s\",\n", name);
+    fprintf(out, "    .size = %u,\n", t->size);
+    fprintf(out, "    .hash = 0x%08lXUL,\n", (unsigned long)aot_hash(&t->memory[PROGRAM_OFFSET], t->size));
+    fprintf(out, "    .code_start = 0x%03X,\n", code_start);
+    fprintf(out, "    .code_end = 0x%03X,\n", code_end);
+    fprintf(out, "    .code_map = code_map,\n");
+    fprintf(out, "    .run = &run,\n};\n");
+}
+
+void translate_emit_index(FILE *out, char **names, int count)
+{
+    fprintf(out, "/*\n * The programs translated by chip8_aot. Do not edit\n */\n");
+    fprintf(out, "#include \"aot.h\"\n\n");
+    for (int i = 0; i < count; i++)
+        fprintf(out, "extern const aot_program aot_rom_%s;\n", names[i]);
+
+    fprintf(out, "\nconst aot_program *const aot_programs[] = {\n");
+    for (int i = 0; i < count; i++)
+        fprintf(out, "    &aot_rom_%s,\n", names[i]);
+    if (count == 0)
+        fprintf(out, "    NULL,\n");
+    fprintf(out, "};\n\nconst uint16_t aot_program_count = %d;\n", count);
+}
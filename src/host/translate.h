@@ -0,0 +1,76 @@
+/**
+ * @file translate.h
+ * @brief This module is used by the chip8_aot tool to translate CHIP-8 programs into C ahead of time
+ *
+ * The program is walked statically from PROGRAM_OFFSET, following jumps, calls, the returns that follow
+ * calls, and both sides of every skip. Every instruction reached is translated into C, a basic block at
+ * a time, within a single function that switches on the PC. Branches between translated blocks are direct
+ * gotos. Returns and computed BNNN jumps go back through the switch, and the interpreter is left to run
+ * anything the walk didn't reach. @see aot.h for the runtime the translation is run by
+ * @see translate_tool.c for the tool
+ */
+#ifndef TRANSLATE_H
+#define TRANSLATE_H
+
+#include <stdio.h>
+#include "../chip8/aot.h"
+
+/**
+ * @struct translation
+ * @brief What the walk has found out about each address of memory
+ */
+typedef struct translation
+{
+    /**
+     * @brief The memory the program was loaded into
+     */
+    uint8_t *memory;
+    /**
+     * @brief The size of the program in bytes
+     */
+    uint16_t size;
+    /**
+     * @brief The instruction starting at each address that was reached
+     */
+    op ops[RAM_SIZE];
+    /**
+     * @brief Whether an instruction starting at each address was reached
+     */
+    uint8_t reached[RAM_SIZE];
+    /**
+     * @brief Whether a block starts at each address
+     */
+    uint8_t leader[RAM_SIZE];
+    /**
+     * @brief Whether translated code branches directly to the block at each address
+     */
+    uint8_t targeted[RAM_SIZE];
+} translation;
+
+/**
+ * @brief Finds every instruction reachable from PROGRAM_OFFSET without knowing the contents of the registers
+ *
+ * @param t - The translation, zeroed, with its memory holding the program and its size set. Written with
+ *  the instructions reached and the blocks they start
+ */
+void translate_walk(translation *t);
+
+/**
+ * @brief Writes the C translation of a walked program, along with the aot_program describing it
+ *
+ * @param out - The file to be written to
+ * @param t - The walked translation @see translate_walk. Written with the blocks that are branched to directly
+ * @param name - The name of the program, a valid C identifier. The aot_program is named aot_rom_NAME
+ */
+void translate_emit_program(FILE *out, translation *t, const char *name);
+
+/**
+ * @brief Writes the index of the given translated programs, aot_programs and aot_program_count
+ *
+ * @param out - The file to be written to
+ * @param names - The names of the programs, as given to translate_emit_program
+ * @param count - The number of programs
+ */
+void translate_emit_index(FILE *out, char **names, int count);
+
+#endif
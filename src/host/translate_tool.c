@@ -0,0 +1,101 @@
+/**
+ * @file translate_tool.c
+ * @brief The entrypoint for the ahead-of-time translator of CHIP-8 programs into C
+ *
+ * A program is translated into C, or an index of translated programs is written. @see translate.h
+ *
+ * Usage: chip8_aot [-o output.c] [--name NAME] program.ch8
+ *        chip8_aot --index [-o output.c] NAME...
+ */
+#include <ctype.h>
+#include "translate.h"
+#include "rom.h"
+
+/**
+ * Makes the given name a valid C identifier, in place
+ */
+static void sanitize(char *name)
+{
+    for (char *c = name; *c != '\0'; c++)
+        if (!isalnum((unsigned char)*c))
+            *c = '_';
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output = NULL;
+    char *name = NULL;
+    uint8_t index = 0;
+    int first_argument = argc;
+
+    for (int i = 1; i < argc && first_argument == argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "--name") == 0 && i + 1 < argc)
+            name = argv[++i];
+        else if (strcmp(argv[i], "--index") == 0)
+            index = 1;
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        else
+            first_argument = i;
+    }
+
+    if ((!index && first_argument != argc - 1) || (index && name != NULL))
+    {
+        fprintf(stderr, "Usage: %s [-o output.c] [--name NAME] program.ch8\n", argv[0]);
+        fprintf(stderr, "       %s --index [-o output.c] NAME...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = (output != NULL) ? fopen(output, "w") : stdout;
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open %s\n", output);
+        return EXIT_FAILURE;
+    }
+
+    if (index)
+    {
+        for (int i = first_argument; i < argc; i++)
+            sanitize(argv[i]);
+        translate_emit_index(out, &argv[first_argument], argc - first_argument);
+    }
+    else
+    {
+        static uint8_t memory[RAM_SIZE];
+        static uint8_t program[PROGRAM_SIZE];
+        static translation t;
+        long size = load_rom(argv[first_argument], program);
+        if (size < 0)
+        {
+            fprintf(stderr, "Could not load %s\n", argv[first_argument]);
+            if (out != stdout)
+                fclose(out);
+            return EXIT_FAILURE;
+        }
+
+        // The program's name defaults to the name of its file
+        if (name == NULL)
+        {
+            const char *base = strrchr(argv[first_argument], '/');
+            name = strdup((base != NULL) ? base + 1 : argv[first_argument]);
+        }
+        sanitize(name);
+
+        state state;
+        init_state(&state, memory, program);
+        t.memory = memory;
+        t.size = size;
+        translate_walk(&t);
+        translate_emit_program(out, &t, name);
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
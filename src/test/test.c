@@ -1,8 +1,27 @@
 #include "../chip8/chip8.h"
+#include "../chip8/threaded.h"
+#include "../chip8/aot.h"
+#include "../chip8/snapshot.h"
+#include "../chip8/instrument.h"
+#include "../chip8/trace.h"
+#include "../chip8/memory.h"
+#if !defined(CHIP8_PAGED_MEMORY) && !defined(CHIP8_XO_CHIP)
+#include "../host/batch.h"
+#endif
+#include "../host/jit.h"
+#include "../host/rewind.h"
+#include "../host/recording.h"
+#include "../host/rom.h"
+#include "../host/translate.h"
+#include "../host/host_util.h"
+#include "../host/pool.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
 
 void test_decode();
 void test_clear_display(state *state);
@@ -11,8 +30,139 @@ void test_reg_dump(state *state);
 void test_load_reg(state *state);
 void test_math(state *state);
 void test_bcd(state *state);
+void test_decode_cache(state *state);
+void test_threaded();
+void test_frame_timers();
+void test_dirty_region(state *state);
+void test_display(state *state);
+void test_super_chip();
+void test_xo_chip();
+void test_present_vblank();
+void test_buzzer();
+void test_batch();
+void test_jit();
+void test_aot();
+void test_translate();
+void test_snapshot();
+void test_rewind();
+void test_recording();
+void test_instrument();
+void test_trace();
+void test_paged_memory();
+void test_reset();
+void test_pool();
+
+void clear_display_stub(void *user, uint8_t *screen);
+void display_region_stub(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count);
+void resolution_stub(void *user, uint8_t hires);
+void buzzer_stub(void *user, uint8_t on);
+
+void *displayed_user;
+uint8_t *displayed_rows;
+uint8_t displayed_first_row;
+uint8_t displayed_row_count;
+int display_calls;
+int buzzer_calls;
+uint8_t buzzer_sounding;
+int resolution_calls;
+uint8_t resolution_hires;
+
+/**
+ * The keys and random generator of a machine run outside of a batch or an engine, to compare them against
+ */
+typedef struct reference_lane
+{
+    uint16_t keys;
+    uint32_t rng_state;
+} reference_lane;
+
+uint8_t reference_random(void *user)
+{
+    return xorshift_next(&((reference_lane *)user)->rng_state);
+}
+
+uint8_t reference_is_key_pressed(void *user, uint8_t key)
+{
+    return (((reference_lane *)user)->keys >> key) & 1;
+}
 
-void clear_display_stub(uint8_t *screen);
+/**
+ * The size of fixture_program
+ */
+#define FIXTURE_PROGRAM_SIZE 0x42
+
+/**
+ * A program that writes over its own code every time round its loop, calls, skips, draws, and sets both
+ * timers, for the tests that run the same program two ways and compare the results
+ */
+static const uint8_t fixture_program[PROGRAM_SIZE] = {
+    0x60, 0x72, // 0x200: V[0] = 0x72
+    0x71, 0x01, // 0x202: V[1] += 1
+    0xA2, 0x0E, // 0x204: I = 0x20E
+    0xF1, 0x55, // 0x206: Dump V[0] and V[1] over the instruction at 0x20E
+    0xA3, 0x00, // 0x208: I = 0x300
+    0xF2, 0x33, // 0x20A: BCD of V[2] to 0x300
+    0x22, 0x20, // 0x20C: CALL 0x220
+    0x72, 0x00, // 0x20E: V[2] += V[1], rewritten every time round
+    0xC3, 0x0F, // 0x210: V[3] = random & 0x0F
+    0x84, 0x34, // 0x212: V[4] += V[3]
+    0x34, 0x05, // 0x214: Skip if V[4] == 5
+    0xD3, 0x43, // 0x216: Draw 3 rows at (V[3], V[4])
+    0xF4, 0x15, // 0x218: delay_timer = V[4]
+    0x12, 0x40, // 0x21A: JUMP 0x240
+    [0x20] = 0xF1, 0x18, // 0x220: audio_timer = V[1]
+    [0x22] = 0x00, 0xEE, // 0x222: RET
+    [0x40] = 0x12, 0x02, // 0x240: JUMP 0x202
+};
+
+/**
+ * A device under test and a reference device, each with its own memory and random generator, both seeded
+ * the same, so that the two run the same program identically
+ */
+typedef struct fixture
+{
+    uint8_t program[PROGRAM_SIZE];
+    uint8_t memory[RAM_SIZE];
+    uint8_t reference_memory[RAM_SIZE];
+    op decode_cache[DECODE_CACHE_SIZE];
+    reference_lane lane;
+    reference_lane reference;
+    peripherals peripherals;
+    peripherals reference_peripherals;
+    chip8 cpu;
+    chip8 reference_cpu;
+} fixture;
+
+/**
+ * Sets up the devices of the fixture to run the given program (fixture_program if NULL, copied into the
+ * fixture first). Only the device under test is given the decode cache, if asked for one
+ */
+static void init_fixture(fixture *fixture, uint8_t *program, uint8_t decode_cache, uint16_t cycles_per_frame)
+{
+    if (program == NULL)
+    {
+        memcpy(fixture->program, fixture_program, PROGRAM_SIZE);
+        program = fixture->program;
+    }
+    fixture->lane = (reference_lane){0, 1};
+    fixture->reference = (reference_lane){0, 1};
+    fixture->peripherals = (peripherals){
+        .user = &fixture->lane,
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_VBLANK,
+        .buzzer = &buzzer_stub,
+        .random = &reference_random,
+    };
+    fixture->reference_peripherals = fixture->peripherals;
+    fixture->reference_peripherals.user = &fixture->reference;
+
+    chip8_config config = {&fixture->peripherals, fixture->memory, program,
+                           decode_cache ? fixture->decode_cache : NULL, cycles_per_frame};
+    fixture->cpu = chip8_init(&config);
+    config = (chip8_config){&fixture->reference_peripherals, fixture->reference_memory, program, NULL,
+                            cycles_per_frame};
+    fixture->reference_cpu = chip8_init(&config);
+}
 
 int main(int argc, char *argv[])
 {
@@ -31,19 +181,68 @@ int main(int argc, char *argv[])
     test_load_reg(&test_state);
     init_state(&test_state, memory, program_memory);
     test_bcd(&test_state);
+    init_state(&test_state, memory, program_memory);
+    test_decode_cache(&test_state);
+    test_threaded();
+    test_frame_timers();
+    init_state(&test_state, memory, program_memory);
+    test_dirty_region(&test_state);
+    init_state(&test_state, memory, program_memory);
+    test_display(&test_state);
+    test_super_chip();
+    test_xo_chip();
+    test_present_vblank();
+    test_buzzer();
+#if !defined(CHIP8_PAGED_MEMORY) && !defined(CHIP8_XO_CHIP)
+    // These run programs straight from flat memory, and only implement CHIP-8 and SUPER-CHIP
+    test_batch();
+    test_jit();
+    test_aot();
+    test_translate();
+#endif
+    test_snapshot();
+    test_rewind();
+    test_recording();
+    test_instrument();
+    test_trace();
+    test_paged_memory();
+    test_reset();
+    test_pool();
 }
 
-void clear_display_stub(uint8_t *screen)
+void clear_display_stub(void *user, uint8_t *screen)
 {
     printf("Printed screen");
 }
 
+void display_region_stub(void *user, uint8_t *rows, uint8_t first_row, uint8_t row_count)
+{
+    displayed_user = user;
+    displayed_rows = rows;
+    displayed_first_row = first_row;
+    displayed_row_count = row_count;
+    display_calls++;
+}
+
+void resolution_stub(void *user, uint8_t hires)
+{
+    resolution_hires = hires;
+    resolution_calls++;
+}
+
+void buzzer_stub(void *user, uint8_t on)
+{
+    buzzer_sounding = on;
+    buzzer_calls++;
+}
+
 void test_clear_display(state *state)
 {
     if (state == NULL)
     {
-        state = malloc(sizeof(state));
+        state = malloc(sizeof(struct state));
         memset(state->screen, 1, SCREEN_BYTES); 
+        state->planes = 1;
     }
 
     op decoded_op = {
@@ -63,10 +262,10 @@ void test_return(state *state)
 {
     if (state == NULL)
     {
-        state = malloc(sizeof(state));
+        state = malloc(sizeof(struct state));
         state->stack[0] = 0xAAAA;
         state->stack[1] = 0xBBBB;
-        state->SP = 1;
+        state->SP = 2;
         state->PC = 0;
     }
 
@@ -74,11 +273,12 @@ void test_return(state *state)
         .type = RET
     };
 
+    // SP points past the last address pushed
     assert(state->PC == 0);
-    assert(state->SP == 1);
+    assert(state->SP == 2);
     execute(&decoded_op, state, NULL);
     assert(state->PC == 0xBBBB);
-    assert(state->SP == 0);
+    assert(state->SP == 1);
     // assert(state->stack[1] == 0);
     execute(&decoded_op, state, NULL);
     assert(state->PC == 0xAAAA);
@@ -98,20 +298,20 @@ void test_reg_dump(state *state)
     };
 
     assert(state->I == 0x150);
-    assert(state->memory[state->I] == 0);
+    assert(MEMORY_READ(state, state->I) == 0);
     execute(&decoded_op, state, NULL);
     for (int i = 1; i < REGISTER_COUNT - 1; i++) 
-        assert(state->memory[state-> I + i] == i);
+        assert(MEMORY_READ(state, state-> I + i) == i);
 
     // Do a subset 
     for (int i = 0; i < REGISTER_COUNT; i++)
         state->V[i] = 2 * i;
     decoded_op.x = 1;
     execute(&decoded_op, state, NULL);
-    assert(state->memory[state->I] == 0);
-    assert(state->memory[state->I + 1] == 2);
+    assert(MEMORY_READ(state, state->I) == 0);
+    assert(MEMORY_READ(state, state->I + 1) == 2);
     // Shouldn't haveen overwritten
-    assert(state->memory[state->I + 2] == 2);
+    assert(MEMORY_READ(state, state->I + 2) == 2);
 }
 
 void test_load_reg(state *state)
@@ -122,7 +322,7 @@ void test_load_reg(state *state)
         state->V[i] = 100;
 
     for (int i = 0; i < REGISTER_COUNT; i++) 
-        state->memory[state->I + i] = i;
+        MEMORY_WRITE(state, state->I + i, i);
 
     op decoded_op = {
         .type = REG_LOAD,
@@ -130,7 +330,7 @@ void test_load_reg(state *state)
     };
 
     assert(state->I == 0x150);
-    assert(state->memory[state->I] == 0);
+    assert(MEMORY_READ(state, state->I) == 0);
     for (int i = 0; i < REGISTER_COUNT; i++)
         assert(state->V[i] == 100);
     execute(&decoded_op, state, NULL);
@@ -153,7 +353,7 @@ void test_math(state *state)
 {
     if (state == NULL) 
     {
-        state = malloc(sizeof(state));
+        state = malloc(sizeof(struct state));
     }
 
     // ADD
@@ -228,16 +428,16 @@ void test_bcd(state *state)
     };
 
     for (int i = 0; i < 3; i++)
-        assert(state->memory[state->I + i] == 0);
+        assert(MEMORY_READ(state, state->I + i) == 0);
     execute(&decoded_op, state, NULL);
     for (int i = 0; i < 3; i++)
-        assert(state->memory[state->I + i] == 1);
+        assert(MEMORY_READ(state, state->I + i) == 1);
 
     state->V[1] = 254;
     execute(&decoded_op, state, NULL);
-    assert(state->memory[state->I] == 2);
-    assert(state->memory[state->I + 1] == 5);
-    assert(state->memory[state->I + 2] == 4);
+    assert(MEMORY_READ(state, state->I) == 2);
+    assert(MEMORY_READ(state, state->I + 1) == 5);
+    assert(MEMORY_READ(state, state->I + 2) == 4);
 }
 
 void test_decode()
@@ -434,4 +634,1342 @@ void test_decode()
     assert(op.type == REG_LOAD);
     assert(op.x == 1); 
 
-}
\ No newline at end of file
+}
+
+void test_decode_cache(state *state)
+{
+    op decode_cache[DECODE_CACHE_SIZE];
+    uint8_t program[] = {
+        0xA2, 0x08, // I = 0x208
+        0x60, 0x71, // V[0] = 0x71
+        0x61, 0xAA, // V[1] = 0xAA
+        0xF1, 0x55, // Dump V[0] - V[1] to 0x208, rewriting the next instruction to 0x71AA
+        0x62, 0x01, // V[2] = 1
+    };
+    memory_store(state, PROGRAM_OFFSET, program, sizeof(program));
+    attach_decode_cache(state, decode_cache);
+
+    peripherals peripherals = {0};
+    chip8 cpu = {
+        .state = *state,
+        .peripherals = &peripherals
+    };
+
+    // Warm the cache entry of the instruction that will be rewritten
+    cpu.state.PC = 0x208;
+    assert(fetch_decoded(&cpu.state)->type == SET_REG);
+    assert(cpu.state.PC == 0x20A);
+    cpu.state.PC = PROGRAM_OFFSET;
+
+    for (int i = 0; i < 4; i++)
+        chip8_run(&cpu);
+    assert(decode_cache[0x208].type == UNDECODED);
+    assert(decode_cache[0x200].type == SET_I_REG);
+
+    // The rewritten instruction (V[1] += 0xAA) should be run rather than the stale one
+    chip8_run(&cpu);
+    assert(cpu.state.V[1] == 0x54);
+    assert(cpu.state.V[2] == 0);
+    assert(cpu.state.PC == 0x20A);
+}
+
+void test_threaded()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x60, 0x00, // 0x200: V[0] = 0
+        0x61, 0x01, // 0x202: V[1] = 1
+        0x22, 0x10, // 0x204: CALL 0x210
+        0x70, 0x01, // 0x206: V[0] += 1
+        0x30, 0x20, // 0x208: Skip if V[0] == 0x20
+        0x12, 0x04, // 0x20A: JUMP 0x204
+        0x12, 0x0C, // 0x20C: JUMP 0x20C
+        0x00, 0x00, // 0x20E:
+        0x81, 0x04, // 0x210: V[1] += V[0]
+        0x82, 0x13, // 0x212: V[2] ^= V[1]
+        0x83, 0x2E, // 0x214: V[3] = V[2] << 1
+        0x84, 0x25, // 0x216: V[4] -= V[2]
+        0x00, 0xEE, // 0x218: RET
+    };
+    uint8_t switch_memory[RAM_SIZE];
+    uint8_t threaded_memory[RAM_SIZE];
+    op decode_cache[DECODE_CACHE_SIZE];
+    peripherals peripherals = {0};
+
+    chip8_config switch_config = {&peripherals, switch_memory, program, NULL};
+    chip8 switch_cpu = chip8_init(&switch_config);
+    chip8_config threaded_config = {&peripherals, threaded_memory, program, decode_cache};
+    chip8 threaded_cpu = chip8_init(&threaded_config);
+
+    for (int i = 0; i < 400; i++)
+        chip8_run(&switch_cpu);
+    threaded_run(&threaded_cpu, 300);
+    threaded_run(&threaded_cpu, 100);
+
+    assert(switch_cpu.state.V[0] == 0x20);
+    assert(switch_cpu.state.PC == 0x20C);
+    assert(threaded_cpu.state.PC == switch_cpu.state.PC);
+    assert(threaded_cpu.state.SP == switch_cpu.state.SP);
+    assert(memcmp(threaded_cpu.state.V, switch_cpu.state.V, REGISTER_COUNT) == 0);
+}
+
+void test_frame_timers()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x12, 0x00, // 0x200: JUMP 0x200
+    };
+    uint8_t memory[RAM_SIZE];
+    peripherals peripherals = {0};
+    chip8_config config = {&peripherals, memory, program, NULL, 10};
+    chip8 cpu = chip8_init(&config);
+    assert(cpu.cycles_per_frame == 10);
+
+    cpu.state.delay_timer = 3;
+    chip8_run_cycles(&cpu, 9);
+    assert(cpu.state.delay_timer == 3);
+    assert(cpu.state.frame_cycles == 9);
+    chip8_run(&cpu);
+    assert(cpu.state.delay_timer == 2);
+    assert(cpu.state.frame_cycles == 0);
+
+    // Batches spanning several frames should tick once per frame
+    chip8_run_cycles(&cpu, 15);
+    assert(cpu.state.delay_timer == 1);
+    assert(cpu.state.frame_cycles == 5);
+    chip8_run_frame(&cpu);
+    assert(cpu.state.delay_timer == 0);
+    assert(cpu.state.frame_cycles == 0);
+    chip8_run_frame(&cpu);
+    assert(cpu.state.delay_timer == 0);
+
+    config.cycles_per_frame = 0;
+    cpu = chip8_init(&config);
+    assert(cpu.cycles_per_frame == CYCLES_PER_FRAME);
+}
+
+void test_dirty_region(state *state)
+{
+    peripherals peripherals = {
+        .display_region = &display_region_stub
+    };
+    op decoded_op = {
+        .type = DRAW_SPRITE,
+        .x = 0,
+        .y = 1,
+        .n = 5
+    };
+
+    // A digit sprite at (12, 4)
+    state->I = DIGIT_SPRITES_OFFSET;
+    state->V[0] = 12;
+    state->V[1] = 4;
+    execute(&decoded_op, state, &peripherals);
+    assert(displayed_first_row == 4);
+    assert(displayed_row_count == 5);
+    assert(displayed_rows == &state->screen[4 * H_OFFSET]);
+    assert(state->dirty_bottom <= state->dirty_top);
+
+    // Sprites are clipped at the bottom of the screen
+    state->V[1] = LORES_SCREEN_H - 2;
+    execute(&decoded_op, state, &peripherals);
+    assert(displayed_first_row == LORES_SCREEN_H - 2);
+    assert(displayed_row_count == 2);
+
+    decoded_op.type = CLEAR_DISPLAY;
+    execute(&decoded_op, state, &peripherals);
+    assert(displayed_first_row == 0);
+    assert(displayed_row_count == LORES_SCREEN_H);
+    assert(displayed_rows == state->screen);
+}
+
+void test_display(state *state)
+{
+    op decoded_op = {
+        .type = DRAW_SPRITE,
+        .x = 0,
+        .y = 1,
+        .n = 1
+    };
+    state->I = 0x300;
+    MEMORY_WRITE(state, 0x300, 0xFF);
+    MEMORY_WRITE(state, 0x301, 0x01);
+
+    // A sprite straddling two bytes
+    state->V[0] = 4;
+    state->V[1] = 0;
+    display(state, &decoded_op);
+    assert(state->screen[0] == 0x0F && state->screen[1] == 0xF0);
+    assert(state->V[0xF] == 0);
+
+    // Sprites are clipped at the right edge of the screen, rather than spilling onto the rest of the row
+    state->V[0] = LORES_SCREEN_W - 4;
+    state->V[1] = 1;
+    display(state, &decoded_op);
+    assert(state->screen[H_OFFSET + 7] == 0x0F && state->screen[H_OFFSET + 8] == 0);
+
+    // Unsetting the rightmost pixel of a byte is a collision
+    state->I = 0x301;
+    state->V[0] = 0;
+    state->V[1] = 2;
+    display(state, &decoded_op);
+    assert(state->screen[2 * H_OFFSET] == 0x01 && state->V[0xF] == 0);
+    display(state, &decoded_op);
+    assert(state->screen[2 * H_OFFSET] == 0x00 && state->V[0xF] == 1);
+
+    // Rows are stored so that their bytes are in the order the display peripherals expect
+    assert(state->screen_rows[0][0] == SCREEN_ROW(0x0FF0000000000000ull));
+}
+
+void test_super_chip()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x00, 0xFF, // 0x200: High resolution
+        0xA3, 0x00, // 0x202: I = 0x300
+        0x60, 0x38, // 0x204: V[0] = 56
+        0x61, 0x3E, // 0x206: V[1] = 62
+        0xD0, 0x10, // 0x208: Draw a 16x16 sprite at (56, 62), across both words of its rows
+        0x00, 0xC1, // 0x20A: Scroll down 1 row
+        0x00, 0xFC, // 0x20C: Scroll left 4 pixels
+        0x00, 0xFB, // 0x20E: Scroll right 4 pixels
+        0x00, 0xFB, // 0x210: Scroll right 4 pixels
+        0x00, 0xFE, // 0x212: Low resolution
+        0x60, 0x3C, // 0x214: V[0] = 60
+        0x61, 0x1F, // 0x216: V[1] = 31
+        0xD0, 0x11, // 0x218: Draw 1 row at (60, 31)
+        0x00, 0xFB, // 0x21A: Scroll right 4 pixels
+        0x00, 0xC1, // 0x21C: Scroll down 1 row
+        0x12, 0x1E, // 0x21E: JUMP 0x21E
+        [0x100] = 0xF0, 0x0F, 0xFF, 0xFF, // 0x300: The first two rows of the 16x16 sprite
+    };
+    uint8_t memory[MEMORY_SIZE];
+    peripherals peripherals = {
+        .display_region = &display_region_stub,
+        .resolution = &resolution_stub,
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 100};
+    chip8 cpu = chip8_init(&config);
+    uint8_t *screen = cpu.state.screen;
+
+    resolution_calls = 0;
+    chip8_run_cycles(&cpu, 1);
+    assert(cpu.state.hires && resolution_calls == 1 && resolution_hires == 1);
+
+    // Only the rows that fit above the bottom of the screen are drawn
+    chip8_run_cycles(&cpu, 4);
+    assert(displayed_first_row == 62 && displayed_row_count == 2);
+    assert(screen[62 * H_OFFSET + 7] == 0xF0 && screen[62 * H_OFFSET + 8] == 0x0F);
+    assert(screen[63 * H_OFFSET + 7] == 0xFF && screen[63 * H_OFFSET + 8] == 0xFF);
+    assert(cpu.state.V[0xF] == 0);
+
+    chip8_run_cycles(&cpu, 1);
+    assert(screen[62 * H_OFFSET + 7] == 0 && screen[62 * H_OFFSET + 8] == 0);
+    assert(screen[63 * H_OFFSET + 7] == 0xF0 && screen[63 * H_OFFSET + 8] == 0x0F);
+    assert(displayed_first_row == 0 && displayed_row_count == SCREEN_H);
+
+    // Scrolling carries pixels across the words of a row
+    chip8_run_cycles(&cpu, 1);
+    assert(screen[63 * H_OFFSET + 6] == 0x0F && screen[63 * H_OFFSET + 7] == 0 && screen[63 * H_OFFSET + 8] == 0xF0);
+    chip8_run_cycles(&cpu, 2);
+    assert(screen[63 * H_OFFSET + 7] == 0x0F && screen[63 * H_OFFSET + 8] == 0 && screen[63 * H_OFFSET + 9] == 0xF0);
+
+    // Switching resolution clears the screen
+    chip8_run_cycles(&cpu, 1);
+    assert(!cpu.state.hires && resolution_calls == 2 && resolution_hires == 0);
+    assert(screen[63 * H_OFFSET + 7] == 0 && screen[63 * H_OFFSET + 9] == 0);
+    assert(displayed_first_row == 0 && displayed_row_count == LORES_SCREEN_H);
+
+    // In low resolution, sprites and scrolls are clipped at the edges of the smaller screen
+    chip8_run_cycles(&cpu, 3);
+    assert(screen[31 * H_OFFSET + 7] == 0x0F && screen[31 * H_OFFSET + 8] == 0);
+    chip8_run_cycles(&cpu, 1);
+    assert(screen[31 * H_OFFSET + 7] == 0 && screen[31 * H_OFFSET + 8] == 0);
+    chip8_run_cycles(&cpu, 1);
+    assert(screen[32 * H_OFFSET] == 0);
+
+    // A 16x16 sprite drawn over itself collides
+    state *state = &cpu.state;
+    op decoded_op = {
+        .type = DRAW_SPRITE,
+        .x = 0,
+        .y = 1,
+        .n = 0
+    };
+    state->I = 0x300;
+    state->V[0] = 0;
+    state->V[1] = 0;
+    display(state, &decoded_op);
+    assert(state->V[0xF] == 0 && screen[0] == 0xF0 && screen[1] == 0x0F && screen[2] == 0);
+    display(state, &decoded_op);
+    assert(state->V[0xF] == 1 && screen[0] == 0 && screen[1] == 0);
+
+    // The SUPER-CHIP instructions decode as expected
+    uint8_t instructions[][2] = {{0x00, 0xC5}, {0x00, 0xFB}, {0x00, 0xFC}, {0x00, 0xFE}, {0x00, 0xFF}};
+    enum op_type types[] = {SCROLL_DOWN, SCROLL_RIGHT, SCROLL_LEFT, LORES, HIRES};
+    for (int i = 0; i < 5; i++)
+    {
+        decode(instructions[i], &decoded_op);
+        assert(decoded_op.type == types[i]);
+    }
+    decode(instructions[0], &decoded_op);
+    assert(decoded_op.n == 5);
+}
+
+void test_xo_chip()
+{
+#ifdef CHIP8_XO_CHIP
+    uint8_t program[PROGRAM_SIZE] = {
+        0xF0, 0x00, 0xFF, 0x00, // 0x200: I = 0xFF00
+        0x60, 0x00,             // 0x204: V[0] = 0
+        0x61, 0x00,             // 0x206: V[1] = 0
+        0xF3, 0x01,             // 0x208: Select both planes
+        0xD0, 0x12,             // 0x20A: Draw 2 rows at (0, 0) to each plane
+        0x30, 0x00,             // 0x20C: Skip if V[0] == 0
+        0xF0, 0x00, 0x12, 0x34, // 0x20E: I = 0x1234, skipped whole
+        0xF2, 0x01,             // 0x212: Select the second plane
+        0x00, 0xE0,             // 0x214: Clear the second plane
+        0xF0, 0x00, 0xFF, 0xFF, // 0x216: I = 0xFFFF
+        0x61, 0x07,             // 0x21A: V[1] = 7
+        0xF1, 0x55,             // 0x21C: Dump V[0] and V[1] to 0xFFFF, wrapping around to 0x0000
+        0x12, 0x1E,             // 0x21E: JUMP 0x21E
+        [0xFD00] = 0x81, 0x42, 0xFF, 0x18, // 0xFF00: A 2 row sprite for each plane
+    };
+    uint8_t memory[MEMORY_SIZE];
+    peripherals peripherals = {
+        .display_region = &display_region_stub,
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 100};
+    chip8 cpu = chip8_init(&config);
+    state *state = &cpu.state;
+    uint8_t *screen = state->screen;
+
+    assert(state->planes == 1);
+    chip8_run_cycles(&cpu, 1);
+    assert(state->I == 0xFF00 && state->PC == 0x204);
+
+    // Each selected plane is drawn with its own sprite, the second following the first
+    chip8_run_cycles(&cpu, 4);
+    assert(state->planes == 3 && state->V[0xF] == 0);
+    assert(screen[0] == 0x81 && screen[H_OFFSET] == 0x42);
+    assert(screen[SCREEN_PLANE_BYTES] == 0xFF && screen[SCREEN_PLANE_BYTES + H_OFFSET] == 0x18);
+    assert(displayed_first_row == 0 && displayed_row_count == 2 && displayed_rows[SCREEN_PLANE_BYTES] == 0xFF);
+
+    // Skips step over all four bytes of a long I load
+    chip8_run_cycles(&cpu, 1);
+    assert(state->PC == 0x212 && state->I == 0xFF00);
+
+    // Only the selected plane is cleared
+    chip8_run_cycles(&cpu, 2);
+    assert(state->planes == 2 && screen[0] == 0x81 && screen[SCREEN_PLANE_BYTES] == 0);
+
+    // Memory is 64KB, and addresses past its end wrap around
+    chip8_run_cycles(&cpu, 3);
+    assert(state->I == 0xFFFF);
+    assert(MEMORY_READ(state, 0xFFFF) == 0 && MEMORY_READ(state, 0x0000) == 7);
+
+    // Pixels turned off in any plane collide
+    op decoded_op = {
+        .type = DRAW_SPRITE,
+        .x = 0,
+        .y = 0,
+        .n = 2
+    };
+    state->planes = 3;
+    state->I = 0xFF00;
+    state->V[0] = 0;
+    display(state, &decoded_op);
+    assert(state->V[0xF] == 1 && screen[0] == 0 && screen[SCREEN_PLANE_BYTES] == 0xFF);
+
+    // The selected planes are kept by snapshots
+    uint8_t *snapshot = chip8_snapshot(&cpu);
+    state->planes = 1;
+    assert(chip8_restore(&cpu, snapshot, SNAPSHOT_SIZE) == 0 && state->planes == 3);
+    free(snapshot);
+
+    // The XO-CHIP instructions decode as expected
+    uint8_t instructions[][2] = {{0xF0, 0x00}, {0xF2, 0x01}, {0xF1, 0x00}};
+    enum op_type types[] = {LONG_I, SELECT_PLANES, NOOP};
+    for (int i = 0; i < 3; i++)
+    {
+        decode(instructions[i], &decoded_op);
+        assert(decoded_op.type == types[i]);
+    }
+#endif
+}
+
+void test_present_vblank()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0xA0, 0x00, // 0x200: I = 0
+        0xD0, 0x15, // 0x202: Draw 5 rows at (V[0], V[1])
+        0x61, 0x10, // 0x204: V[1] = 16
+        0xD0, 0x15, // 0x206: Draw 5 rows at (V[0], V[1])
+        0x12, 0x08, // 0x208: JUMP 0x208
+    };
+    uint8_t memory[RAM_SIZE];
+    int context;
+    peripherals peripherals = {
+        .user = &context,
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_VBLANK
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 10};
+    chip8 cpu = chip8_init(&config);
+
+    // Draws only mark the screen as dirty until the frame ends
+    display_calls = 0;
+    chip8_run_cycles(&cpu, 4);
+    assert(display_calls == 0);
+    chip8_run_frame(&cpu);
+    assert(display_calls == 1);
+    assert(displayed_first_row == 0);
+    assert(displayed_row_count == 21);
+    assert(displayed_user == &context);
+
+    // Nothing is displayed for frames that didn't draw
+    chip8_run_frame(&cpu);
+    assert(display_calls == 1);
+}
+
+void test_buzzer()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x60, 0x02, // 0x200: V[0] = 2
+        0xF0, 0x18, // 0x202: audio_timer = V[0]
+        0x12, 0x04, // 0x204: JUMP 0x204
+    };
+    uint8_t memory[RAM_SIZE];
+    peripherals peripherals = {
+        .buzzer = &buzzer_stub
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 2};
+    chip8 cpu = chip8_init(&config);
+
+    // The buzzer is started once, sounds for as many frames as the timer was set to, then stops once
+    buzzer_calls = 0;
+    chip8_run_frame(&cpu);
+    assert(buzzer_calls == 1);
+    assert(buzzer_sounding == 1);
+    chip8_run_frame(&cpu);
+    assert(buzzer_calls == 1);
+    chip8_run_frame(&cpu);
+    assert(buzzer_calls == 2);
+    assert(buzzer_sounding == 0);
+    chip8_run_frame(&cpu);
+    assert(buzzer_calls == 2);
+}
+#if !defined(CHIP8_PAGED_MEMORY) && !defined(CHIP8_XO_CHIP)
+void test_batch()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x60, 0x00, // 0x200: V[0] = 0
+        0xE0, 0x9E, // 0x202: Skip if key V[0] is pressed
+        0x71, 0x01, // 0x204: V[1] += 1
+        0x72, 0x03, // 0x206: V[2] += 3
+        0x83, 0x14, // 0x208: V[3] += V[1]
+        0x84, 0x25, // 0x20A: V[4] -= V[2]
+        0x85, 0x36, // 0x20C: V[5] >>= 1
+        0x86, 0x37, // 0x20E: V[6] = V[3] - V[6]
+        0x87, 0x4E, // 0x210: V[7] <<= 1
+        0xC8, 0x0F, // 0x212: V[8] = random & 0x0F
+        0x38, 0x05, // 0x214: Skip if V[8] == 5
+        0x79, 0x01, // 0x216: V[9] += 1
+        0x8A, 0x93, // 0x218: V[A] ^= V[9]
+        0xF3, 0x15, // 0x21A: delay_timer = V[3]
+        0xA3, 0x00, // 0x21C: I = 0x300
+        0xF3, 0x33, // 0x21E: BCD of V[3] to 0x300
+        0xF0, 0x65, // 0x220: Load V[0] from 0x300
+        0xD3, 0x43, // 0x222: Draw 3 rows at (V[3], V[4])
+        0x12, 0x02, // 0x224: JUMP 0x202
+    };
+    // Enough machines for whole AVX2 blocks in each group of keys, and a remainder
+    enum { count = 100 };
+    static uint8_t memory[count][RAM_SIZE];
+    static chip8 cpus[count];
+    reference_lane lanes[count];
+    peripherals reference_peripherals[count];
+    // Run once with the AVX2 kernels, if the CPU has AVX2, and once without
+    for (uint8_t pass = 0; pass < 2; pass++)
+    {
+        batch batch;
+        assert(batch_init(&batch, count, program, 7) == 0);
+        if (pass == 1)
+            batch.avx2 = 0;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint16_t keys = (i % 3 == 0) ? 0x0001 : (i % 3 == 1) ? 0xFFFF : 0;
+            batch_set_keys(&batch, i, keys);
+            lanes[i] = (reference_lane){keys, i + 1};
+            reference_peripherals[i] = (peripherals){
+                .user = &lanes[i],
+                .display_region = &display_region_stub,
+                .present_mode = PRESENT_VBLANK,
+                .random = &reference_random,
+                .is_key_pressed = &reference_is_key_pressed,
+            };
+            chip8_config config = {&reference_peripherals[i], memory[i], program, NULL, 7};
+            cpus[i] = chip8_init(&config);
+        }
+
+        batch_run_cycles(&batch, 1500);
+        batch_run_frame(&batch);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            state lane_state;
+            chip8_run_cycles(&cpus[i], 1500);
+            chip8_run_frame(&cpus[i]);
+            batch_get_state(&batch, i, &lane_state);
+
+            assert(lane_state.PC == cpus[i].state.PC);
+            assert(lane_state.I == cpus[i].state.I);
+            assert(lane_state.delay_timer == cpus[i].state.delay_timer);
+            assert(memcmp(lane_state.V, cpus[i].state.V, REGISTER_COUNT) == 0);
+            assert(memcmp(lane_state.memory, cpus[i].state.memory, RAM_SIZE) == 0);
+            assert(memcmp(batch_screen(&batch, i), cpus[i].state.screen, SCREEN_BYTES) == 0);
+        }
+        // The machines diverge on their keys and random numbers, and are regrouped to run on in lockstep
+        assert(batch.scalar_steps > 0);
+        assert(batch.lockstep_steps > batch.scalar_steps);
+        batch_free(&batch);
+    }
+}
+#endif
+
+void test_jit()
+{
+#ifdef JIT_SUPPORTED
+    static fixture fixture;
+    init_fixture(&fixture, NULL, 0, 7);
+    chip8 *cpu = &fixture.cpu;
+    chip8 *reference_cpu = &fixture.reference_cpu;
+
+    jit jit;
+    assert(jit_init(&jit, cpu) == 0);
+    // Uneven numbers of cycles leave blocks part way through
+    uint32_t cycles[] = {1, 5, 13, 100, 1234};
+    for (int i = 0; i < 5; i++)
+    {
+        jit_run_cycles(&jit, cycles[i]);
+        jit_run_frame(&jit);
+        chip8_run_cycles(reference_cpu, cycles[i]);
+        chip8_run_frame(reference_cpu);
+
+        assert(cpu->state.PC == reference_cpu->state.PC);
+        assert(cpu->state.I == reference_cpu->state.I);
+        assert(cpu->state.SP == reference_cpu->state.SP);
+        assert(cpu->state.delay_timer == reference_cpu->state.delay_timer);
+        assert(cpu->state.audio_timer == reference_cpu->state.audio_timer);
+        assert(memcmp(cpu->state.V, reference_cpu->state.V, REGISTER_COUNT) == 0);
+        assert(memcmp(fixture.memory, fixture.reference_memory, RAM_SIZE) == 0);
+        assert(memcmp(cpu->state.screen, reference_cpu->state.screen, SCREEN_BYTES) == 0);
+    }
+    assert(jit.compiled_steps > 0);
+
+    // Translating again from scratch gives the same results
+    jit_flush(&jit);
+    jit_run_cycles(&jit, 500);
+    chip8_run_cycles(reference_cpu, 500);
+    assert(memcmp(cpu->state.V, reference_cpu->state.V, REGISTER_COUNT) == 0);
+    assert(memcmp(fixture.memory, fixture.reference_memory, RAM_SIZE) == 0);
+    jit_free(&jit);
+#endif
+}
+
+/**
+ * A translation of the block at 0x202 of test_aot's program, as chip8_aot would emit it
+ */
+uint32_t test_aot_run(aot *aot, uint32_t cycles)
+{
+    state *s = &aot->cpu->state;
+    uint8_t *V = s->V;
+
+    while (!aot->modified)
+    {
+        switch (s->PC)
+        {
+        case 0x202:
+            V[0x1] += 0x01;
+            if (--cycles == 0) { s->PC = 0x204; return 0; }
+            s->I = 0x20E;
+            if (--cycles == 0) { s->PC = 0x206; return 0; }
+            memcpy(&s->memory[s->I], V, 2);
+            aot_wrote(aot, s->I, 2);
+            s->PC = 0x208;
+            if (--cycles == 0) return 0;
+            break;
+        default:
+            return cycles;
+        }
+    }
+    return cycles;
+}
+
+void test_aot()
+{
+    static fixture fixture;
+    init_fixture(&fixture, NULL, 0, 7);
+    chip8 *cpu = &fixture.cpu;
+    chip8 *reference_cpu = &fixture.reference_cpu;
+
+    // Only the block at 0x202 is translated, but the bytes of every instruction are marked as code
+    const uint8_t code_map[] = {0xFF, 0xFF, 0xFF, 0x0F, 0x0F, 0x00, 0x00, 0x00, 0x03};
+    aot_program translated = {
+        .name = "test",
+        .size = FIXTURE_PROGRAM_SIZE,
+        .hash = aot_hash(fixture_program, FIXTURE_PROGRAM_SIZE),
+        .code_start = 0x200,
+        .code_end = PROGRAM_OFFSET + FIXTURE_PROGRAM_SIZE,
+        .code_map = code_map,
+        .run = &test_aot_run,
+    };
+    const aot_program *const programs[] = {&translated};
+
+    aot aot;
+    assert(aot_find(cpu, programs, 1) == &translated);
+    assert(aot_init(&aot, cpu, &translated) == 0);
+
+    // Writing over 0x20E (a translated instruction) hands everything to the interpreter from then on
+    aot_run_cycles(&aot, 4);
+    chip8_run_cycles(reference_cpu, 4);
+    assert(aot.translated_steps == 3);
+    assert(aot.modified == 1);
+
+    aot_run_cycles(&aot, 1000);
+    aot_run_frame(&aot);
+    chip8_run_cycles(reference_cpu, 1000);
+    chip8_run_frame(reference_cpu);
+    assert(aot.translated_steps == 3);
+    assert(cpu->state.PC == reference_cpu->state.PC);
+    assert(cpu->state.I == reference_cpu->state.I);
+    assert(cpu->state.SP == reference_cpu->state.SP);
+    assert(memcmp(cpu->state.V, reference_cpu->state.V, REGISTER_COUNT) == 0);
+    assert(memcmp(fixture.memory, fixture.reference_memory, RAM_SIZE) == 0);
+
+    // A translation of some other program is refused
+    fixture.program[1] = 0x73;
+    init_fixture(&fixture, fixture.program, 0, 7);
+    assert(aot_find(cpu, programs, 1) == NULL);
+    assert(aot_init(&aot, cpu, &translated) == -1);
+}
+
+#if !defined(CHIP8_PAGED_MEMORY) && !defined(CHIP8_XO_CHIP)
+/**
+ * The translation of roms/test/translate.ch8 by chip8_aot, built along with the test suite
+ */
+extern const aot_program aot_rom_test;
+
+void test_translate()
+{
+    // 0x200: V[0] = 4
+    // 0x202: Skip if V[0] == 4
+    // 0x204: V[0] += 1
+    // 0x206: CALL 0x210
+    // 0x208: JUMP 0x20A + V[0], which the walk can't follow
+    // 0x20A: Never reached by the walk, up to the JUMP 0x200 at 0x20E
+    // 0x210: V[1] += 1
+    // 0x212: I = 0x204
+    // 0x214: Dump V[0] over the instruction at 0x204
+    // 0x216: RET
+    uint8_t program[PROGRAM_SIZE];
+    long size = load_rom("roms/test/translate.ch8", program);
+    assert(size == 0x18);
+
+    static uint8_t memory[RAM_SIZE];
+    static translation t;
+    state state;
+    init_state(&state, memory, program);
+    memset(&t, 0, sizeof(t));
+    t.memory = memory;
+    t.size = size;
+    translate_walk(&t);
+
+    // Both sides of the skip, the call and the instruction it returns to, and what follows the dump
+    const uint16_t leaders[] = {0x200, 0x204, 0x206, 0x208, 0x210, 0x216};
+    const uint16_t reached[] = {0x200, 0x202, 0x204, 0x206, 0x208, 0x210, 0x212, 0x214, 0x216};
+    uint8_t expected[RAM_SIZE] = {0};
+    for (size_t i = 0; i < sizeof(leaders) / sizeof(leaders[0]); i++)
+        expected[leaders[i]] = 1;
+    assert(memcmp(t.leader, expected, RAM_SIZE) == 0);
+    memset(expected, 0, RAM_SIZE);
+    for (size_t i = 0; i < sizeof(reached) / sizeof(reached[0]); i++)
+        expected[reached[i]] = 1;
+    assert(memcmp(t.reached, expected, RAM_SIZE) == 0);
+    assert(t.ops[0x208].type == BNNN && t.ops[0x214].type == REG_DUMP);
+
+    FILE *out = tmpfile();
+    assert(out != NULL);
+    translate_emit_program(out, &t, "test");
+    static char text[1 << 16];
+    rewind(out);
+    text[fread(text, 1, sizeof(text) - 1, out)] = '\0';
+    fclose(out);
+
+    // Branched to directly: the call's target, both sides of the skip, and what follows an instruction
+    // that doesn't end its block. Not the instruction the call returns to, which RET reaches by the switch
+    const uint16_t targeted[] = {0x202, 0x204, 0x206, 0x210, 0x212, 0x214};
+    memset(expected, 0, RAM_SIZE);
+    for (size_t i = 0; i < sizeof(targeted) / sizeof(targeted[0]); i++)
+        expected[targeted[i]] = 1;
+    assert(memcmp(t.targeted, expected, RAM_SIZE) == 0);
+
+    // Every byte of 0x200 to 0x209 and 0x210 to 0x217 is code
+    assert(strstr(text, "static const uint8_t code_map[] = {\n    0xFF, 0x03, 0xFF,\n};") != NULL);
+    assert(strstr(text, "        case 0x208:\n") != NULL && strstr(text, "        case 0x20E:\n") == NULL);
+
+    // The translation built with the test suite is the same, and runs just as the interpreter does
+    assert(aot_rom_test.size == size && aot_rom_test.hash == aot_hash(program, size));
+    assert(aot_rom_test.code_start == 0x200 && aot_rom_test.code_end == 0x218);
+    assert(memcmp(aot_rom_test.code_map, "\xFF\x03\xFF", 3) == 0);
+
+    uint8_t reference_memory[RAM_SIZE];
+    peripherals peripherals = {
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_VBLANK,
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 7};
+    chip8 cpu = chip8_init(&config);
+    config = (chip8_config){&peripherals, reference_memory, program, NULL, 7};
+    chip8 reference_cpu = chip8_init(&config);
+    const aot_program *const programs[] = {&aot_rom_test};
+    aot aot;
+    assert(aot_find(&cpu, programs, 1) == &aot_rom_test);
+    assert(aot_init(&aot, &cpu, &aot_rom_test) == 0);
+
+    // The skip, the call and the subroutine up to its dump over 0x204 are translated, and everything after
+    // the dump is interpreted
+    aot_run_cycles(&aot, 6);
+    chip8_run_cycles(&reference_cpu, 6);
+    assert(aot.modified && aot.translated_steps == 6);
+    assert(cpu.state.PC == 0x216 && cpu.state.SP == 1 && cpu.state.stack[0] == 0x208);
+    assert(cpu.state.PC == reference_cpu.state.PC && memcmp(cpu.state.V, reference_cpu.state.V, REGISTER_COUNT) == 0);
+    aot_run_cycles(&aot, 500);
+    chip8_run_cycles(&reference_cpu, 500);
+    assert(cpu.state.PC == reference_cpu.state.PC && cpu.state.I == reference_cpu.state.I);
+    assert(memcmp(cpu.state.V, reference_cpu.state.V, REGISTER_COUNT) == 0);
+    assert(memcmp(memory, reference_memory, RAM_SIZE) == 0);
+}
+#endif
+
+void test_snapshot()
+{
+    static fixture fixture;
+    init_fixture(&fixture, NULL, 1, 5);
+    chip8 cpu = fixture.cpu;
+    uint8_t *memory = fixture.memory;
+    op *decode_cache = fixture.decode_cache;
+
+    // The stack is zeroed in full on init
+    assert(cpu.state.stack[STACK_COUNT - 1] == 0);
+
+    uint8_t buffer[SNAPSHOT_SIZE];
+    chip8_run_cycles(&cpu, 103);
+    assert(chip8_snapshot_into(&cpu, buffer, SNAPSHOT_SIZE - 1) == 0);
+    assert(chip8_snapshot_into(&cpu, buffer, sizeof(buffer)) == SNAPSHOT_SIZE);
+    assert(memcmp(buffer, SNAPSHOT_MAGIC, 4) == 0);
+    chip8 saved = cpu;
+    uint8_t saved_memory[RAM_SIZE];
+    memcpy(saved_memory, memory, RAM_SIZE);
+    // The random generator belongs to the host, so isn't in the snapshot, and is put back alongside it
+    reference_lane saved_lane = fixture.lane;
+
+    // Running on from the snapshot repeats exactly what followed it
+    chip8_run_cycles(&cpu, 250);
+    chip8 after = cpu;
+    uint8_t after_memory[RAM_SIZE];
+    memcpy(after_memory, memory, RAM_SIZE);
+
+    buzzer_calls = 0;
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == 0);
+    fixture.lane = saved_lane;
+    assert(cpu.state.PC == saved.state.PC);
+    assert(cpu.state.SP == saved.state.SP);
+    assert(cpu.state.frame_cycles == saved.state.frame_cycles);
+    assert(memcmp(cpu.state.stack, saved.state.stack, sizeof(cpu.state.stack)) == 0);
+    assert(memcmp(memory, saved_memory, RAM_SIZE) == 0);
+    assert(cpu.state.buzzer_on == saved.state.buzzer_on);
+    assert(buzzer_calls == (after.state.buzzer_on != saved.state.buzzer_on));
+    assert(cpu.state.dirty_top == 0 && cpu.state.dirty_bottom == LORES_SCREEN_H);
+    assert(decode_cache[0x20E].type == UNDECODED);
+
+    chip8_run_cycles(&cpu, 250);
+    assert(cpu.state.PC == after.state.PC);
+    assert(cpu.state.I == after.state.I);
+    assert(cpu.state.delay_timer == after.state.delay_timer);
+    assert(cpu.state.audio_timer == after.state.audio_timer);
+    assert(memcmp(cpu.state.V, after.state.V, REGISTER_COUNT) == 0);
+    assert(memcmp(cpu.state.screen, after.state.screen, SCREEN_BYTES) == 0);
+    assert(memcmp(memory, after_memory, RAM_SIZE) == 0);
+
+    // The allocating variant writes the same snapshot
+    uint8_t *allocated = chip8_snapshot(&cpu);
+    assert(allocated != NULL);
+    chip8_snapshot_into(&cpu, buffer, sizeof(buffer));
+    assert(memcmp(allocated, buffer, SNAPSHOT_SIZE) == 0);
+    free(allocated);
+
+    // Snapshots that are cut short, aren't snapshots, are of another version, or were taken by a build with
+    // another layout are refused untouched
+    uint16_t PC = cpu.state.PC;
+    assert(chip8_restore(&cpu, buffer, SNAPSHOT_SIZE - 1) == -1);
+    buffer[4] = SNAPSHOT_VERSION + 1;
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == -1);
+    buffer[4] = SNAPSHOT_VERSION;
+    assert(buffer[6] == (RAM_SIZE & 0xFF) && buffer[8] == ((RAM_SIZE >> 16) & 0xFF) && buffer[10] == SCREEN_PLANES);
+    buffer[8] ^= 1;
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == -1);
+    buffer[8] ^= 1;
+    buffer[10] = SCREEN_PLANES + 1;
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == -1);
+    buffer[10] = SCREEN_PLANES;
+    buffer[0] = 'X';
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == -1);
+    assert(cpu.state.PC == PC);
+}
+
+void test_rewind()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x71, 0x01, // 0x200: V[1] += 1
+        0xA3, 0x00, // 0x202: I = 0x300
+        0xF1, 0x33, // 0x204: BCD of V[1] to 0x300
+        0xC3, 0x3F, // 0x206: V[3] = random & 0x3F
+        0xD3, 0x13, // 0x208: Draw 3 rows at (V[3], V[1])
+        0xF1, 0x15, // 0x20A: delay_timer = V[1]
+        0x12, 0x00, // 0x20C: JUMP 0x200
+    };
+    uint8_t memory[RAM_SIZE];
+    reference_lane lane = {0, 1};
+    peripherals peripherals = {
+        .user = &lane,
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_VBLANK,
+        .random = &reference_random,
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 7};
+    chip8 cpu = chip8_init(&config);
+
+    rewind_buffer *rewind = malloc(sizeof(rewind_buffer));
+    assert(rewind_init(rewind, 0, 20) == 0);
+    assert(rewind_step_back(rewind, &cpu) == -1);
+
+    // Every frame's snapshot, to compare the rewound ones against
+    static uint8_t frames[30][SNAPSHOT_SIZE];
+    for (int i = 0; i < 30; i++)
+    {
+        chip8_run_frame(&cpu);
+        rewind_capture(rewind, &cpu);
+        chip8_snapshot_into(&cpu, frames[i], SNAPSHOT_SIZE);
+    }
+    // Only max_frames frames are kept, and each is far smaller than a snapshot
+    assert(rewind->count == 20);
+    assert(rewind->used < 20 * SNAPSHOT_SIZE / 8);
+
+    uint8_t rewound[SNAPSHOT_SIZE];
+    for (int i = 28; i >= 9; i--)
+    {
+        assert(rewind_step_back(rewind, &cpu) == 0);
+        chip8_snapshot_into(&cpu, rewound, SNAPSHOT_SIZE);
+        assert(memcmp(rewound, frames[i], SNAPSHOT_SIZE) == 0);
+    }
+    assert(rewind_step_back(rewind, &cpu) == -1);
+
+    // Running on from a rewound frame is captured as usual
+    chip8_run_frame(&cpu);
+    rewind_capture(rewind, &cpu);
+    assert(rewind_step_back(rewind, &cpu) == 0);
+    chip8_snapshot_into(&cpu, rewound, SNAPSHOT_SIZE);
+    assert(memcmp(rewound, frames[9], SNAPSHOT_SIZE) == 0);
+    rewind_free(rewind);
+
+    // A ring buffer too small for many frames drops the oldest, wrapping around as it goes
+    assert(rewind_init(rewind, 300, 0) == 0);
+    for (int i = 0; i < 200; i++)
+    {
+        chip8_run_frame(&cpu);
+        rewind_capture(rewind, &cpu);
+        assert(rewind->used <= rewind->capacity);
+    }
+    chip8_snapshot_into(&cpu, frames[0], SNAPSHOT_SIZE);
+    chip8_run_frame(&cpu);
+    rewind_capture(rewind, &cpu);
+    assert(rewind->count > 1);
+    assert(rewind_step_back(rewind, &cpu) == 0);
+    chip8_snapshot_into(&cpu, rewound, SNAPSHOT_SIZE);
+    assert(memcmp(rewound, frames[0], SNAPSHOT_SIZE) == 0);
+    rewind_free(rewind);
+
+#ifdef CHIP8_XO_CHIP
+    // Unchanged runs longer than a 16-bit length, from the registers to the end of memory, are split
+    assert(rewind_init(rewind, 0, 0) == 0);
+    rewind_capture(rewind, &cpu);
+    cpu.state.V[0] = 1;
+    MEMORY_WRITE(&cpu.state, RAM_SIZE - 8, 0x55);
+    rewind_capture(rewind, &cpu);
+    cpu.state.V[0] = 2;
+    MEMORY_WRITE(&cpu.state, RAM_SIZE - 8, 0xAA);
+    rewind_capture(rewind, &cpu);
+    assert(rewind_step_back(rewind, &cpu) == 0);
+    assert(cpu.state.V[0] == 1 && MEMORY_READ(&cpu.state, RAM_SIZE - 8) == 0x55);
+    rewind_free(rewind);
+#endif
+    free(rewind);
+}
+
+void test_recording()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0xC3, 0x3F, // 0x200: V[3] = random & 0x3F
+        0x60, 0x05, // 0x202: V[0] = 5
+        0xE0, 0xA1, // 0x204: Skip if key V[0] isn't pressed
+        0x71, 0x01, // 0x206: V[1] += 1
+        0xA3, 0x00, // 0x208: I = 0x300
+        0xF1, 0x33, // 0x20A: BCD of V[1] to 0x300
+        0xD3, 0x13, // 0x20C: Draw 3 rows at (V[3], V[1])
+        0x12, 0x00, // 0x20E: JUMP 0x200
+    };
+    const char *file_name = "test_recording.c8r";
+    uint8_t memory[RAM_SIZE];
+    reference_lane lane = {0, 1};
+    peripherals live = {
+        .user = &lane,
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_VBLANK,
+        .random = &reference_random,
+        .is_key_pressed = &reference_is_key_pressed,
+    };
+
+    recording recording;
+    assert(recording_start(&recording, file_name, &live, program, 9) == 0);
+    chip8_config config = {&recording.peripherals, memory, program, NULL, 9};
+    chip8 cpu = chip8_init(&config);
+    for (int i = 0; i < 50; i++)
+    {
+        // Key 5 is held for a stretch in the middle
+        lane.keys = (i >= 10 && i < 30) ? (1 << 5) : 0;
+        recording_frame(&recording);
+        chip8_run_frame(&cpu);
+    }
+    recording_close(&recording);
+    chip8 recorded = cpu;
+    uint8_t recorded_memory[RAM_SIZE];
+    memcpy(recorded_memory, memory, RAM_SIZE);
+    assert(recorded.state.V[1] > 0);
+
+    // Replaying with another seed, and no keys, runs exactly as recorded
+    reference_lane other = {0xFFFF, 1234};
+    live.user = &other;
+    uint16_t cycles_per_frame = 0;
+    assert(replay_start(&recording, file_name, &live, program, &cycles_per_frame) == 0);
+    assert(cycles_per_frame == 9);
+    config = (chip8_config){&recording.peripherals, memory, program, NULL, cycles_per_frame};
+    cpu = chip8_init(&config);
+    int frames = 0;
+    while (recording_frame(&recording) == 0)
+    {
+        chip8_run_frame(&cpu);
+        frames++;
+    }
+    assert(frames == 50);
+    assert(recording.diverged == 0);
+    assert(cpu.state.PC == recorded.state.PC);
+    assert(memcmp(cpu.state.V, recorded.state.V, REGISTER_COUNT) == 0);
+    assert(memcmp(cpu.state.screen, recorded.state.screen, SCREEN_BYTES) == 0);
+    assert(memcmp(memory, recorded_memory, RAM_SIZE) == 0);
+    recording_close(&recording);
+
+    // Running more per frame than recorded asks for random bytes the recording doesn't have
+    assert(replay_start(&recording, file_name, &live, program, &cycles_per_frame) == 0);
+    config.cycles_per_frame = cycles_per_frame + 1;
+    cpu = chip8_init(&config);
+    while (recording_frame(&recording) == 0)
+        chip8_run_frame(&cpu);
+    assert(recording.diverged == 1);
+    recording_close(&recording);
+
+    // A recording of another program is refused
+    program[1] = 0x1F;
+    assert(replay_start(&recording, file_name, &live, program, &cycles_per_frame) == -1);
+    assert(replay_start(&recording, "missing.c8r", &live, program, &cycles_per_frame) == -1);
+    remove(file_name);
+}
+
+void test_instrument()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x60, 0x08, // 0x200: V[0] = 8
+        0xA2, 0x10, // 0x202: I = 0x210
+        0xD0, 0x01, // 0x204: Draw 1 row at (V[0], V[0])
+        0xC1, 0xFF, // 0x206: V[1] = random
+        0xE0, 0x9E, // 0x208: Skip if key V[0] is pressed
+        0x12, 0x04, // 0x20A: JUMP 0x204
+        [0x10] = 0x80,
+    };
+    uint8_t memory[RAM_SIZE];
+    op decode_cache[DECODE_CACHE_SIZE];
+    reference_lane lane = {0, 1};
+    peripherals peripherals = {
+        .user = &lane,
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_IMMEDIATE,
+        .random = &reference_random,
+        .is_key_pressed = &reference_is_key_pressed,
+    };
+    chip8_config config = {&peripherals, memory, program, decode_cache, 1000};
+    chip8 cpu = chip8_init(&config);
+
+#ifdef CHIP8_INSTRUMENT
+    static chip8_stats stats_buffer;
+    chip8_stats *stats = &stats_buffer;
+    chip8_stats_attach(&cpu.state, stats);
+#endif
+    chip8_run_cycles(&cpu, 2 + 4 * 10);
+#ifdef CHIP8_INSTRUMENT
+    assert(stats->op_counts[SET_REG] == 1);
+    assert(stats->op_counts[DRAW_SPRITE] == 10);
+    assert(stats->op_counts[JUMP] == 10);
+    assert(stats->pc_counts[0x200] == 1 && stats->pc_counts[0x204] == 10);
+    // The same pixel is toggled on and off, colliding every other draw
+    assert(stats->draws == 10 && stats->collisions == 5);
+    assert(stats->callback_calls[INSTRUMENT_DISPLAY] == 10);
+    assert(stats->callback_calls[INSTRUMENT_RANDOM] == 10);
+    assert(stats->callback_calls[INSTRUMENT_IS_KEY_PRESSED] == 10);
+
+    chip8_stats_reset(stats);
+    assert(stats->op_counts[DRAW_SPRITE] == 0 && stats->pc_counts[0x204] == 0);
+#endif
+    chip8_run_cycles(&cpu, 4);
+#ifdef CHIP8_INSTRUMENT
+    assert(stats->op_counts[DRAW_SPRITE] == 1 && stats->draws == 1);
+
+    // Devices are only counted while counters are attached to them
+    chip8_stats_attach(&cpu.state, NULL);
+    chip8_run_cycles(&cpu, 4);
+    assert(stats->op_counts[DRAW_SPRITE] == 1 && stats->draws == 1);
+    assert(stats->callback_calls[INSTRUMENT_DISPLAY] == 1);
+    chip8_stats_attach(&cpu.state, stats);
+    chip8_run_cycles(&cpu, 4);
+    assert(stats->draws == 2);
+#endif
+    // Counting doesn't change what's run
+    assert(cpu.state.PC == 0x204);
+    assert(cpu.state.V[0xF] == 0);
+}
+
+#if CHIP8_TRACE_LEVEL > 0
+/**
+ * The blocks flushed from the trace buffer, one after another
+ */
+uint8_t flushed_trace[1024];
+size_t flushed_size;
+
+void trace_sink_stub(void *user, const uint8_t *block, uint16_t size)
+{
+    assert(user == &flushed_size);
+    assert(flushed_size + size <= sizeof(flushed_trace));
+    memcpy(&flushed_trace[flushed_size], block, size);
+    flushed_size += size;
+}
+#endif
+
+void test_trace()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0x60, 0x07, // 0x200: V[0] = 7
+        0xA3, 0x00, // 0x202: I = 0x300
+        0x70, 0x01, // 0x204: V[0] += 1
+        0x22, 0x04, // 0x206: CALL 0x204, until the stack overflows
+    };
+    uint8_t memory[RAM_SIZE];
+    peripherals peripherals = {0};
+    chip8_config config = {&peripherals, memory, program, NULL, 1000};
+    chip8 cpu = chip8_init(&config);
+
+#if CHIP8_TRACE_LEVEL > 0
+    trace_buffer trace;
+    flushed_size = 0;
+    chip8_trace_attach(&cpu.state, &trace, &trace_sink_stub, &flushed_size);
+
+    // Only the devices a buffer is attached to are traced into it
+    uint8_t untraced_memory[MEMORY_SIZE];
+    chip8_config untraced_config = {&peripherals, untraced_memory, program, NULL, 1000};
+    chip8 untraced = chip8_init(&untraced_config);
+    chip8_run_cycles(&untraced, 2);
+    assert(trace.count == 0);
+#endif
+
+    // The 15th call fills the stack, and the 16th overflows it, flushing the trace straight away
+    chip8_run_cycles(&cpu, 2 + 2 * 15);
+#if CHIP8_TRACE_LEVEL > 0
+    assert(flushed_size == 0);
+#endif
+    chip8_run_cycles(&cpu, 2);
+#if CHIP8_TRACE_LEVEL > 0
+    assert(flushed_size == TRACE_HEADER_SIZE + CHIP8_TRACE_ENTRIES * TRACE_ENTRY_SIZE ||
+           flushed_size == TRACE_HEADER_SIZE + 34 * TRACE_ENTRY_SIZE);
+    assert(memcmp(flushed_trace, TRACE_MAGIC, 4) == 0);
+    assert(flushed_trace[4] == CHIP8_TRACE_LEVEL && flushed_trace[5] == TRACE_ENTRY_SIZE);
+    assert(flushed_trace[6] == TRACE_STACK_OVERFLOW);
+    uint16_t count = flushed_trace[8] | (flushed_trace[9] << 8);
+    assert(flushed_size == TRACE_HEADER_SIZE + count * TRACE_ENTRY_SIZE);
+
+    // The newest entry is the CALL that overflowed, and the oldest the first instruction still held
+    uint8_t *newest = &flushed_trace[TRACE_HEADER_SIZE + (count - 1) * TRACE_ENTRY_SIZE];
+    assert(newest[0] == 0x06 && newest[1] == 0x02 && newest[2] == 0x22 && newest[3] == 0x04);
+    if (count == 34)
+    {
+        uint8_t *oldest = &flushed_trace[TRACE_HEADER_SIZE];
+        assert(oldest[0] == 0x00 && oldest[1] == 0x02 && oldest[2] == 0x60 && oldest[3] == 0x07);
+        assert(flushed_trace[7] == 0);
+    }
+#if CHIP8_TRACE_LEVEL >= 2
+    // Each entry holds V[X] and I once it has run
+    uint8_t *add = newest - TRACE_ENTRY_SIZE;
+    assert(add[2] == 0x70 && add[4] == 7 + 16 && add[6] == 0x00 && add[7] == 0x03);
+#endif
+
+    // Flushing on demand writes only what's been run since
+    flushed_size = 0;
+#endif
+    chip8_run_cycles(&cpu, 1);
+#if CHIP8_TRACE_LEVEL > 0
+    chip8_trace_flush(&trace, TRACE_REQUESTED);
+    assert(flushed_size == TRACE_HEADER_SIZE + TRACE_ENTRY_SIZE);
+    assert(flushed_trace[6] == TRACE_REQUESTED && flushed_trace[8] == 1);
+    assert(flushed_trace[TRACE_HEADER_SIZE + 2] == 0x70);
+    chip8_trace_attach(&cpu.state, NULL, NULL, NULL);
+#endif
+    // Tracing doesn't change what's run
+    assert(cpu.state.V[0] == 7 + 17);
+}
+
+void test_paged_memory()
+{
+#ifdef CHIP8_PAGED_MEMORY
+    uint8_t program[PROGRAM_SIZE] = {
+        0xA3, 0x00, // 0x200: I = 0x300
+        0x60, 0x7B, // 0x202: V[0] = 123
+        0xF0, 0x33, // 0x204: BCD of V[0] to 0x300
+        0xA2, 0x10, // 0x206: I = 0x210
+        0xF0, 0x55, // 0x208: Dump V[0] over the instruction at 0x210
+        0x60, 0x00, // 0x20A: V[0] = 0
+        0xA4, 0x00, // 0x20C: I = 0x400
+        0xF0, 0x55, // 0x20E: Dump V[0] to 0x400, which already reads as 0
+        0x00, 0x00, // 0x210: Rewritten to V[B] += 0
+        0xF0, 0x29, // 0x212: I = the sprite of digit 0
+        0xF1, 0x65, // 0x214: Load V[0] and V[1] from the sprite
+        0xA5, 0x00, // 0x216: I = 0x500
+        0xF1, 0x55, // 0x218: Dump V[0] and V[1] to 0x500
+        0xA6, 0x00, // 0x21A: I = 0x600
+        0xF1, 0x55, // 0x21C: Dump V[0] and V[1] to 0x600
+        0xA7, 0x00, // 0x21E: I = 0x700
+        0xF1, 0x55, // 0x220: Dump V[0] and V[1] to 0x700
+        0x12, 0x22, // 0x222: JUMP 0x222
+    };
+    uint8_t memory[MEMORY_SIZE];
+    peripherals peripherals = {
+        .display_region = &display_region_stub,
+        .present_mode = PRESENT_VBLANK,
+        .buzzer = &buzzer_stub,
+    };
+    chip8_config config = {&peripherals, memory, program, NULL, 5};
+    chip8 cpu = chip8_init(&config);
+    state *state = &cpu.state;
+
+    // Nothing's taken from the pool until it's written to
+    assert(state->pages_used == 0);
+    assert(MEMORY_READ(state, PROGRAM_OFFSET) == 0xA3);
+    assert(MEMORY_READ(state, DIGIT_SPRITES_OFFSET) == digit_sprites_data[0]);
+    assert(MEMORY_READ(state, 0xFFF) == 0);
+
+    chip8_run_cycles(&cpu, 3);
+    assert(state->pages_used == 1);
+    assert(MEMORY_READ(state, 0x300) == 1 && MEMORY_READ(state, 0x301) == 2 && MEMORY_READ(state, 0x302) == 3);
+
+    // The rest of a page that's copied still reads from the program image
+    chip8_run_cycles(&cpu, 2);
+    assert(state->pages_used == 2);
+    assert(MEMORY_READ(state, 0x210) == 0x7B && MEMORY_READ(state, 0x212) == 0xF0);
+    assert(program[0x10] == 0x00);
+
+    // Writing what's already there takes no page
+    chip8_run_cycles(&cpu, 3);
+    assert(state->pages_used == 2);
+
+    // The rewritten instruction is run
+    chip8_run_cycles(&cpu, 3);
+    assert(state->V[0] == digit_sprites_data[0] && state->V[1] == digit_sprites_data[1]);
+
+    uint8_t buffer[SNAPSHOT_SIZE];
+    assert(chip8_snapshot_into(&cpu, buffer, sizeof(buffer)) == SNAPSHOT_SIZE);
+
+    // With the default pool of 4 pages, the last dump doesn't fit and is dropped
+    chip8_run_cycles(&cpu, 6);
+    assert(state->pages_used == CHIP8_PAGE_POOL);
+    assert(MEMORY_READ(state, 0x601) == digit_sprites_data[1]);
+    assert(state->pool_exhausted);
+    assert(MEMORY_READ(state, 0x700) == 0);
+
+    // Restoring brings back the memory that was snapshot
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == 0);
+    assert(MEMORY_READ(state, 0x300) == 1 && MEMORY_READ(state, 0x210) == 0x7B);
+    assert(MEMORY_READ(state, 0x500) == 0 && MEMORY_READ(state, 0x600) == 0);
+    assert(state->pages_used == 2 && !state->pool_exhausted);
+
+    // A snapshot whose memory was written to more pages than the pool holds can't be restored
+    uint8_t *snapshot_memory = buffer + SNAPSHOT_SIZE - RAM_SIZE;
+    for (int page = 0; page <= CHIP8_PAGE_POOL; page++)
+        snapshot_memory[0x800 + page * MEMORY_PAGE_SIZE] = 0xEE;
+    assert(chip8_restore(&cpu, buffer, sizeof(buffer)) == -1);
+    assert(state->pool_exhausted);
+#endif
+}
+
+void test_reset()
+{
+    // The program is mapped from a file, and must fit in program memory
+    char path[] = "/tmp/chip8_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE *file = fdopen(fd, "wb");
+    fwrite(fixture_program, 1, FIXTURE_PROGRAM_SIZE, file);
+    fclose(file);
+    rom_image rom;
+    assert(rom_map(&rom, path) == 0);
+    assert(rom.size == FIXTURE_PROGRAM_SIZE);
+    assert(memcmp(rom.data, fixture_program, FIXTURE_PROGRAM_SIZE) == 0);
+
+    uint8_t program_memory[PROGRAM_SIZE];
+    assert(load_rom(path, program_memory) == FIXTURE_PROGRAM_SIZE);
+    assert(memcmp(program_memory, fixture_program, FIXTURE_PROGRAM_SIZE) == 0 &&
+           program_memory[FIXTURE_PROGRAM_SIZE] == 0);
+
+    uint8_t golden[RAM_SIZE];
+    rom_golden_image(&rom, golden);
+    rom_unmap(&rom);
+    assert(golden[PROGRAM_OFFSET] == 0x60 && golden[DIGIT_SPRITES_OFFSET] == digit_sprites_data[0]);
+    assert(golden[PROGRAM_OFFSET + FIXTURE_PROGRAM_SIZE] == 0);
+
+    file = fopen(path, "wb");
+    for (int i = 0; i <= PROGRAM_SIZE; i++)
+        fputc(0, file);
+    fclose(file);
+    assert(rom_map(&rom, path) == -1);
+    assert(load_rom(path, program_memory) == -1);
+    remove(path);
+    assert(rom_map(&rom, path) == -1);
+
+    static fixture fixture;
+    init_fixture(&fixture, golden + PROGRAM_OFFSET, 1, 5);
+    chip8 *cpu = &fixture.cpu;
+    chip8 *reference_cpu = &fixture.reference_cpu;
+
+    chip8_run_cycles(cpu, 103);
+    assert(cpu->state.buzzer_on);
+
+    // Reset, the device runs just as one that was initialized anew, once the host's random generator is too
+    buzzer_calls = 0;
+    chip8_reset(cpu, golden);
+    fixture.lane = (reference_lane){0, 1};
+    assert(buzzer_calls == 1 && !buzzer_sounding);
+    assert(cpu->state.PC == PROGRAM_OFFSET && cpu->state.SP == 0 && cpu->state.I == 0);
+    assert(cpu->state.dirty_top == 0 && cpu->state.dirty_bottom == LORES_SCREEN_H);
+#ifndef CHIP8_PAGED_MEMORY
+    assert(memcmp(fixture.memory, golden, RAM_SIZE) == 0);
+    // Only the decoded instructions of the blocks that were written to are invalidated
+    assert(fixture.decode_cache[0x240].type == JUMP);
+    assert(fixture.decode_cache[0x202].type == UNDECODED);
+    assert(fixture.decode_cache[0x300].type == UNDECODED);
+#endif
+
+    chip8_run_cycles(cpu, 250);
+    chip8_run_cycles(reference_cpu, 250);
+    assert(cpu->state.PC == reference_cpu->state.PC);
+    assert(memcmp(cpu->state.V, reference_cpu->state.V, REGISTER_COUNT) == 0);
+    assert(memcmp(cpu->state.screen, reference_cpu->state.screen, SCREEN_BYTES) == 0);
+    for (uint32_t address = 0; address < RAM_SIZE; address++)
+        assert(MEMORY_READ(&cpu->state, address) == MEMORY_READ(&reference_cpu->state, address));
+}
+
+/**
+ * Limits the address space to just past what is in use, so that no thread stack can be mapped and every
+ * worker thread fails to start. Returns the previous limit, to be restored @see setrlimit
+ */
+#ifdef __linux__
+struct rlimit limit_thread_stacks()
+{
+    struct rlimit previous;
+    assert(getrlimit(RLIMIT_AS, &previous) == 0);
+    FILE *statm = fopen("/proc/self/statm", "r");
+    unsigned long pages;
+    assert(statm != NULL && fscanf(statm, "%lu", &pages) == 1);
+    fclose(statm);
+    struct rlimit limited = {pages * 4096 + 512 * 1024, previous.rlim_max};
+    assert(setrlimit(RLIMIT_AS, &limited) == 0);
+    return previous;
+}
+#endif
+
+void test_pool()
+{
+    uint8_t program[PROGRAM_SIZE] = {
+        0xC0, 0x3F, // 0x200: V[0] = random & 0x3F
+        0xC1, 0x1F, // 0x202: V[1] = random & 0x1F
+        0xA2, 0x0C, // 0x204: I = 0x20C
+        0xD0, 0x14, // 0x206: Draw 4 rows at (V[0], V[1])
+        0xF0, 0x18, // 0x208: audio_timer = V[0]
+        0x12, 0x00, // 0x20A: JUMP 0x200
+        0xF0, 0x90, 0x90, 0xF0, // 0x20C: A square
+    };
+    enum { count = 48, frames = 40 };
+    uint64_t hashes[count];
+    uint32_t rng_states[count];
+    unsigned long draw_calls[count];
+
+    // Every instance is run the same, whether by one thread or by several taking and stealing from one another
+    for (int run = 0; run < 3; run++)
+    {
+        pool pool;
+        pool_stats stats;
+        assert(pool_init(&pool, count, run != 2) == 0);
+        for (uint32_t i = 0; i < count; i++)
+            // Some instances run many more cycles per frame, so that the workers finish their shares unevenly
+            pool_load(&pool, i, program, (i < count / 4) ? 200 : 10, i);
+
+        if (run == 0)
+            assert(pool_run(&pool, 1, frames, &stats) == 0);
+        else if (run == 1)
+        {
+#ifdef __linux__
+            // No worker thread starts, so the calling thread steals and runs the shares of every other worker.
+            // This runs before any thread has been started, as their stacks would be kept for reuse
+            struct rlimit previous = limit_thread_stacks();
+            int result = pool_run(&pool, 4, frames, &stats);
+            setrlimit(RLIMIT_AS, &previous);
+            assert(result == -1);
+            assert(stats.steals >= 3);
+#else
+            assert(pool_run(&pool, 3, frames, &stats) == 0);
+#endif
+        }
+        else
+            assert(pool_run(&pool, 4, frames, &stats) == 0);
+
+        assert(stats.frames == (unsigned long long)count * frames);
+        assert(stats.instructions == (unsigned long long)frames * (count / 4 * 200 + (count - count / 4) * 10));
+        for (uint32_t i = 0; i < count; i++)
+        {
+            pool_instance *instance = &pool.instances[i];
+            if (run == 0)
+            {
+                hashes[i] = hash_screen(instance->cpu.state.screen);
+                rng_states[i] = instance->rng_state;
+                draw_calls[i] = instance->draw_calls;
+                assert(draw_calls[i] > 0);
+                continue;
+            }
+            assert(hash_screen(instance->cpu.state.screen) == hashes[i]);
+            assert(instance->rng_state == rng_states[i]);
+            assert(instance->draw_calls == draw_calls[i]);
+        }
+        pool_free(&pool);
+    }
+}